@@ -0,0 +1,250 @@
+#include "BatchRenderer.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sys/stat.h>
+#include "OrderedWriter.h"
+#include "RecursiveExpander.h"
+#include "SpriteSymmetry.h"
+#include "ThreadPool.h"
+
+// One sprite on its way through the pool
+struct SpriteJob {
+    bool valid = false;
+    SpriteView sprite;
+    std::vector<Uint8> data;     // Storage for sprites read from loose files
+    Palette filePalette;
+    const Palette* palette = nullptr;
+};
+
+BatchRenderer::BatchRenderer(const BatchOptions& options)
+    : options(options), spritesRendered(0), secondsElapsed(0.0) {}
+
+bool BatchRenderer::collectInput() {
+    struct stat info;
+    if (stat(options.input.c_str(), &info) != 0) {
+        std::cerr << "No such input: " << options.input << std::endl;
+        return false;
+    }
+    
+    if (!S_ISDIR(info.st_mode)) {
+        return library.open(options.input);
+    }
+    
+    return SpriteFile::listDirectory(options.input, spriteFiles);
+}
+
+std::string BatchRenderer::getOutputPath(Uint64 index) const {
+    if (library.isOpen()) {
+        char name[32];
+        snprintf(name, sizeof(name), "%08llu.ppm", static_cast<unsigned long long>(index));
+        return options.outputDir + "/" + name;
+    }
+    
+    const std::string& path = spriteFiles[index];
+    size_t slash = path.find_last_of('/');
+    std::string name = path.substr(slash + 1, path.size() - slash - 1 - 4);
+    return options.outputDir + "/" + name + ".ppm";
+}
+
+bool BatchRenderer::run() {
+    if (!collectInput()) return false;
+    mkdir(options.outputDir.c_str(), 0755);
+    
+    Uint64 spriteCount = library.isOpen() ? library.getSpriteCount() : spriteFiles.size();
+    auto startTime = std::chrono::steady_clock::now();
+    
+    std::unique_ptr<ContentStore> store;
+    if (options.deduplicate) {
+        store = std::make_unique<ContentStore>(options.maxStoreBytes);
+    }
+    
+    OrderedWriter writer([this](Uint64 index, const std::vector<Uint8>& data) {
+        if (data.empty()) return true;  // Sprite could not be read, already reported
+        
+        std::string path = getOutputPath(index);
+        FILE* file = fopen(path.c_str(), "wb");
+        bool ok = file && fwrite(data.data(), 1, data.size(), file) == data.size();
+        ok = file && (fclose(file) == 0) && ok;
+        if (!ok) {
+            std::cerr << "Could not write " << path << std::endl;
+        }
+        return ok;
+    }, options.maxBytesInFlight);
+    
+    {
+        ThreadPool pool(options.threads);
+        
+        for (Uint64 index = 0; index < spriteCount && !writer.hasFailed(); index++) {
+            // Library sprites are views into the mapping; loose files are tiny and read here
+            auto job = std::make_shared<SpriteJob>();
+            if (library.isOpen()) {
+                job->valid = library.getSprite(index, job->sprite);
+                job->palette = &library.getSpritePalette(index);
+                if (!job->valid) {
+                    std::cerr << "Sprite " << index << " is corrupt, skipped" << std::endl;
+                }
+            } else {
+                job->valid = SpriteFile::read(spriteFiles[index], job->data, job->sprite, job->filePalette);
+                job->palette = &job->filePalette;
+            }
+            
+            // Outputs too large to hold are refused here, before any work is queued
+            size_t bytes = job->valid ? getImageBytes(job->sprite.gridSize, options.depth, options.scale) : 0;
+            if (job->valid && (bytes == 0 || bytes > MAX_IMAGE_BYTES)) {
+                std::cerr << "Sprite " << index << " (" << job->sprite.gridSize << "x" << job->sprite.gridSize
+                          << ") is too large to render at depth " << options.depth << ", skipped" << std::endl;
+                job->valid = false;
+                bytes = 0;
+            }
+            
+            // Reserve the output before queueing, this is what bounds memory in flight
+            writer.acquire(bytes);
+            
+            pool.submit([this, index, bytes, job, &writer, &store] {
+                std::vector<Uint8> image;
+                if (job->valid) {
+                    renderSprite(job->sprite, *job->palette, options.depth, options.scale, image, store.get());
+                }
+                writer.submit(index, std::move(image), bytes);
+            });
+        }
+        
+        pool.waitIdle();
+    }
+    writer.finish();
+    
+    spritesRendered = writer.getItemsWritten();
+    secondsElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    
+    double rate = (secondsElapsed > 0.0) ? spritesRendered / secondsElapsed : 0.0;
+    std::cout << "Rendered " << spritesRendered << " sprites in " << secondsElapsed << " s ("
+              << rate << " sprites/s, " << (writer.getBytesWritten() >> 20) << " MB written)" << std::endl;
+    if (store) {
+        std::cout << "Deduplication: " << store->getHits() << " renders reused, "
+                  << (store->getBytesStored() >> 20) << " MB stored" << std::endl;
+    }
+    
+    return !writer.hasFailed();
+}
+
+size_t BatchRenderer::getImageBytes(int gridSize, int depth, int scale) {
+    if (depth < 1 || scale < 1 || depth > RecursiveExpander::getMaxDepth(gridSize)) return 0;
+    
+    size_t size = 1;
+    for (int level = 0; level < depth; level++) {
+        size *= gridSize;
+    }
+    if (size > static_cast<size_t>(INT_MAX / scale)) return 0;
+    
+    // Encoded image plus the index image and its re-oriented copy
+    return size * size * scale * scale * 3 + 32 + 2 * size * size;
+}
+
+void BatchRenderer::renderSprite(const SpriteView& sprite, const Palette& palette, int depth, int scale,
+                                 std::vector<Uint8>& out, ContentStore* store) {
+    RecursiveExpander expander(sprite, depth);
+    int size = expander.getOutputSize();
+    int imageSize = size * scale;
+    
+    char header[32];
+    int headerLength = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", imageSize, imageSize);
+    out.resize(headerLength + static_cast<size_t>(imageSize) * imageSize * 3);
+    std::memcpy(out.data(), header, headerLength);
+    Uint8* pixels = out.data() + headerLength;
+    
+    // Index to RGB once per sprite; background shows palette color 0
+    Uint8 colors[256][3];
+    for (int i = 0; i < 256; i++) {
+        SDL_Color color = palette.getColor(i);
+        colors[i][0] = color.r;
+        colors[i][1] = color.g;
+        colors[i][2] = color.b;
+    }
+    
+    if (!store) {
+        // Expand in bands so the index buffer stays small for deep outputs
+        const int bandRows = 64;
+        std::vector<Uint8> band(static_cast<size_t>(size) * bandRows);
+        
+        for (int firstRow = 0; firstRow < size; firstRow += bandRows) {
+            int rows = std::min(bandRows, size - firstRow);
+            expander.expandRows(firstRow, rows, band.data(), size);
+            encodeRows(band.data(), size, firstRow, rows, colors, scale, pixels);
+        }
+        return;
+    }
+    
+    // Sprites equal up to rotation or reflection share one expansion of their
+    // canonical form; the encoded image is shared per orientation and palette.
+    // The symmetry search compares whole rows, so it takes one byte per index.
+    std::vector<Uint8> base(static_cast<size_t>(sprite.gridSize) * sprite.gridSize);
+    sprite.unpack(base.data());
+    CanonicalForm form;
+    SpriteSymmetry::canonicalize(base.data(), sprite.gridSize, form);
+    
+    std::vector<Uint8> imageKey = form.identity;
+    imageKey.push_back(static_cast<Uint8>(form.orientation));
+    Uint64 imageHash = form.hash ^ (static_cast<Uint64>(form.orientation + 1) * 0x9E3779B97F4A7C15ULL);
+    for (const SDL_Color& color : palette.getColors()) {
+        imageKey.push_back(color.r);
+        imageKey.push_back(color.g);
+        imageKey.push_back(color.b);
+        imageHash = (imageHash ^ ((color.r << 16) | (color.g << 8) | color.b)) * 0x100000001B3ULL;
+    }
+    
+    ContentStore::Blob image = store->getOrCreate(imageHash, imageKey, [&] {
+        ContentStore::Blob canonicalIndices = store->getOrCreate(form.hash, form.identity, [&] {
+            std::vector<Uint8> canonical(base.size());
+            SpriteSymmetry::transformImage(base.data(), sprite.gridSize, 1, form.orientation, canonical.data());
+            
+            RecursiveExpander canonicalExpander(canonical.data(), sprite.gridSize, depth);
+            std::vector<Uint8> indices(static_cast<size_t>(size) * size);
+            canonicalExpander.expandRows(0, size, indices.data(), size);
+            return indices;
+        });
+        
+        const Uint8* indices = canonicalIndices->data();
+        std::vector<Uint8> oriented;
+        if (form.orientation != 0) {
+            oriented.resize(canonicalIndices->size());
+            SpriteSymmetry::transformImage(indices, size, 1, SpriteSymmetry::inverse(form.orientation),
+                                           oriented.data());
+            indices = oriented.data();
+        }
+        
+        encodeRows(indices, size, 0, size, colors, scale, pixels);
+        return out;
+    });
+    
+    out.assign(image->begin(), image->end());
+}
+
+void BatchRenderer::encodeRows(const Uint8* indices, int size, int firstRow, int rowCount,
+                               const Uint8 colors[256][3], int scale, Uint8* pixels) {
+    size_t rowBytes = static_cast<size_t>(size) * scale * 3;
+    
+    for (int r = 0; r < rowCount; r++) {
+        const Uint8* rowIndices = indices + static_cast<size_t>(r) * size;
+        Uint8* row = pixels + static_cast<size_t>(firstRow + r) * scale * rowBytes;
+        
+        Uint8* target = row;
+        for (int x = 0; x < size; x++) {
+            const Uint8* rgb = colors[rowIndices[x]];
+            for (int s = 0; s < scale; s++) {
+                target[0] = rgb[0];
+                target[1] = rgb[1];
+                target[2] = rgb[2];
+                target += 3;
+            }
+        }
+        
+        for (int s = 1; s < scale; s++) {
+            std::memcpy(row + s * rowBytes, row, rowBytes);
+        }
+    }
+}
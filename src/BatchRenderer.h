@@ -0,0 +1,63 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "ContentStore.h"
+#include "Palette.h"
+#include "SpriteFile.h"
+#include "SpriteLibrary.h"
+
+struct BatchOptions {
+    std::string input;       // Sprite library (.rpl) or directory of .rps sprites
+    std::string outputDir;
+    int depth = 2;
+    int scale = 1;           // Each output pixel becomes scale x scale pixels
+    int threads = 0;         // 0 means one per hardware core
+    size_t maxBytesInFlight = static_cast<size_t>(256) << 20;
+    bool deduplicate = true;  // Render sprites equal up to rotation/reflection once
+    size_t maxStoreBytes = static_cast<size_t>(256) << 20;
+};
+
+// Renders the recursive output of every sprite in a library or directory.
+// Sprites that are equal up to rotation or reflection are expanded once.
+// Sprites are spread over a thread pool; finished images go through an
+// OrderedWriter, so files are written in input order on a separate thread
+// while memory held by rendered-but-unwritten images stays bounded.
+class BatchRenderer {
+public:
+    explicit BatchRenderer(const BatchOptions& options);
+    ~BatchRenderer() = default;
+
+    // Render everything; false if the input could not be read or a write failed
+    bool run();
+
+    Uint64 getSpritesRendered() const { return spritesRendered; }
+    double getSecondsElapsed() const { return secondsElapsed; }
+
+    // Encode the recursive output of a sprite as a binary PPM image. With a
+    // store, the expansion is shared by all sprites with the same canonical form.
+    static void renderSprite(const SpriteView& sprite, const Palette& palette, int depth, int scale,
+                             std::vector<Uint8>& out, ContentStore* store = nullptr);
+
+    // Bytes renderSprite() produces for a sprite of this size; 0 if the
+    // depth is past RecursiveExpander::getMaxDepth() or the scaled side
+    // would not fit in an int
+    static size_t getImageBytes(int gridSize, int depth, int scale);
+
+    // Largest image rendered in memory; deeper outputs are for --export
+    static const size_t MAX_IMAGE_BYTES = static_cast<size_t>(1) << 30;
+
+private:
+    BatchOptions options;
+    SpriteLibrary library;
+    std::vector<std::string> spriteFiles;  // Directory input, sorted
+    Uint64 spritesRendered;
+    double secondsElapsed;
+
+    bool collectInput();
+    
+    static void encodeRows(const Uint8* indices, int size, int firstRow, int rowCount,
+                           const Uint8 colors[256][3], int scale, Uint8* pixels);
+    std::string getOutputPath(Uint64 index) const;
+};
@@ -0,0 +1,89 @@
+#include "BlendTable.h"
+#include <algorithm>
+#include "CoverageTable.h"
+
+BlendTable::BlendTable() : mode(BlendMode::Source), colorCount(0) {}
+
+BlendTable::BlendTable(const Palette& palette, BlendMode mode)
+    : mode(mode), colorCount(0) {
+    // Source needs no table: blend() falls back to the parent's color
+    if (mode == BlendMode::Source) return;
+
+    colorCount = std::min(palette.getColorCount(), 256);
+    const Uint32* argb = palette.getARGBColors();
+    colors.assign(argb, argb + colorCount);
+    table.assign(static_cast<size_t>(colorCount) * colorCount, 0);
+
+    for (int parent = 0; parent < colorCount; parent++) {
+        SDL_Color p = palette.getColor(parent);
+        for (int child = 1; child < colorCount; child++) {
+            SDL_Color c = palette.getColor(child);
+            Uint8& entry = table[parent * colorCount + child];
+
+            if (parent == 0 || mode == BlendMode::Child) {
+                // A background parent never expands; keep the child for completeness
+                entry = static_cast<Uint8>(child);
+            } else if (mode == BlendMode::Multiply) {
+                entry = findNearest(p.r * c.r / 255.0f, p.g * c.g / 255.0f, p.b * c.b / 255.0f, palette);
+            } else if (mode == BlendMode::Screen) {
+                auto screen = [](Uint8 a, Uint8 b) { return 255.0f - (255 - a) * (255 - b) / 255.0f; };
+                entry = findNearest(screen(p.r, c.r), screen(p.g, c.g), screen(p.b, c.b), palette);
+            } else {
+                auto average = [](Uint8 a, Uint8 b) {
+                    float mean = (CoverageTable::srgbToLinear(a) + CoverageTable::srgbToLinear(b)) * 0.5f;
+                    return static_cast<float>(CoverageTable::linearToSrgb(mean));
+                };
+                entry = findNearest(average(p.r, c.r), average(p.g, c.g), average(p.b, c.b), palette);
+            }
+        }
+    }
+}
+
+bool BlendTable::matches(const Palette& palette, BlendMode mode) const {
+    if (mode != this->mode) return false;
+    if (mode == BlendMode::Source) return true;
+
+    int count = std::min(palette.getColorCount(), 256);
+    return count == colorCount && std::equal(colors.begin(), colors.end(), palette.getARGBColors());
+}
+
+Uint8 BlendTable::findNearest(float r, float g, float b, const Palette& palette) const {
+    // Index 0 is background, so a blended pixel never becomes it
+    int nearest = 1;
+    float nearestDistance = -1.0f;
+    for (int index = 1; index < colorCount; index++) {
+        SDL_Color color = palette.getColor(index);
+        float dr = color.r - r;
+        float dg = color.g - g;
+        float db = color.b - b;
+        float distance = dr * dr + dg * dg + db * db;
+        if (nearestDistance < 0.0f || distance < nearestDistance) {
+            nearest = index;
+            nearestDistance = distance;
+        }
+    }
+    return static_cast<Uint8>(nearest);
+}
+
+const char* BlendTable::getName(BlendMode mode) {
+    switch (mode) {
+        case BlendMode::Source: return "source";
+        case BlendMode::Child: return "child";
+        case BlendMode::Multiply: return "multiply";
+        case BlendMode::Screen: return "screen";
+        case BlendMode::Average: return "average";
+    }
+    return "source";
+}
+
+bool BlendTable::parseMode(const std::string& name, BlendMode& mode) {
+    const BlendMode modes[] = {BlendMode::Source, BlendMode::Child, BlendMode::Multiply,
+                               BlendMode::Screen, BlendMode::Average};
+    for (BlendMode candidate : modes) {
+        if (name == getName(candidate)) {
+            mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include "Palette.h"
+
+// How a copy of the grid is colored: every copy stands in for one pixel of
+// the level above (the parent) and repaints the grid's own pixels (children)
+enum class BlendMode {
+    Source,    // Flat in the parent's color (the classic look)
+    Child,     // The grid's own colors, repeated at every level
+    Multiply,
+    Screen,
+    Average    // Linear-light mean of the two colors
+};
+
+// Index-to-index composite of parent and child colors for one palette. The
+// blended color is snapped to the nearest palette color, so a composited
+// expansion is still a substitution over palette states: building the blocks
+// consults the table once per state and cell, and rendering at any depth
+// costs exactly what the flat mode costs. Background (index 0) stays
+// background, and no blend ever produces it.
+class BlendTable {
+public:
+    // Source mode, which needs no palette
+    BlendTable();
+    BlendTable(const Palette& palette, BlendMode mode);
+    ~BlendTable() = default;
+
+    BlendMode getMode() const { return mode; }
+
+    // Colors covered by the table; states past it blend as Source
+    int getColorCount() const { return colorCount; }
+
+    // State of a child pixel inside a copy of color parent
+    Uint8 blend(Uint8 parent, Uint8 child) const {
+        if (child == 0) return 0;
+        if (parent >= colorCount || child >= colorCount) return parent;
+        return table[parent * colorCount + child];
+    }
+
+    // True if this table was built from these colors in this mode
+    bool matches(const Palette& palette, BlendMode mode) const;
+
+    static const char* getName(BlendMode mode);
+
+    // Mode by name (source, child, multiply, screen, average); false if unknown
+    static bool parseMode(const std::string& name, BlendMode& mode);
+
+private:
+    BlendMode mode;
+    int colorCount;
+    std::vector<Uint32> colors;  // ARGB words the table was built from
+    std::vector<Uint8> table;    // colorCount x colorCount, parent major
+
+    Uint8 findNearest(float r, float g, float b, const Palette& palette) const;
+};
@@ -0,0 +1,311 @@
+#include "ColorAnalytics.h"
+#include <algorithm>
+#include <limits>
+
+double ColorCounts::getCoverage(int index) const {
+    if (total == 0 || index < 0 || index >= static_cast<int>(pixels.size())) return 0.0;
+    return static_cast<double>(pixels[index]) / static_cast<double>(total);
+}
+
+double ColorCounts::getFillDensity() const {
+    if (total == 0) return 0.0;
+    return static_cast<double>(getFilled()) / static_cast<double>(total);
+}
+
+ColorAnalytics::ColorAnalytics(const RecursiveExpander& expander, int maxDepth)
+    : baseSize(expander.getBaseSize()), stateCount(expander.getStateCount()) {
+    int limit = getMaxDepth(baseSize);
+    tableDepth = (maxDepth < 1 || maxDepth > limit) ? limit : maxDepth;
+
+    int cells = baseSize * baseSize;
+    base.resize(cells);
+    for (int i = 0; i < cells; i++) {
+        base[i] = expander.getBaseIndex(i % baseSize, i / baseSize);
+    }
+
+    blocks.resize(static_cast<size_t>(getSourceCount()) * cells);
+    transitions.assign(static_cast<size_t>(stateCount) * stateCount, 0);
+    for (int state = 0; state < stateCount; state++) {
+        const Uint8* block = expander.getBlock(state);
+        std::copy(block, block + cells, &blocks[static_cast<size_t>(state) * cells]);
+        for (int i = 0; i < cells; i++) {
+            transitions[static_cast<size_t>(state) * stateCount + block[i]]++;
+        }
+    }
+    std::copy(base.begin(), base.end(), &blocks[static_cast<size_t>(getRoot()) * cells]);
+
+    buildTables();
+}
+
+void ColorAnalytics::buildTables() {
+    int sources = getSourceCount();
+    size_t corners = static_cast<size_t>(baseSize + 1) * (baseSize + 1);
+
+    // Region queries are given up rather than allocate tables this large
+    size_t prefixBytes = static_cast<size_t>(sources) * corners * stateCount * sizeof(Uint32);
+    size_t matrixBytes = static_cast<size_t>(stateCount) * stateCount * sizeof(Uint64);
+    if (prefixBytes + static_cast<size_t>(tableDepth) * matrixBytes > MAX_TABLE_BYTES) {
+        tableDepth = 0;
+        return;
+    }
+
+    // 2D prefix sums of the states of every block's children
+    blockPrefix.assign(static_cast<size_t>(sources) * corners * stateCount, 0);
+    for (int source = 0; source < sources; source++) {
+        const Uint8* block = getBlock(source);
+        for (int j = 1; j <= baseSize; j++) {
+            for (int i = 1; i <= baseSize; i++) {
+                Uint32* target = const_cast<Uint32*>(getBlockPrefix(source, j, i));
+                const Uint32* above = getBlockPrefix(source, j - 1, i);
+                const Uint32* left = getBlockPrefix(source, j, i - 1);
+                const Uint32* diagonal = getBlockPrefix(source, j - 1, i - 1);
+                for (int state = 0; state < stateCount; state++) {
+                    target[state] = above[state] + left[state] - diagonal[state];
+                }
+                target[block[(j - 1) * baseSize + i - 1]]++;
+            }
+        }
+    }
+
+    // What one child expands to at each level
+    levelCounts.resize(tableDepth);
+    levelCounts[0] = identity();
+    for (int level = 1; level < tableDepth; level++) {
+        levelCounts[level] = multiply(transitions, levelCounts[level - 1]);
+    }
+}
+
+const Uint32* ColorAnalytics::getBlockPrefix(int source, int row, int column) const {
+    size_t corners = static_cast<size_t>(baseSize + 1) * (baseSize + 1);
+    size_t corner = static_cast<size_t>(source) * corners + static_cast<size_t>(row) * (baseSize + 1) + column;
+    return &blockPrefix[corner * stateCount];
+}
+
+void ColorAnalytics::addChildren(int source, int top, int left, int bottom, int right, Uint64 multiplicity,
+                                 std::vector<Uint64>& children) const {
+    if (top >= bottom || left >= right) return;
+
+    // Inclusion-exclusion over four corners; unsigned wraparound cancels out
+    const Uint32* full = getBlockPrefix(source, bottom, right);
+    const Uint32* leftPart = getBlockPrefix(source, bottom, left);
+    const Uint32* topPart = getBlockPrefix(source, top, right);
+    const Uint32* corner = getBlockPrefix(source, top, left);
+    for (int state = 0; state < stateCount; state++) {
+        Uint32 count = full[state] - leftPart[state] - topPart[state] + corner[state];
+        children[state] += multiplicity * count;
+    }
+}
+
+int ColorAnalytics::getMaxDepth(int baseSize) {
+    if (baseSize < 2) return 1;
+
+    // baseSize^(2 depth) pixels must stay below 2^64
+    int depth = 0;
+    Uint64 pixels = 1;
+    Uint64 cells = static_cast<Uint64>(baseSize) * baseSize;
+    while (pixels <= std::numeric_limits<Uint64>::max() / cells) {
+        pixels *= cells;
+        depth++;
+    }
+    return depth;
+}
+
+bool ColorAnalytics::countColors(int depth, ColorCounts& counts) const {
+    if (depth < 1 || depth > getMaxDepth(baseSize)) return false;
+
+    // Row vector of base counts times M^(depth - 1), by repeated squaring
+    Matrix result = identity();
+    Matrix square = transitions;
+    for (int exponent = depth - 1; exponent > 0; exponent >>= 1) {
+        if (exponent & 1) {
+            result = multiply(result, square);
+        }
+        if (exponent > 1) {
+            square = multiply(square, square);
+        }
+    }
+
+    counts.pixels.assign(stateCount, 0);
+    counts.total = 0;
+    for (Uint8 state : base) {
+        const Uint64* row = &result[static_cast<size_t>(state) * stateCount];
+        for (int color = 0; color < stateCount; color++) {
+            counts.pixels[color] += row[color];
+        }
+    }
+    for (Uint64 pixels : counts.pixels) {
+        counts.total += pixels;
+    }
+    return true;
+}
+
+bool ColorAnalytics::getOutputSize(int depth, Uint64& size) const {
+    if (depth < 1 || depth > tableDepth) return false;
+
+    size = 1;
+    for (int level = 0; level < depth; level++) {
+        size *= baseSize;
+    }
+    return true;
+}
+
+bool ColorAnalytics::countRegion(int depth, Uint64 x, Uint64 y, Uint64 width, Uint64 height,
+                                 ColorCounts& counts) const {
+    Uint64 size;
+    if (!getOutputSize(depth, size)) return false;
+    if (x > size || y > size || width > size - x || height > size - y) return false;
+
+    // Inclusion-exclusion over four prefix rectangles; unsigned wraparound cancels out
+    std::vector<Uint64> full = countPrefix(depth, x + width, y + height);
+    std::vector<Uint64> left = countPrefix(depth, x, y + height);
+    std::vector<Uint64> top = countPrefix(depth, x + width, y);
+    std::vector<Uint64> corner = countPrefix(depth, x, y);
+
+    counts.pixels.assign(stateCount, 0);
+    counts.total = 0;
+    for (int color = 0; color < stateCount; color++) {
+        counts.pixels[color] = full[color] - left[color] - top[color] + corner[color];
+        counts.total += counts.pixels[color];
+    }
+    return true;
+}
+
+bool ColorAnalytics::countGrid(int depth, Uint64 x, Uint64 y, Uint64 width, Uint64 height,
+                               int columns, int rows, std::vector<ColorCounts>& cells) const {
+    Uint64 size;
+    if (!getOutputSize(depth, size)) return false;
+    if (x > size || y > size || width > size - x || height > size - y) return false;
+    if (columns < 1 || rows < 1) return false;
+
+    // Cell edges at origin + extent * index / parts, split so the product
+    // cannot overflow at the deepest levels
+    auto edge = [](Uint64 origin, Uint64 extent, int index, int parts) {
+        Uint64 whole = extent / parts;
+        Uint64 rest = extent % parts;
+        return origin + whole * index + rest * index / parts;
+    };
+
+    // One prefix query per cell corner, a row of corners at a time
+    std::vector<std::vector<Uint64>> previous(columns + 1);
+    std::vector<std::vector<Uint64>> current(columns + 1);
+    cells.assign(static_cast<size_t>(columns) * rows, ColorCounts());
+    for (int j = 0; j <= rows; j++) {
+        Uint64 cornerY = edge(y, height, j, rows);
+        for (int i = 0; i <= columns; i++) {
+            current[i] = countPrefix(depth, edge(x, width, i, columns), cornerY);
+        }
+
+        if (j > 0) {
+            for (int i = 0; i < columns; i++) {
+                ColorCounts& cell = cells[static_cast<size_t>(j - 1) * columns + i];
+                cell.pixels.assign(stateCount, 0);
+                for (int color = 0; color < stateCount; color++) {
+                    cell.pixels[color] = current[i + 1][color] - current[i][color] -
+                                         previous[i + 1][color] + previous[i][color];
+                    cell.total += cell.pixels[color];
+                }
+            }
+        }
+        previous.swap(current);
+    }
+    return true;
+}
+
+std::vector<Uint64> ColorAnalytics::countPrefix(int depth, Uint64 x, Uint64 y) const {
+    std::vector<Uint64> counts(stateCount, 0);
+    if (x == 0 || y == 0) return counts;
+
+    Uint64 side = 1;  // Side of a child block at the current level
+    for (int level = 1; level < depth; level++) {
+        side *= baseSize;
+    }
+
+    // Multiplicity of each state among the nodes of the column strip (full
+    // height, cut at x) and the row strip (full width, cut at y) at this level
+    std::vector<Uint64> columnStrip(stateCount, 0);
+    std::vector<Uint64> rowStrip(stateCount, 0);
+    std::vector<Uint64> nextColumnStrip(stateCount);
+    std::vector<Uint64> nextRowStrip(stateCount);
+    std::vector<Uint64> children(stateCount);  // Whole children inside the prefix
+
+    int corner = getRoot();
+    for (int level = depth; level >= 1; level--) {
+        int column = static_cast<int>(x / side);
+        int row = static_cast<int>(y / side);
+        x %= side;
+        y %= side;
+
+        // Strip nodes: their whole child columns left of the cut (rows above it),
+        // and the cut column (row) of children goes on to the next level
+        std::fill(nextColumnStrip.begin(), nextColumnStrip.end(), 0);
+        std::fill(nextRowStrip.begin(), nextRowStrip.end(), 0);
+        std::fill(children.begin(), children.end(), 0);
+        for (int state = 0; state < stateCount; state++) {
+            Uint64 columnNodes = columnStrip[state];
+            if (columnNodes != 0) {
+                addChildren(state, 0, 0, baseSize, column, columnNodes, children);
+                addChildren(state, 0, column, baseSize, column + 1, columnNodes, nextColumnStrip);
+            }
+
+            Uint64 rowNodes = rowStrip[state];
+            if (rowNodes != 0) {
+                addChildren(state, 0, 0, row, baseSize, rowNodes, children);
+                addChildren(state, row, 0, row + 1, baseSize, rowNodes, nextRowStrip);
+            }
+        }
+
+        // The corner node: whole children above and left of the cut, then the
+        // children cut by only one edge start new strips
+        if (corner >= 0) {
+            addChildren(corner, 0, 0, row, column, 1, children);
+            if (column < baseSize) {
+                addChildren(corner, 0, column, row, column + 1, 1, nextColumnStrip);
+            }
+            if (row < baseSize) {
+                addChildren(corner, row, 0, row + 1, column, 1, nextRowStrip);
+            }
+            corner = (column < baseSize && row < baseSize) ? getBlock(corner)[row * baseSize + column] : -1;
+        }
+
+        // Whole children expand over the levels below this one
+        const Matrix& expansion = levelCounts[level - 1];
+        for (int state = 0; state < stateCount; state++) {
+            Uint64 multiplicity = children[state];
+            if (multiplicity == 0) continue;
+            const Uint64* expanded = &expansion[static_cast<size_t>(state) * stateCount];
+            for (int color = 0; color < stateCount; color++) {
+                counts[color] += multiplicity * expanded[color];
+            }
+        }
+
+        columnStrip.swap(nextColumnStrip);
+        rowStrip.swap(nextRowStrip);
+        side /= baseSize;
+    }
+
+    return counts;
+}
+
+ColorAnalytics::Matrix ColorAnalytics::multiply(const Matrix& a, const Matrix& b) const {
+    Matrix result(static_cast<size_t>(stateCount) * stateCount, 0);
+    for (int i = 0; i < stateCount; i++) {
+        Uint64* target = &result[static_cast<size_t>(i) * stateCount];
+        for (int k = 0; k < stateCount; k++) {
+            Uint64 factor = a[static_cast<size_t>(i) * stateCount + k];
+            if (factor == 0) continue;
+            const Uint64* row = &b[static_cast<size_t>(k) * stateCount];
+            for (int j = 0; j < stateCount; j++) {
+                target[j] += factor * row[j];
+            }
+        }
+    }
+    return result;
+}
+
+ColorAnalytics::Matrix ColorAnalytics::identity() const {
+    Matrix result(static_cast<size_t>(stateCount) * stateCount, 0);
+    for (int i = 0; i < stateCount; i++) {
+        result[static_cast<size_t>(i) * stateCount + i] = 1;
+    }
+    return result;
+}
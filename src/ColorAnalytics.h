@@ -0,0 +1,100 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include "RecursiveExpander.h"
+
+// Pixel counts of a recursive output, one per palette index
+struct ColorCounts {
+    std::vector<Uint64> pixels;
+    Uint64 total = 0;
+
+    // Pixels that are not background (index 0)
+    Uint64 getFilled() const { return total - (pixels.empty() ? 0 : pixels[0]); }
+
+    // Share of the counted pixels that have the given index
+    double getCoverage(int index) const;
+
+    // Share of the counted pixels that are not background
+    double getFillDensity() const;
+};
+
+// Color statistics of a depth-d output straight from the substitution,
+// without rasterizing. With M[s][t] the number of cells of state t in the
+// block of state s, the counts at depth d are the base's counts times
+// M^(d-1), computed by repeated squaring in O(states^3 log d).
+//
+// Rectangles are counted as summed-area queries: a prefix [0, x) x [0, y)
+// walks the digits of its corner from the top level down. The children above
+// and left of a cut are counted from 2D prefix tables of the states in every
+// block, and the column and row strips cut by the corner are carried down as
+// state multiplicities; the children's states of a level are summed first and
+// then expanded once, through M^(level-1). With the tables built once up to
+// maxDepth, a query costs O(depth x states^2) whatever the size of the
+// output. The tables take states^2 x (baseSize + 1)^2 x 4 bytes, plus
+// states^2 x 8 per level; past MAX_TABLE_BYTES they are not built, and only
+// whole-output counts are available.
+class ColorAnalytics {
+public:
+    explicit ColorAnalytics(const RecursiveExpander& expander, int maxDepth = 0);
+    ~ColorAnalytics() = default;
+
+    int getBaseSize() const { return baseSize; }
+    int getStateCount() const { return stateCount; }
+
+    // Deepest output whose pixel count still fits in 64 bits
+    static int getMaxDepth(int baseSize);
+
+    // Deepest output the region tables were built for, 0 if they would not fit
+    int getTableDepth() const { return tableDepth; }
+
+    // Pixels of each color in the whole depth-d output
+    bool countColors(int depth, ColorCounts& counts) const;
+
+    // Pixels of each color in [x, x + width) x [y, y + height) of the depth-d output
+    bool countRegion(int depth, Uint64 x, Uint64 y, Uint64 width, Uint64 height, ColorCounts& counts) const;
+
+    // Split a region into columns x rows cells (row-major) and count each one;
+    // shared cell corners are only queried once
+    bool countGrid(int depth, Uint64 x, Uint64 y, Uint64 width, Uint64 height, int columns, int rows,
+                   std::vector<ColorCounts>& cells) const;
+
+    static const size_t MAX_TABLE_BYTES = static_cast<size_t>(512) << 20;
+
+private:
+    using Matrix = std::vector<Uint64>;  // stateCount x stateCount, row-major
+
+    int baseSize;
+    int stateCount;
+    int tableDepth;
+    std::vector<Uint8> base;
+    std::vector<Uint8> blocks;  // stateCount blocks, then the base as a virtual root state
+    Matrix transitions;
+
+    // Per source (every state and the root), per child cell corner (j, i) in
+    // (baseSize + 1)^2: occurrences of every state among the children above
+    // and left of it
+    std::vector<Uint32> blockPrefix;
+
+    // Per level l >= 1: M^(l-1), the counts of a child's expansion at that level
+    std::vector<Matrix> levelCounts;
+
+    Matrix multiply(const Matrix& a, const Matrix& b) const;
+    Matrix identity() const;
+    void buildTables();
+
+    bool getOutputSize(int depth, Uint64& size) const;
+
+    // Counts in [0, x) x [0, y) of the depth-d output, x and y at most its size
+    std::vector<Uint64> countPrefix(int depth, Uint64 x, Uint64 y) const;
+
+    int getSourceCount() const { return stateCount + 1; }
+    int getRoot() const { return stateCount; }
+    const Uint8* getBlock(int source) const { return &blocks[static_cast<size_t>(source) * baseSize * baseSize]; }
+
+    const Uint32* getBlockPrefix(int source, int row, int column) const;
+
+    // Add multiplicity times the states of source's children in rows [top, bottom)
+    // and columns [left, right) to children
+    void addChildren(int source, int top, int left, int bottom, int right, Uint64 multiplicity,
+                     std::vector<Uint64>& children) const;
+};
@@ -0,0 +1,817 @@
+#include "CommandLine.h"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include "BatchRenderer.h"
+#include "BlendTable.h"
+#include "ColorAnalytics.h"
+#include "CoverageTable.h"
+#include "GifExporter.h"
+#include "ImageExporter.h"
+#include "RecursiveExpander.h"
+#include "SpriteFile.h"
+#include "SpriteLibrary.h"
+#include "TileExporter.h"
+#include "VideoExporter.h"
+
+namespace {
+
+// Replace every index of a packed grid in place through a table
+template <int BITS>
+void remapIndices(Uint8* indices, size_t count, const Uint8 remap[256]) {
+    for (size_t i = 0; i < count; i++) {
+        PackedIndices<BITS>::set(indices, i, remap[PackedIndices<BITS>::get(indices, i)]);
+    }
+}
+
+}
+
+bool CommandLine::isHeadless(int argc, char* argv[]) {
+    return argc > 1 && argv[1][0] == '-' && std::strcmp(argv[1], "--rule") != 0;
+}
+
+bool CommandLine::parseEditorArguments(int argc, char* argv[], int gridSize,
+                                       std::vector<std::vector<Uint8>>& rules) {
+    std::vector<std::string> ruleSpecs;
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (option != "--rule" || i + 1 >= argc) {
+            std::cerr << "The editor only takes --rule INDEX:sprite.rps, not " << option << std::endl;
+            printUsage();
+            return false;
+        }
+        ruleSpecs.push_back(argv[++i]);
+    }
+    // The editor's palette can still be replaced, and it draws any index
+    return loadRules(ruleSpecs, gridSize, Palette::MAX_COLORS, rules);
+}
+
+void CommandLine::printUsage() {
+    std::cout << "Usage:\n"
+              << "  pixelrecursor [--rule INDEX:sprite.rps ...]\n"
+              << "                                Start the editor\n"
+              << "  pixelrecursor --batch <library.rpl|directory> --out <directory>\n"
+              << "                [--depth N] [--scale N] [--threads N] [--memory MB]\n"
+              << "                [--store MB] [--no-dedupe]\n"
+              << "                                Render every sprite's recursive output\n"
+              << "  pixelrecursor --pack <directory> --out <library.rpl>\n"
+              << "                                Pack a directory of .rps sprites into a library\n"
+              << "  pixelrecursor --export <sprite.rps> --out <image.png|ppm|bmp|tga>\n"
+              << "                [--depth N] [--scale N] [--threads N] [--rgb] [--blend MODE]\n"
+              << "                                Write one large output straight to disk\n"
+              << "  pixelrecursor --tiles <sprite.rps> --out <image.dzi> [--depth N]\n"
+              << "                [--tile N] [--threads N] [--blend MODE]\n"
+              << "                                Deep Zoom tile pyramid with shared tiles\n"
+              << "  pixelrecursor --gif <sprite.rps> --out <animation.gif> [--depth N]\n"
+              << "                [--size N] [--fps N] [--threads N] [--blend MODE]\n"
+              << "                                One cycle of the pulsing animation\n"
+              << "  pixelrecursor --video <sprite.rps> --out <video.y4m|video.rgb|-> [--depth N]\n"
+              << "                [--width W] [--height H] [--fps N] [--seconds S]\n"
+              << "                [--format y4m|rgb] [--threads N] [--blend MODE]\n"
+              << "                                Stream the pulsing animation to an encoder\n"
+              << "  pixelrecursor --stats <sprite.rps> [--depth N] [--region X Y W H] [--blend MODE]\n"
+              << "                                Count the pixels of each color without rendering\n"
+              << "  pixelrecursor --thumbnail <sprite.rps> --out <image.ppm> [--depth N]\n"
+              << "                [--size N] [--region X Y W H] [--blend MODE]\n"
+              << "                                Area-averaged preview of any depth or region\n"
+              << "\n"
+              << "Blend modes color each copy from its own pixel and the grid's:\n"
+              << "  source (default), child, multiply, screen, average\n"
+              << "--rule INDEX:sprite.rps (repeatable) makes pixels of that color expand\n"
+              << "into the given grid instead of a copy of the sprite, in the editor's\n"
+              << "preview and in every mode that takes --blend\n"
+              << "--palette FILE replaces the sprite's colors with a GIMP palette (.gpl)\n"
+              << "or a list of RRGGBB hex colors (.hex), up to 256 of them, in every mode\n"
+              << "that takes --blend" << std::endl;
+}
+
+int CommandLine::run(int argc, char* argv[]) {
+    std::string mode = argv[1];
+    if (mode == "--help" || mode == "-h") {
+        printUsage();
+        return 0;
+    }
+    
+    if (mode == "--batch" && argc >= 3) {
+        return runBatch(argc, argv);
+    }
+    if (mode == "--pack" && argc >= 3) {
+        return runPack(argc, argv);
+    }
+    if (mode == "--export" && argc >= 3) {
+        return runExport(argc, argv);
+    }
+    if (mode == "--tiles" && argc >= 3) {
+        return runTiles(argc, argv);
+    }
+    if (mode == "--gif" && argc >= 3) {
+        return runGif(argc, argv);
+    }
+    if (mode == "--video" && argc >= 3) {
+        return runVideo(argc, argv);
+    }
+    if (mode == "--stats" && argc >= 3) {
+        return runStats(argc, argv);
+    }
+    if (mode == "--thumbnail" && argc >= 3) {
+        return runThumbnail(argc, argv);
+    }
+    
+    printUsage();
+    return 1;
+}
+
+int CommandLine::runBatch(int argc, char* argv[]) {
+    BatchOptions options;
+    options.input = argv[2];
+    
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--no-dedupe") {
+            options.deduplicate = false;
+            continue;
+        }
+        
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        const char* value = argv[++i];
+        
+        if (option == "--out") {
+            options.outputDir = value;
+        } else if (option == "--depth") {
+            options.depth = std::atoi(value);
+        } else if (option == "--scale") {
+            options.scale = std::atoi(value);
+        } else if (option == "--threads") {
+            options.threads = std::atoi(value);
+        } else if (option == "--memory") {
+            options.maxBytesInFlight = static_cast<size_t>(std::atoi(value)) << 20;
+        } else if (option == "--store") {
+            options.maxStoreBytes = static_cast<size_t>(std::atoi(value)) << 20;
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    
+    if (options.outputDir.empty() || options.depth < 1 || options.scale < 1) {
+        printUsage();
+        return 1;
+    }
+    
+    // Even the smallest grid cannot go deeper; sprite sizes are checked as they are read
+    if (options.depth > RecursiveExpander::getMaxDepth(2)) {
+        std::cerr << "Depth must be between 1 and " << RecursiveExpander::getMaxDepth(2) << std::endl;
+        return 1;
+    }
+    
+    BatchRenderer batch(options);
+    return batch.run() ? 0 : 1;
+}
+
+int CommandLine::runPack(int argc, char* argv[]) {
+    std::string outputPath;
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        const char* value = argv[++i];
+        
+        if (option == "--out") {
+            outputPath = value;
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    
+    if (outputPath.empty()) {
+        printUsage();
+        return 1;
+    }
+    
+    std::vector<std::string> paths;
+    SpriteLibraryWriter writer;
+    if (!SpriteFile::listDirectory(argv[2], paths) || !writer.open(outputPath)) {
+        return 1;
+    }
+    
+    // Sprites with the same colors share one palette
+    std::map<std::vector<Uint8>, int> paletteIndices;
+    for (const std::string& path : paths) {
+        std::vector<Uint8> data;
+        SpriteView sprite;
+        Palette palette;
+        if (!SpriteFile::read(path, data, sprite, palette)) {
+            return 1;
+        }
+        
+        const std::vector<SDL_Color>& colors = palette.getColors();
+        const Uint8* colorBytes = reinterpret_cast<const Uint8*>(colors.data());
+        std::vector<Uint8> key(colorBytes, colorBytes + colors.size() * sizeof(SDL_Color));
+        auto found = paletteIndices.find(key);
+        int paletteIndex = (found != paletteIndices.end()) ? found->second : writer.addPalette(palette);
+        if (paletteIndex < 0) {
+            std::cerr << "Too many different palettes for one library" << std::endl;
+            return 1;
+        }
+        paletteIndices.emplace(std::move(key), paletteIndex);
+        
+        if (!writer.addSprite(sprite, paletteIndex)) {
+            std::cerr << "Could not add " << path << " to " << outputPath << std::endl;
+            return 1;
+        }
+    }
+    
+    if (!writer.finish()) {
+        return 1;
+    }
+    std::cout << "Packed " << paths.size() << " sprites with " << paletteIndices.size() << " palettes into "
+              << outputPath << std::endl;
+    return 0;
+}
+
+int CommandLine::runExport(int argc, char* argv[]) {
+    ExportOptions options;
+    SpriteInput input;
+    
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--rgb") {
+            options.indexed = false;
+            continue;
+        }
+        
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        const char* value = argv[++i];
+        
+        OptionStatus status = parseSpriteOption(option, value, input);
+        if (status == OptionStatus::Invalid) return 1;
+        if (status == OptionStatus::Handled) continue;
+        
+        if (option == "--out") {
+            options.outputPath = value;
+        } else if (option == "--depth") {
+            options.depth = std::atoi(value);
+        } else if (option == "--scale") {
+            options.scale = std::atoi(value);
+        } else if (option == "--threads") {
+            options.threads = std::atoi(value);
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    
+    if (options.outputPath.empty() || options.depth < 1 || options.scale < 1) {
+        printUsage();
+        return 1;
+    }
+    
+    std::vector<Uint8> data;
+    SpriteView sprite;
+    Palette palette;
+    if (!loadSpriteInput(argv[2], input, data, sprite, palette, options.rules)) {
+        return 1;
+    }
+    options.blend = input.blend;
+    
+    ImageExporter exporter(options);
+    if (!exporter.run(sprite, palette)) {
+        return 1;
+    }
+    
+    double seconds = exporter.getSecondsElapsed();
+    double megapixels = static_cast<double>(exporter.getImageSize()) * exporter.getImageSize() / 1e6;
+    std::cout << std::fixed << std::setprecision(2)
+              << "Exported " << exporter.getImageSize() << " x " << exporter.getImageSize() << " to "
+              << options.outputPath << " (" << exporter.getFileBytes() / (1024.0 * 1024.0) << " MB) in "
+              << seconds << " s (" << (seconds > 0.0 ? megapixels / seconds : 0.0) << " Mpixels/s)" << std::endl;
+    return 0;
+}
+
+int CommandLine::runTiles(int argc, char* argv[]) {
+    TileOptions options;
+    SpriteInput input;
+    
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        const char* value = argv[++i];
+        
+        OptionStatus status = parseSpriteOption(option, value, input);
+        if (status == OptionStatus::Invalid) return 1;
+        if (status == OptionStatus::Handled) continue;
+        
+        if (option == "--out") {
+            options.outputPath = value;
+        } else if (option == "--depth") {
+            options.depth = std::atoi(value);
+        } else if (option == "--tile") {
+            options.tileSize = std::atoi(value);
+        } else if (option == "--threads") {
+            options.threads = std::atoi(value);
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    
+    if (options.outputPath.empty() || options.depth < 1) {
+        printUsage();
+        return 1;
+    }
+    
+    std::vector<Uint8> data;
+    SpriteView sprite;
+    Palette palette;
+    if (!loadSpriteInput(argv[2], input, data, sprite, palette, options.rules)) {
+        return 1;
+    }
+    options.blend = input.blend;
+    
+    TileExporter exporter(options);
+    if (!exporter.run(sprite, palette)) {
+        return 1;
+    }
+    
+    std::cout << std::fixed << std::setprecision(2)
+              << "Wrote " << exporter.getLevelCount() << " levels, " << exporter.getTilePositions()
+              << " tile positions from " << exporter.getTilesWritten() << " unique tiles ("
+              << exporter.getBytesWritten() / (1024.0 * 1024.0) << " MB) to " << options.outputPath << std::endl;
+    return 0;
+}
+
+int CommandLine::runGif(int argc, char* argv[]) {
+    GifOptions options;
+    SpriteInput input;
+    
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        const char* value = argv[++i];
+        
+        OptionStatus status = parseSpriteOption(option, value, input);
+        if (status == OptionStatus::Invalid) return 1;
+        if (status == OptionStatus::Handled) continue;
+        
+        if (option == "--out") {
+            options.outputPath = value;
+        } else if (option == "--depth") {
+            options.depth = std::atoi(value);
+        } else if (option == "--size") {
+            options.size = std::atoi(value);
+        } else if (option == "--fps") {
+            options.framesPerSecond = std::atoi(value);
+        } else if (option == "--threads") {
+            options.threads = std::atoi(value);
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    
+    if (options.outputPath.empty() || options.depth < 1 || options.size < 0) {
+        printUsage();
+        return 1;
+    }
+    
+    std::vector<Uint8> data;
+    SpriteView sprite;
+    Palette palette;
+    if (!loadSpriteInput(argv[2], input, data, sprite, palette, options.rules)) {
+        return 1;
+    }
+    options.blend = input.blend;
+    
+    GifExporter exporter(options);
+    if (!exporter.run(sprite, palette)) {
+        return 1;
+    }
+    
+    std::cout << std::fixed << std::setprecision(2)
+              << "Wrote " << exporter.getFrameCount() << " frames of " << exporter.getCanvasSize() << " x "
+              << exporter.getCanvasSize() << " (" << exporter.getBytesWritten() / (1024.0 * 1024.0)
+              << " MB) to " << options.outputPath << std::endl;
+    return 0;
+}
+
+int CommandLine::runVideo(int argc, char* argv[]) {
+    VideoOptions options;
+    SpriteInput input;
+    bool hasFormat = false;
+    
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        const char* value = argv[++i];
+        
+        OptionStatus status = parseSpriteOption(option, value, input);
+        if (status == OptionStatus::Invalid) return 1;
+        if (status == OptionStatus::Handled) continue;
+        
+        if (option == "--out") {
+            options.outputPath = value;
+        } else if (option == "--depth") {
+            options.depth = std::atoi(value);
+        } else if (option == "--width") {
+            options.width = std::atoi(value);
+        } else if (option == "--height") {
+            options.height = std::atoi(value);
+        } else if (option == "--fps") {
+            options.framesPerSecond = std::atoi(value);
+        } else if (option == "--seconds") {
+            options.seconds = static_cast<float>(std::atof(value));
+        } else if (option == "--format") {
+            if (std::strcmp(value, "y4m") == 0) {
+                options.format = VideoFormat::Y4M;
+            } else if (std::strcmp(value, "rgb") == 0) {
+                options.format = VideoFormat::RGB;
+            } else {
+                std::cerr << "Unknown video format " << value << std::endl;
+                return 1;
+            }
+            hasFormat = true;
+        } else if (option == "--threads") {
+            options.threads = std::atoi(value);
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    
+    if (options.outputPath.empty() || options.depth < 1) {
+        printUsage();
+        return 1;
+    }
+    if (!hasFormat && options.outputPath != "-" && !VideoExporter::getFormat(options.outputPath, options.format)) {
+        std::cerr << "Unknown video format for " << options.outputPath << " (use .y4m or .rgb)" << std::endl;
+        return 1;
+    }
+    
+    std::vector<Uint8> data;
+    SpriteView sprite;
+    Palette palette;
+    if (!loadSpriteInput(argv[2], input, data, sprite, palette, options.rules)) {
+        return 1;
+    }
+    options.blend = input.blend;
+    
+    VideoExporter exporter(options);
+    if (!exporter.run(sprite, palette)) {
+        return 1;
+    }
+    
+    // The video itself may be on standard output
+    std::ostream& report = (options.outputPath == "-") ? std::cerr : std::cout;
+    double seconds = exporter.getSecondsElapsed();
+    report << std::fixed << std::setprecision(2)
+           << "Wrote " << exporter.getFrameCount() << " frames of " << options.width << " x " << options.height
+           << " in " << seconds << " s (" << (seconds > 0.0 ? exporter.getFrameCount() / seconds : 0.0)
+           << " frames/s) to " << options.outputPath << std::endl;
+    return 0;
+}
+
+int CommandLine::runStats(int argc, char* argv[]) {
+    int depth = 2;
+    SpriteInput input;
+    bool hasRegion = false;
+    Uint64 region[4] = {0, 0, 0, 0};
+    
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--region") {
+            if (!parseRegion(argc, argv, i, region)) return 1;
+            hasRegion = true;
+            continue;
+        }
+        
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        const char* value = argv[++i];
+        
+        OptionStatus status = parseSpriteOption(option, value, input);
+        if (status == OptionStatus::Invalid) return 1;
+        if (status == OptionStatus::Handled) continue;
+        
+        if (option == "--depth") {
+            depth = std::atoi(value);
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    
+    std::vector<Uint8> data;
+    SpriteView sprite;
+    Palette palette;
+    std::vector<std::vector<Uint8>> rules;
+    if (!loadSpriteInput(argv[2], input, data, sprite, palette, rules)) {
+        return 1;
+    }
+    int gridSize = sprite.gridSize;
+    
+    if (depth < 1 || depth > ColorAnalytics::getMaxDepth(gridSize)) {
+        std::cerr << "Depth must be between 1 and " << ColorAnalytics::getMaxDepth(gridSize) << std::endl;
+        return 1;
+    }
+    
+    RecursiveExpander expander(sprite, 1, BlendTable(palette, input.blend), rules);
+    ColorAnalytics analytics(expander, depth);
+    if (hasRegion && analytics.getTableDepth() < depth) {
+        std::cerr << "Region counts of " << analytics.getStateCount() << " colors on a " << gridSize << " x "
+                  << gridSize << " grid need more than " << (ColorAnalytics::MAX_TABLE_BYTES >> 20)
+                  << " MB of tables" << std::endl;
+        return 1;
+    }
+    
+    ColorCounts counts;
+    bool counted = hasRegion
+        ? analytics.countRegion(depth, region[0], region[1], region[2], region[3], counts)
+        : analytics.countColors(depth, counts);
+    if (!counted) {
+        std::cerr << "Region lies outside the depth " << depth << " output" << std::endl;
+        return 1;
+    }
+    
+    Uint64 size = 1;
+    for (int level = 0; level < depth; level++) {
+        size *= gridSize;
+    }
+    std::cout << "Depth " << depth << ": " << size << " x " << size << " pixels";
+    if (hasRegion) {
+        std::cout << ", region " << region[2] << " x " << region[3] << " at " << region[0] << ", " << region[1];
+    }
+    std::cout << "\n";
+    
+    std::cout << std::fixed << std::setprecision(4)
+              << "Filled: " << counts.getFilled() << " (" << counts.getFillDensity() * 100.0 << "%)\n"
+              << "Index  Pixels                Coverage\n";
+    for (int index = 0; index < static_cast<int>(counts.pixels.size()); index++) {
+        if (counts.pixels[index] == 0) continue;
+        std::cout << std::setw(5) << index << "  " << std::setw(20) << std::left << counts.pixels[index]
+                  << std::right << "  " << counts.getCoverage(index) * 100.0 << "%\n";
+    }
+    std::cout.flush();
+    return 0;
+}
+
+int CommandLine::runThumbnail(int argc, char* argv[]) {
+    int depth = 2;
+    SpriteInput input;
+    int thumbnailSize = 256;
+    std::string outputPath;
+    bool hasRegion = false;
+    Uint64 region[4] = {0, 0, 0, 0};
+    
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--region") {
+            if (!parseRegion(argc, argv, i, region)) return 1;
+            hasRegion = true;
+            continue;
+        }
+        
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        const char* value = argv[++i];
+        
+        OptionStatus status = parseSpriteOption(option, value, input);
+        if (status == OptionStatus::Invalid) return 1;
+        if (status == OptionStatus::Handled) continue;
+        
+        if (option == "--out") {
+            outputPath = value;
+        } else if (option == "--depth") {
+            depth = std::atoi(value);
+        } else if (option == "--size") {
+            thumbnailSize = std::atoi(value);
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    
+    if (outputPath.empty() || thumbnailSize < 1 || thumbnailSize > 4096) {
+        printUsage();
+        return 1;
+    }
+    
+    std::vector<Uint8> data;
+    SpriteView sprite;
+    Palette palette;
+    std::vector<std::vector<Uint8>> rules;
+    if (!loadSpriteInput(argv[2], input, data, sprite, palette, rules)) {
+        return 1;
+    }
+    int gridSize = sprite.gridSize;
+    
+    if (depth < 1 || depth > ColorAnalytics::getMaxDepth(gridSize)) {
+        std::cerr << "Depth must be between 1 and " << ColorAnalytics::getMaxDepth(gridSize) << std::endl;
+        return 1;
+    }
+    
+    RecursiveExpander expander(sprite, 1, BlendTable(palette, input.blend), rules);
+    ColorAnalytics analytics(expander, depth);
+    if (analytics.getTableDepth() < depth) {
+        std::cerr << "Region counts of " << analytics.getStateCount() << " colors on a " << gridSize << " x "
+                  << gridSize << " grid need more than " << (ColorAnalytics::MAX_TABLE_BYTES >> 20)
+                  << " MB of tables" << std::endl;
+        return 1;
+    }
+    
+    if (!hasRegion) {
+        Uint64 size = 1;
+        for (int level = 0; level < depth; level++) {
+            size *= gridSize;
+        }
+        region[2] = size;
+        region[3] = size;
+    }
+    
+    // Never more thumbnail pixels than output pixels along an axis
+    int columns = static_cast<int>(std::min<Uint64>(thumbnailSize, region[2]));
+    int rows = static_cast<int>(std::min<Uint64>(thumbnailSize, region[3]));
+    
+    // Each thumbnail pixel is the exact mean of the output pixels it covers,
+    // taken in linear light; background shows the palette's background color
+    std::vector<ColorCounts> cells;
+    if (columns < 1 || rows < 1 ||
+        !analytics.countGrid(depth, region[0], region[1], region[2], region[3], columns, rows, cells)) {
+        std::cerr << "Region lies outside the depth " << depth << " output" << std::endl;
+        return 1;
+    }
+    
+    int stateCount = analytics.getStateCount();
+    std::vector<float> linear(static_cast<size_t>(stateCount) * 3);
+    for (int index = 0; index < stateCount; index++) {
+        SDL_Color color = palette.getColor(index);
+        linear[index * 3] = CoverageTable::srgbToLinear(color.r);
+        linear[index * 3 + 1] = CoverageTable::srgbToLinear(color.g);
+        linear[index * 3 + 2] = CoverageTable::srgbToLinear(color.b);
+    }
+    
+    char header[64];
+    int headerLength = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", columns, rows);
+    std::vector<Uint8> image(header, header + headerLength);
+    image.reserve(headerLength + cells.size() * 3);
+    for (const ColorCounts& cell : cells) {
+        float sum[3] = {0.0f, 0.0f, 0.0f};
+        for (int index = 0; index < stateCount; index++) {
+            float weight = static_cast<float>(cell.getCoverage(index));
+            for (int channel = 0; channel < 3; channel++) {
+                sum[channel] += weight * linear[index * 3 + channel];
+            }
+        }
+        for (int channel = 0; channel < 3; channel++) {
+            image.push_back(CoverageTable::linearToSrgb(sum[channel]));
+        }
+    }
+    
+    FILE* file = fopen(outputPath.c_str(), "wb");
+    bool ok = file && fwrite(image.data(), 1, image.size(), file) == image.size();
+    ok = file && (fclose(file) == 0) && ok;
+    if (!ok) {
+        std::cerr << "Could not write " << outputPath << std::endl;
+        return 1;
+    }
+    
+    std::cout << "Wrote " << columns << " x " << rows << " thumbnail of depth " << depth << " to "
+              << outputPath << std::endl;
+    return 0;
+}
+
+CommandLine::OptionStatus CommandLine::parseSpriteOption(const std::string& option, const char* value,
+                                                         SpriteInput& input) {
+    if (option == "--rule") {
+        input.ruleSpecs.push_back(value);
+    } else if (option == "--palette") {
+        input.palettePath = value;
+    } else if (option == "--blend") {
+        if (!BlendTable::parseMode(value, input.blend)) {
+            std::cerr << "Unknown blend mode " << value << std::endl;
+            return OptionStatus::Invalid;
+        }
+    } else {
+        return OptionStatus::Unknown;
+    }
+    return OptionStatus::Handled;
+}
+
+bool CommandLine::parseRegion(int argc, char* argv[], int& i, Uint64 region[4]) {
+    if (i + 4 >= argc) {
+        std::cerr << "--region takes X Y W H" << std::endl;
+        return false;
+    }
+    for (int k = 0; k < 4; k++) {
+        region[k] = std::strtoull(argv[++i], nullptr, 10);
+    }
+    return true;
+}
+
+bool CommandLine::loadSpriteInput(const char* path, const SpriteInput& input, std::vector<Uint8>& data,
+                                  SpriteView& sprite, Palette& palette, std::vector<std::vector<Uint8>>& rules) {
+    return SpriteFile::read(path, data, sprite, palette) &&
+           loadPalette(input.palettePath, data, sprite, palette) &&
+           loadRules(input.ruleSpecs, sprite.gridSize, palette.getColorCount(), rules);
+}
+
+bool CommandLine::loadPalette(const std::string& path, std::vector<Uint8>& data, const SpriteView& sprite,
+                              Palette& palette) {
+    if (path.empty()) return true;
+    
+    Palette loaded;
+    if (!Palette::loadFile(path, loaded)) {
+        return false;
+    }
+    
+    // Indices the new palette lacks take its nearest color, as replacing the editor's palette does
+    Uint8 remap[256];
+    for (int index = 0; index < 256; index++) {
+        remap[index] = static_cast<Uint8>((index < loaded.getColorCount())
+                                              ? index : loaded.findNearest(palette.getColor(index), 1));
+    }
+    size_t count = static_cast<size_t>(sprite.gridSize) * sprite.gridSize;
+    if (sprite.bitsPerIndex == 8) {
+        remapIndices<8>(data.data(), count, remap);
+    } else {
+        remapIndices<4>(data.data(), count, remap);
+    }
+    
+    palette = loaded;
+    return true;
+}
+
+bool CommandLine::loadRules(const std::vector<std::string>& specs, int gridSize, int colorCount,
+                            std::vector<std::vector<Uint8>>& rules) {
+    for (const std::string& spec : specs) {
+        size_t colon = spec.find(':');
+        int index = (colon == std::string::npos) ? -1 : std::atoi(spec.substr(0, colon).c_str());
+        if (index < 0 || index > 255) {
+            std::cerr << "Rules are given as INDEX:sprite.rps, not " << spec << std::endl;
+            return false;
+        }
+        
+        // A rule's own palette is ignored; its indices are colors of the main sprite
+        std::vector<Uint8> data;
+        SpriteView rule;
+        Palette rulePalette;
+        if (!SpriteFile::read(spec.c_str() + colon + 1, data, rule, rulePalette)) {
+            return false;
+        }
+        if (rule.gridSize != gridSize) {
+            std::cerr << "Rule " << spec << " is " << rule.gridSize << " x " << rule.gridSize << ", not "
+                      << gridSize << " x " << gridSize << std::endl;
+            return false;
+        }
+        
+        // Substitution looks rules up a whole block at a time, so they are kept a byte per index
+        std::vector<Uint8> cells(static_cast<size_t>(gridSize) * gridSize);
+        rule.unpack(cells.data());
+        int maxIndex = *std::max_element(cells.begin(), cells.end());
+        if (maxIndex >= colorCount) {
+            std::cerr << "Rule " << spec << " uses color " << maxIndex << ", the sprite's palette has "
+                      << colorCount << std::endl;
+            return false;
+        }
+        
+        if (rules.size() <= static_cast<size_t>(index)) {
+            rules.resize(index + 1);
+        }
+        rules[index] = std::move(cells);
+    }
+    return true;
+}
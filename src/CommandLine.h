@@ -0,0 +1,70 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include "BlendTable.h"
+#include "PackedIndices.h"
+#include "Palette.h"
+
+// Headless modes of the native build (batch rendering, exports), selected
+// by command-line arguments; without arguments the editor starts as usual.
+class CommandLine {
+public:
+    // True if the arguments ask for a headless mode instead of the editor
+    static bool isHeadless(int argc, char* argv[]);
+    
+    // Read the editor's own arguments (--rule INDEX:sprite.rps, repeatable)
+    // into per-color pattern grids for a grid of gridSize
+    static bool parseEditorArguments(int argc, char* argv[], int gridSize,
+                                     std::vector<std::vector<Uint8>>& rules);
+
+    // Run the requested mode; returns the process exit code
+    static int run(int argc, char* argv[]);
+
+private:
+    // Options every mode that renders one sprite takes
+    struct SpriteInput {
+        BlendMode blend = BlendMode::Source;
+        std::vector<std::string> ruleSpecs;  // --rule INDEX:sprite.rps
+        std::string palettePath;             // --palette FILE
+    };
+    
+    enum class OptionStatus {
+        Handled,  // A shared option, applied to the input
+        Unknown,  // Not a shared option; the mode handles it
+        Invalid   // A shared option with a bad value, already reported
+    };
+    
+    static void printUsage();
+    
+    // Apply --blend, --rule or --palette and its value to input
+    static OptionStatus parseSpriteOption(const std::string& option, const char* value, SpriteInput& input);
+    
+    // Read the four values of --region X Y W H after argv[i], advancing i past them
+    static bool parseRegion(int argc, char* argv[], int& i, Uint64 region[4]);
+    
+    static int runBatch(int argc, char* argv[]);
+    static int runPack(int argc, char* argv[]);
+    static int runStats(int argc, char* argv[]);
+    static int runThumbnail(int argc, char* argv[]);
+    static int runExport(int argc, char* argv[]);
+    static int runTiles(int argc, char* argv[]);
+    static int runGif(int argc, char* argv[]);
+    static int runVideo(int argc, char* argv[]);
+    
+    // Read a sprite file, then apply input's palette and rules to it, in that
+    // order, so rules are checked against the final palette; sprite points
+    // into data afterwards, still packed
+    static bool loadSpriteInput(const char* path, const SpriteInput& input, std::vector<Uint8>& data,
+                                SpriteView& sprite, Palette& palette, std::vector<std::vector<Uint8>>& rules);
+    
+    // Replace the palette with the one in a --palette file, moving indices past
+    // its end to its nearest color (sprite must point into data); true if path is empty
+    static bool loadPalette(const std::string& path, std::vector<Uint8>& data, const SpriteView& sprite,
+                            Palette& palette);
+    
+    // Read --rule specs (INDEX:sprite.rps) into per-color pattern grids whose
+    // indices are all below colorCount
+    static bool loadRules(const std::vector<std::string>& specs, int gridSize, int colorCount,
+                          std::vector<std::vector<Uint8>>& rules);
+};
@@ -0,0 +1,46 @@
+#include "ContentStore.h"
+
+ContentStore::ContentStore(size_t maxBytes)
+    : maxBytes(maxBytes), bytesStored(0), hits(0), misses(0) {}
+
+ContentStore::Blob ContentStore::getOrCreate(Uint64 hash, const std::vector<Uint8>& identity,
+                                             const MakeFunction& make) {
+    std::promise<Blob> promise;
+    std::shared_future<Blob> existing;
+    bool found = false;
+    bool stored = false;
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& bucket = entries[hash];
+        for (const auto& entry : bucket) {
+            if (entry.identity == identity) {
+                existing = entry.blob;
+                found = true;
+                break;
+            }
+        }
+        
+        if (found) {
+            hits++;
+        } else {
+            misses++;
+            if (bytesStored < maxBytes) {
+                bucket.push_back(Entry{identity, promise.get_future().share()});
+                stored = true;
+            }
+        }
+    }
+    
+    // Wait outside the lock, the first requester may still be producing it
+    if (found) {
+        return existing.get();
+    }
+    
+    Blob blob = std::make_shared<const std::vector<Uint8>>(make());
+    if (stored) {
+        bytesStored += blob->size() + identity.size();
+        promise.set_value(blob);
+    }
+    return blob;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Content-addressed store of immutable blobs (e.g. renders of canonical
+// grids). The first request for a key produces the blob; concurrent requests
+// for the same key wait for it instead of doing the work again. Keys are a
+// hash plus the exact identity bytes, so hash collisions cannot mix content.
+// Once maxBytes are stored, new blobs are still produced but no longer kept.
+class ContentStore {
+public:
+    using Blob = std::shared_ptr<const std::vector<Uint8>>;
+    using MakeFunction = std::function<std::vector<Uint8>()>;
+
+    explicit ContentStore(size_t maxBytes);
+    ~ContentStore() = default;
+
+    // Blob stored under (hash, identity), made with make() on first use
+    Blob getOrCreate(Uint64 hash, const std::vector<Uint8>& identity, const MakeFunction& make);
+
+    Uint64 getHits() const { return hits; }
+    Uint64 getMisses() const { return misses; }
+    size_t getBytesStored() const { return bytesStored; }
+
+private:
+    struct Entry {
+        std::vector<Uint8> identity;
+        std::shared_future<Blob> blob;
+    };
+
+    size_t maxBytes;
+    std::atomic<size_t> bytesStored;
+    std::atomic<Uint64> hits;
+    std::atomic<Uint64> misses;
+
+    std::mutex mutex;
+    std::unordered_map<Uint64, std::vector<Entry>> entries;
+};
@@ -0,0 +1,160 @@
+#include "CoverageTable.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// x^(1/5) for 0 <= x <= 1 by Newton's method, which approaches the root from above
+constexpr double fifthRoot(double x) {
+    if (x <= 0.0) return 0.0;
+    double y = 1.0;
+    while (true) {
+        double next = (4.0 * y + x / (y * y * y * y)) / 5.0;
+        if (next >= y) return y;
+        y = next;
+    }
+}
+
+// sRGB decoding; the power 2.4 is x^2 times the fifth root of x^2
+constexpr double decodeSrgb(double c) {
+    if (c <= 0.04045) return c / 12.92;
+    double x = (c + 0.055) / 1.055;
+    return x * x * fifthRoot(x * x);
+}
+
+// Both conversion tables, generated by the compiler
+struct SrgbTables {
+    float toLinear[256];
+    Uint8 toSrgb[4097];  // 4096 steps keep the darkest sRGB codes apart
+
+    constexpr SrgbTables() : toLinear(), toSrgb() {
+        for (int i = 0; i < 256; i++) {
+            toLinear[i] = static_cast<float>(decodeSrgb(i / 255.0));
+        }
+
+        // Encoding rounds to the nearest code, so code k starts where the
+        // decoded midpoint between k - 1 and k lies
+        double starts[256] = {};
+        for (int code = 1; code < 256; code++) {
+            starts[code] = decodeSrgb((code - 0.5) / 255.0);
+        }
+        int code = 0;
+        for (int i = 0; i <= 4096; i++) {
+            double c = i / 4096.0;
+            while (code < 255 && c >= starts[code + 1]) {
+                code++;
+            }
+            toSrgb[i] = static_cast<Uint8>(code);
+        }
+    }
+};
+
+alignas(64) constexpr SrgbTables SRGB_TABLES;
+
+}
+
+CoverageTable::CoverageTable(const RecursiveExpander& expander, const Palette& palette, int maxLevels)
+    : stateCount(expander.getStateCount()), maxLevels(std::max(0, maxLevels)) {
+    levels.resize(static_cast<size_t>(this->maxLevels + 1) * stateCount);
+
+    // Level 0 is the state's own color; index 0 is background
+    for (int state = 0; state < stateCount; state++) {
+        Coverage& coverage = levels[state];
+        if (state == 0) {
+            coverage = {0.0f, 0.0f, 0.0f, 0.0f};
+            continue;
+        }
+        SDL_Color color = palette.getColor(state);
+        float alpha = color.a / 255.0f;
+        coverage = {srgbToLinear(color.r) * alpha, srgbToLinear(color.g) * alpha,
+                    srgbToLinear(color.b) * alpha, alpha};
+    }
+
+    // One more level is the mean over the state's block of the previous level
+    int cells = expander.getBaseSize() * expander.getBaseSize();
+    float weight = 1.0f / cells;
+    for (int level = 1; level <= this->maxLevels; level++) {
+        const Coverage* previous = getLevel(level - 1);
+        Coverage* current = &levels[static_cast<size_t>(level) * stateCount];
+
+        for (int state = 0; state < stateCount; state++) {
+            const Uint8* block = expander.getBlock(state);
+            Coverage sum = {0.0f, 0.0f, 0.0f, 0.0f};
+            for (int i = 0; i < cells; i++) {
+                const Coverage& part = previous[block[i]];
+                sum.r += part.r;
+                sum.g += part.g;
+                sum.b += part.b;
+                sum.a += part.a;
+            }
+            current[state] = {sum.r * weight, sum.g * weight, sum.b * weight, sum.a * weight};
+        }
+    }
+}
+
+void CoverageTable::resolve(const Uint8* indices, int width, int rowCount, int levels, int factor,
+                            Uint32* out) const {
+    const Coverage* coverage = getLevel(std::max(0, std::min(levels, maxLevels)));
+
+    if (factor <= 1) {
+        std::vector<Uint32> colors(stateCount);
+        for (int state = 0; state < stateCount; state++) {
+            colors[state] = toARGB(coverage[state]);
+        }
+        size_t count = static_cast<size_t>(width) * rowCount;
+        for (size_t i = 0; i < count; i++) {
+            out[i] = colors[indices[i]];
+        }
+        return;
+    }
+
+    // Box filter factor x factor pixels; their coverages are already linear and premultiplied
+    int outputSize = width / factor;
+    float weight = 1.0f / (factor * factor);
+    std::vector<Coverage> row(outputSize);
+
+    for (int y = 0; y < rowCount; y++) {
+        std::fill(row.begin(), row.end(), Coverage{0.0f, 0.0f, 0.0f, 0.0f});
+        for (int sy = 0; sy < factor; sy++) {
+            const Uint8* source = indices + static_cast<size_t>(y * factor + sy) * width;
+            for (int x = 0; x < outputSize; x++) {
+                Coverage& sum = row[x];
+                for (int sx = 0; sx < factor; sx++) {
+                    const Coverage& part = coverage[source[x * factor + sx]];
+                    sum.r += part.r;
+                    sum.g += part.g;
+                    sum.b += part.b;
+                    sum.a += part.a;
+                }
+            }
+        }
+
+        Uint32* target = out + static_cast<size_t>(y) * outputSize;
+        for (int x = 0; x < outputSize; x++) {
+            const Coverage& sum = row[x];
+            target[x] = toARGB({sum.r * weight, sum.g * weight, sum.b * weight, sum.a * weight});
+        }
+    }
+}
+
+Uint32 CoverageTable::toARGB(const Coverage& coverage) {
+    if (coverage.a <= 0.0f) return 0;
+
+    // Encode the straight color, then premultiply the encoded value by coverage
+    float alpha = std::min(coverage.a, 1.0f);
+    float inverse = 1.0f / coverage.a;
+    auto channel = [&](float value) {
+        return static_cast<Uint32>(linearToSrgb(value * inverse) * alpha + 0.5f);
+    };
+    return (static_cast<Uint32>(alpha * 255.0f + 0.5f) << 24) |
+           (channel(coverage.r) << 16) | (channel(coverage.g) << 8) | channel(coverage.b);
+}
+
+float CoverageTable::srgbToLinear(Uint8 value) {
+    return SRGB_TABLES.toLinear[value];
+}
+
+Uint8 CoverageTable::linearToSrgb(float value) {
+    int index = static_cast<int>(std::max(0.0f, std::min(value, 1.0f)) * 4096.0f + 0.5f);
+    return SRGB_TABLES.toSrgb[index];
+}
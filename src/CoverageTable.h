@@ -0,0 +1,40 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include "Palette.h"
+#include "RecursiveExpander.h"
+
+// Mean color of the expansion of every state over 0..maxLevels substitution
+// levels, averaged in linear light with background counted as transparent.
+// A depth-d output can then be drawn at the resolution of depth k <= d: each
+// pixel of the depth-k expansion covers a baseSize^(d-k) square of the full
+// output, whose exact average is the coverage of its state over d-k levels.
+// Building the tables costs stateCount * baseSize^2 per level, whatever d is.
+class CoverageTable {
+public:
+    CoverageTable(const RecursiveExpander& expander, const Palette& palette, int maxLevels);
+    ~CoverageTable() = default;
+
+    int getMaxLevels() const { return maxLevels; }
+
+    // Resolve rowCount output rows of a depth-k index image (width wide) to
+    // premultiplied ARGB through the coverage over levels, averaging factor x
+    // factor pixels per output pixel (width % factor == 0)
+    void resolve(const Uint8* indices, int width, int rowCount, int levels, int factor, Uint32* out) const;
+
+    static float srgbToLinear(Uint8 value);
+    static Uint8 linearToSrgb(float value);
+
+private:
+    // Premultiplied linear RGB and coverage, per state
+    struct Coverage {
+        float r, g, b, a;
+    };
+
+    int stateCount;
+    int maxLevels;
+    std::vector<Coverage> levels;  // (maxLevels + 1) tables of stateCount entries
+
+    const Coverage* getLevel(int level) const { return &levels[static_cast<size_t>(level) * stateCount]; }
+    static Uint32 toARGB(const Coverage& coverage);
+};
@@ -0,0 +1,275 @@
+#include "EditHistory.h"
+#include <algorithm>
+
+EditHistory::EditHistory(int gridSize, int maxDeltas, int maxGroups,
+                         int keyframeInterval, int maxKeyframes, int maxPaletteChanges)
+    : gridSize(gridSize), keyframeInterval(std::max(1, keyframeInterval)),
+      deltaTail(0), deltaHead(0), groupBase(0), groupEnd(0), cursor(0),
+      groupPending(false), groupOverflow(false), applying(false),
+      paletteTail(0), paletteHead(0), nextKeyframe(0) {
+    // Everything is allocated here, recording and replaying never allocate
+    deltas.resize(std::max(1, maxDeltas));
+    groups.resize(std::max(1, maxGroups));
+    paletteChanges.resize(std::max(1, maxPaletteChanges));
+    for (auto& change : paletteChanges) {
+        change.before.reserve(Palette::MAX_COLORS);
+        change.after.reserve(Palette::MAX_COLORS);
+    }
+    keyframes.resize(std::max(1, maxKeyframes), Keyframe{0, false});
+    keyframePixels.resize(keyframes.size() * gridSize * gridSize, 0);
+}
+
+void EditHistory::beginGroup(const PixelEditor& editor) {
+    commitPendingGroup(editor);
+    groupOverflow = false;
+}
+
+void EditHistory::endGroup(const PixelEditor& editor) {
+    commitPendingGroup(editor);
+    groupOverflow = false;
+}
+
+void EditHistory::record(int x, int y, int oldColor, int newColor) {
+    if (applying || groupOverflow) return;
+    
+    openGroup();
+    
+    // Make room by forgetting the oldest groups
+    while (deltaHead - deltaTail >= deltas.size() && groupBase < groupEnd) {
+        evictOldestGroup();
+    }
+    
+    if (deltaHead - deltaTail >= deltas.size()) {
+        // This group alone outgrew the ring: it cannot be undone, so drop it.
+        // The grid no longer matches any stored position, neither do keyframes.
+        deltaHead = deltaTail = groupAt(groupEnd).firstDelta;
+        paletteHead = paletteTail = groupAt(groupEnd).firstPaletteChange;
+        groupPending = false;
+        groupOverflow = true;
+        for (auto& keyframe : keyframes) {
+            keyframe.valid = false;
+        }
+        return;
+    }
+    
+    Delta& delta = deltas[deltaHead % deltas.size()];
+    delta.position = static_cast<Uint16>(y * gridSize + x);
+    delta.oldColor = static_cast<Uint8>(oldColor);
+    delta.newColor = static_cast<Uint8>(newColor);
+    deltaHead++;
+    groupAt(groupEnd).deltaCount++;
+}
+
+void EditHistory::recordPalette(const Palette& before, const Palette& after) {
+    if (applying || groupOverflow) return;
+    
+    openGroup();
+    Group& group = groupAt(groupEnd);
+    if (group.changesPalette) {
+        // The group already starts from an earlier palette; only the end moves
+        paletteChanges[group.firstPaletteChange % paletteChanges.size()].after = after.getColors();
+        return;
+    }
+    
+    while (paletteHead - paletteTail >= paletteChanges.size() && groupBase < groupEnd) {
+        evictOldestGroup();
+    }
+    
+    PaletteChange& change = paletteChanges[paletteHead % paletteChanges.size()];
+    change.before = before.getColors();
+    change.after = after.getColors();
+    group.changesPalette = true;
+    paletteHead++;
+}
+
+bool EditHistory::undo(PixelEditor& editor, Palette& palette) {
+    commitPendingGroup(editor);
+    if (!canUndo()) return false;
+    
+    applying = true;
+    applyGroup(editor, palette, cursor - 1, false);
+    cursor--;
+    applying = false;
+    return true;
+}
+
+bool EditHistory::redo(PixelEditor& editor, Palette& palette) {
+    commitPendingGroup(editor);
+    if (!canRedo()) return false;
+    
+    applying = true;
+    applyGroup(editor, palette, cursor, true);
+    cursor++;
+    applying = false;
+    return true;
+}
+
+bool EditHistory::seek(PixelEditor& editor, Palette& palette, Uint64 position) {
+    commitPendingGroup(editor);
+    if (position < groupBase || position > groupEnd) return false;
+    
+    Uint64 walkCost = (position < cursor) ? countDeltas(position, cursor) : countDeltas(cursor, position);
+    
+    // The closest keyframe at or before the target may beat walking the deltas
+    int bestKeyframe = -1;
+    for (int i = 0; i < static_cast<int>(keyframes.size()); i++) {
+        const Keyframe& keyframe = keyframes[i];
+        if (keyframe.valid && keyframe.position >= groupBase && keyframe.position <= position &&
+            (bestKeyframe < 0 || keyframe.position > keyframes[bestKeyframe].position)) {
+            bestKeyframe = i;
+        }
+    }
+    
+    applying = true;
+    
+    if (bestKeyframe >= 0) {
+        Uint64 keyframePosition = keyframes[bestKeyframe].position;
+        Uint64 keyframeCost = static_cast<Uint64>(gridSize) * gridSize + countDeltas(keyframePosition, position);
+        
+        if (keyframeCost < walkCost) {
+            // Keyframes hold pixels only; the palette is walked there on its own
+            applyPalette(palette, cursor, keyframePosition);
+            const Uint8* pixels = &keyframePixels[static_cast<size_t>(bestKeyframe) * gridSize * gridSize];
+            for (int y = 0; y < gridSize; y++) {
+                for (int x = 0; x < gridSize; x++) {
+                    editor.setPixel(x, y, pixels[y * gridSize + x]);
+                }
+            }
+            cursor = keyframePosition;
+        }
+    }
+    
+    while (cursor > position) {
+        applyGroup(editor, palette, cursor - 1, false);
+        cursor--;
+    }
+    while (cursor < position) {
+        applyGroup(editor, palette, cursor, true);
+        cursor++;
+    }
+    
+    applying = false;
+    return true;
+}
+
+size_t EditHistory::getMemoryUsage() const {
+    return deltas.size() * sizeof(Delta) + groups.size() * sizeof(Group) +
+           paletteChanges.size() * 2 * Palette::MAX_COLORS * sizeof(SDL_Color) +
+           keyframes.size() * sizeof(Keyframe) + keyframePixels.size();
+}
+
+void EditHistory::commitPendingGroup(const PixelEditor& editor) {
+    if (!groupPending) return;
+    
+    groupEnd++;
+    cursor = groupEnd;
+    groupPending = false;
+    
+    if (cursor % keyframeInterval == 0) {
+        captureKeyframe(editor);
+    }
+}
+
+void EditHistory::openGroup() {
+    if (groupPending) return;
+    
+    // A new edit makes the undone groups unreachable
+    discardRedo();
+    if (groupEnd - groupBase >= groups.size()) {
+        evictOldestGroup();
+    }
+    groupAt(groupEnd) = Group{deltaHead, 0, false, paletteHead};
+    groupPending = true;
+}
+
+void EditHistory::discardRedo() {
+    if (cursor >= groupEnd) return;
+    
+    deltaHead = groupAt(cursor).firstDelta;
+    paletteHead = groupAt(cursor).firstPaletteChange;
+    groupEnd = cursor;
+    
+    for (auto& keyframe : keyframes) {
+        if (keyframe.position > cursor) {
+            keyframe.valid = false;
+        }
+    }
+}
+
+void EditHistory::evictOldestGroup() {
+    groupBase++;
+    
+    if (groupBase < groupEnd) {
+        deltaTail = groupAt(groupBase).firstDelta;
+        paletteTail = groupAt(groupBase).firstPaletteChange;
+    } else if (groupPending) {
+        deltaTail = groupAt(groupEnd).firstDelta;
+        paletteTail = groupAt(groupEnd).firstPaletteChange;
+    } else {
+        deltaTail = deltaHead;
+        paletteTail = paletteHead;
+    }
+}
+
+void EditHistory::applyGroup(PixelEditor& editor, Palette& palette, Uint64 index, bool forward) {
+    const Group& group = groupAt(index);
+    
+    if (group.changesPalette) {
+        const PaletteChange& change = paletteChanges[group.firstPaletteChange % paletteChanges.size()];
+        palette.setColors(forward ? change.after : change.before);
+    }
+    
+    if (forward) {
+        for (Uint32 i = 0; i < group.deltaCount; i++) {
+            const Delta& delta = deltas[(group.firstDelta + i) % deltas.size()];
+            editor.setPixel(delta.position % gridSize, delta.position / gridSize, delta.newColor);
+        }
+    } else {
+        // Reverse order, a stroke may touch the same pixel more than once
+        for (Uint32 i = group.deltaCount; i > 0; i--) {
+            const Delta& delta = deltas[(group.firstDelta + i - 1) % deltas.size()];
+            editor.setPixel(delta.position % gridSize, delta.position / gridSize, delta.oldColor);
+        }
+    }
+}
+
+void EditHistory::applyPalette(Palette& palette, Uint64 from, Uint64 to) {
+    // Only the change closest to the target matters
+    if (to < from) {
+        for (Uint64 index = to; index < from; index++) {
+            const Group& group = groupAt(index);
+            if (group.changesPalette) {
+                palette.setColors(paletteChanges[group.firstPaletteChange % paletteChanges.size()].before);
+                return;
+            }
+        }
+    } else {
+        for (Uint64 index = to; index > from; index--) {
+            const Group& group = groupAt(index - 1);
+            if (group.changesPalette) {
+                palette.setColors(paletteChanges[group.firstPaletteChange % paletteChanges.size()].after);
+                return;
+            }
+        }
+    }
+}
+
+Uint64 EditHistory::countDeltas(Uint64 from, Uint64 to) const {
+    Uint64 count = 0;
+    for (Uint64 index = from; index < to; index++) {
+        count += groupAt(index).deltaCount;
+    }
+    return count;
+}
+
+void EditHistory::captureKeyframe(const PixelEditor& editor) {
+    Uint8* pixels = &keyframePixels[static_cast<size_t>(nextKeyframe) * gridSize * gridSize];
+    for (int y = 0; y < gridSize; y++) {
+        for (int x = 0; x < gridSize; x++) {
+            pixels[y * gridSize + x] = static_cast<Uint8>(editor.getPixel(x, y));
+        }
+    }
+    
+    keyframes[nextKeyframe] = Keyframe{cursor, true};
+    nextKeyframe = (nextKeyframe + 1) % static_cast<int>(keyframes.size());
+}
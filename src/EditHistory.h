@@ -0,0 +1,113 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <vector>
+#include "Palette.h"
+#include "PixelEditor.h"
+
+// Undo/redo history stored as compact per-pixel deltas, grouped per stroke.
+// Deltas and groups live in fixed-size rings allocated up front, so recording,
+// undo and redo never allocate; when a ring is full the oldest groups are
+// forgotten. Every keyframeInterval groups a full copy of the grid is kept, so
+// seek() can jump far through the history without replaying every delta.
+// A group may also replace the palette (loading a sprite or a palette file);
+// those changes keep the colors before and after in a small ring of their own.
+class EditHistory {
+public:
+    EditHistory(int gridSize, int maxDeltas = 262144, int maxGroups = 16384,
+                int keyframeInterval = 64, int maxKeyframes = 16, int maxPaletteChanges = 64);
+    ~EditHistory() = default;
+
+    // Start a new undo step; changes recorded until endGroup() belong to it.
+    // Changes recorded outside begin/end pairs are collected into one step,
+    // closed here (editor is the current state, as for endGroup()).
+    void beginGroup(const PixelEditor& editor);
+
+    // Close the current undo step (editor is the state right after it)
+    void endGroup(const PixelEditor& editor);
+
+    // Record one pixel change; ignored while the history itself is applying changes
+    void record(int x, int y, int oldColor, int newColor);
+
+    // Record a palette replacement; several in one group count as one
+    void recordPalette(const Palette& before, const Palette& after);
+
+    // Step back or forward by one group; O(pixels changed by that group)
+    bool canUndo() const { return cursor > groupBase; }
+    bool canRedo() const { return cursor < groupEnd; }
+    bool undo(PixelEditor& editor, Palette& palette);
+    bool redo(PixelEditor& editor, Palette& palette);
+
+    // Move to any retained position (number of groups applied since the start)
+    bool seek(PixelEditor& editor, Palette& palette, Uint64 position);
+
+    // Positions currently reachable
+    Uint64 getPosition() const { return cursor; }
+    Uint64 getOldestPosition() const { return groupBase; }
+    Uint64 getNewestPosition() const { return groupEnd; }
+
+    // Bytes held by the rings and keyframes (fixed at construction)
+    size_t getMemoryUsage() const;
+
+private:
+    // 4 bytes per changed pixel: grids are at most 256x256
+    struct Delta {
+        Uint16 position;
+        Uint8 oldColor;
+        Uint8 newColor;
+    };
+
+    struct Group {
+        Uint64 firstDelta;          // Absolute index into the delta stream
+        Uint32 deltaCount;
+        bool changesPalette;        // Its palette change is at firstPaletteChange
+        Uint64 firstPaletteChange;  // Absolute index into the palette change stream
+    };
+
+    // Storage is reserved for MAX_COLORS entries, so replacing never allocates
+    struct PaletteChange {
+        std::vector<SDL_Color> before;
+        std::vector<SDL_Color> after;
+    };
+
+    struct Keyframe {
+        Uint64 position;
+        bool valid;
+    };
+
+    int gridSize;
+    int keyframeInterval;
+
+    std::vector<Delta> deltas;
+    Uint64 deltaTail;  // Oldest retained delta (absolute)
+    Uint64 deltaHead;  // Next delta to write (absolute)
+
+    std::vector<Group> groups;
+    Uint64 groupBase;  // Oldest group that can still be undone
+    Uint64 groupEnd;   // One past the newest group
+    Uint64 cursor;     // Groups currently applied; [cursor, groupEnd) can be redone
+
+    bool groupPending;   // The current group has recorded changes (stored at groupEnd)
+    bool groupOverflow;  // The open group outgrew the delta ring and is dropped
+    bool applying;       // Undo/redo/seek is writing pixels
+
+    std::vector<PaletteChange> paletteChanges;
+    Uint64 paletteTail;  // Oldest retained palette change (absolute)
+    Uint64 paletteHead;  // Next palette change to write (absolute)
+
+    std::vector<Keyframe> keyframes;
+    std::vector<Uint8> keyframePixels;
+    int nextKeyframe;
+
+    Group& groupAt(Uint64 index) { return groups[index % groups.size()]; }
+    const Group& groupAt(Uint64 index) const { return groups[index % groups.size()]; }
+
+    void commitPendingGroup(const PixelEditor& editor);
+    void openGroup();
+    void discardRedo();
+    void evictOldestGroup();
+    void applyGroup(PixelEditor& editor, Palette& palette, Uint64 index, bool forward);
+    void applyPalette(Palette& palette, Uint64 from, Uint64 to);
+    Uint64 countDeltas(Uint64 from, Uint64 to) const;
+    void captureKeyframe(const PixelEditor& editor);
+};
@@ -0,0 +1,12 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include "PixelEditor.h"
+#include "Palette.h"
+
+// Immutable copy of the document handed from the document thread to the renderer.
+// Slots are reused, so copying into one does not allocate once sizes match.
+struct EditorSnapshot {
+    PixelEditor editor;
+    Palette palette;
+    Uint64 sequence = 0;  // Increases by one with every published snapshot
+};
@@ -0,0 +1,288 @@
+#include "GifExporter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "OrderedWriter.h"
+#include "RecursiveExpander.h"
+#include "RecursiveRenderer.h"
+#include "ThreadPool.h"
+
+namespace {
+
+void appendWord(std::vector<Uint8>& out, int value) {
+    out.push_back(static_cast<Uint8>(value));
+    out.push_back(static_cast<Uint8>(value >> 8));
+}
+
+}
+
+GifExporter::GifExporter(const GifOptions& options)
+    : options(options), frameCount(0), canvasSize(0), bytesWritten(0), imageSize(0), displaySize(0) {}
+
+bool GifExporter::run(const SpriteView& sprite, const Palette& palette) {
+    if (options.framesPerSecond < 1 || options.framesPerSecond > 100) {
+        std::cerr << "Frame rate must be between 1 and 100" << std::endl;
+        return false;
+    }
+
+    RecursiveExpander expander(sprite, options.depth, BlendTable(palette, options.blend),
+                               options.rules);
+    imageSize = expander.getOutputSize();
+    if (imageSize > MAX_IMAGE_SIZE) {
+        std::cerr << "Depth " << options.depth << " is too deep to animate" << std::endl;
+        return false;
+    }
+    image.resize(static_cast<size_t>(imageSize) * imageSize);
+    expander.expandRows(0, imageSize, image.data(), imageSize);
+
+    // The pulse grows the image up to twice its size, around its center
+    displaySize = (options.size > 0) ? options.size : std::min(imageSize, 512);
+    canvasSize = displaySize * 2;
+    if (canvasSize > 65535) {
+        std::cerr << "GIF frames are limited to 65535 pixels per side" << std::endl;
+        return false;
+    }
+    frameCount = static_cast<int>(RecursiveRenderer::PULSE_PERIOD_SECONDS * options.framesPerSecond + 0.5f);
+
+    // Global color table: every state the image can hold, padded to a power
+    // of two; states past the palette take its fallback color
+    int colorCount = std::max(palette.getColorCount(), expander.getStateCount());
+    int colorBits = 1;
+    while ((1 << colorBits) < colorCount) {
+        colorBits++;
+    }
+
+    std::vector<Uint8> header = {'G', 'I', 'F', '8', '9', 'a'};
+    appendWord(header, canvasSize);
+    appendWord(header, canvasSize);
+    header.push_back(static_cast<Uint8>(0x80 | 0x70 | (colorBits - 1)));
+    header.push_back(0);  // Background index
+    header.push_back(0);  // Square pixels
+    for (int index = 0; index < (1 << colorBits); index++) {
+        SDL_Color color = palette.getColor(std::min(index, colorCount - 1));
+        header.push_back(color.r);
+        header.push_back(color.g);
+        header.push_back(color.b);
+    }
+
+    // Loop forever
+    const Uint8 loop[] = {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+                          0x03, 0x01, 0x00, 0x00, 0x00};
+    header.insert(header.end(), loop, loop + sizeof(loop));
+
+    std::string tempPath = options.outputPath + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Could not create " << tempPath << std::endl;
+        return false;
+    }
+    bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+
+    OrderedWriter writer([file](Uint64, const std::vector<Uint8>& data) {
+        return fwrite(data.data(), 1, data.size(), file) == data.size();
+    }, static_cast<size_t>(64) << 20);
+
+    if (ok) {
+        ThreadPool pool(options.threads);
+        size_t frameBytes = static_cast<size_t>(canvasSize) * canvasSize * 3;
+        for (int frame = 0; frame < frameCount && !writer.hasFailed(); frame++) {
+            writer.acquire(frameBytes);
+            pool.submit([this, frame, colorBits, frameBytes, &writer] {
+                // A frame that cannot be encoded is still submitted, empty, so its reservation is returned
+                std::vector<Uint8> data;
+                if (!encodeFrame(frame, colorBits, data)) {
+                    writer.fail();
+                    data.clear();
+                }
+                writer.submit(frame, std::move(data), frameBytes);
+            });
+        }
+        pool.waitIdle();
+    }
+    writer.finish();
+    ok = ok && !writer.hasFailed() && writer.getItemsWritten() == static_cast<Uint64>(frameCount);
+
+    ok = ok && fputc(0x3B, file) != EOF;  // Trailer
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(tempPath.c_str(), options.outputPath.c_str()) == 0;
+    if (!ok) {
+        std::cerr << "Could not write " << options.outputPath << std::endl;
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    bytesWritten = header.size() + writer.getBytesWritten() + 1;
+    return true;
+}
+
+void GifExporter::drawFrame(int frame, Uint8* canvas) const {
+    float seconds = static_cast<float>(frame) / options.framesPerSecond;
+    int size = static_cast<int>(displaySize * RecursiveRenderer::getPulseScale(seconds) + 0.5f);
+    size = std::min(size, canvasSize);
+    int offset = (canvasSize - size) / 2;
+
+    std::memset(canvas, 0, static_cast<size_t>(canvasSize) * canvasSize);
+
+    // Nearest sampling, as the editor draws exact renders
+    std::vector<int> columns(size);
+    for (int x = 0; x < size; x++) {
+        columns[x] = static_cast<int>(static_cast<long long>(x) * imageSize / size);
+    }
+    for (int y = 0; y < size; y++) {
+        const Uint8* source = &image[static_cast<size_t>(static_cast<long long>(y) * imageSize / size) * imageSize];
+        Uint8* target = canvas + static_cast<size_t>(offset + y) * canvasSize + offset;
+        for (int x = 0; x < size; x++) {
+            target[x] = source[columns[x]];
+        }
+    }
+}
+
+bool GifExporter::encodeFrame(int frame, int colorBits, std::vector<Uint8>& out) const {
+    size_t pixels = static_cast<size_t>(canvasSize) * canvasSize;
+    std::vector<Uint8> current(pixels);
+    drawFrame(frame, current.data());
+
+    // Bounding rectangle of the pixels that differ from the previous frame
+    int left = 0;
+    int top = 0;
+    int right = canvasSize;
+    int bottom = canvasSize;
+    if (frame > 0) {
+        std::vector<Uint8> previous(pixels);
+        drawFrame(frame - 1, previous.data());
+
+        left = canvasSize;
+        top = canvasSize;
+        right = 0;
+        bottom = 0;
+        for (int y = 0; y < canvasSize; y++) {
+            const Uint8* a = &current[static_cast<size_t>(y) * canvasSize];
+            const Uint8* b = &previous[static_cast<size_t>(y) * canvasSize];
+            if (std::memcmp(a, b, canvasSize) == 0) continue;
+
+            int first = 0;
+            while (a[first] == b[first]) first++;
+            int last = canvasSize - 1;
+            while (a[last] == b[last]) last--;
+
+            left = std::min(left, first);
+            right = std::max(right, last + 1);
+            top = std::min(top, y);
+            bottom = y + 1;
+        }
+
+        // Nothing changed: a single unchanged pixel keeps the frame's timing
+        if (right <= left) {
+            left = 0;
+            top = 0;
+            right = 1;
+            bottom = 1;
+        }
+    }
+
+    int width = right - left;
+    int height = bottom - top;
+    std::vector<Uint8> region(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++) {
+        std::memcpy(&region[static_cast<size_t>(y) * width],
+                    &current[static_cast<size_t>(top + y) * canvasSize + left], width);
+    }
+
+    // Delays are in hundredths of a second, rounded so the cycle keeps its length
+    int delay = static_cast<int>(std::lround((frame + 1) * 100.0 / options.framesPerSecond) -
+                                 std::lround(frame * 100.0 / options.framesPerSecond));
+
+    // Graphic control: keep the previous frame under this one
+    const Uint8 control[] = {0x21, 0xF9, 0x04, 0x04};
+    out.insert(out.end(), control, control + sizeof(control));
+    appendWord(out, delay);
+    out.push_back(0);  // No transparent index
+    out.push_back(0);
+
+    out.push_back(0x2C);
+    appendWord(out, left);
+    appendWord(out, top);
+    appendWord(out, width);
+    appendWord(out, height);
+    out.push_back(0);  // No local color table, not interlaced
+
+    return encodeLzw(region.data(), region.size(), std::max(2, colorBits), out);
+}
+
+bool GifExporter::encodeLzw(const Uint8* pixels, size_t count, int minimumCodeSize, std::vector<Uint8>& out) {
+    int alphabet = 1 << minimumCodeSize;
+    int clearCode = alphabet;
+    int endCode = alphabet + 1;
+
+    // Dictionary as a dense table: the code extending `code` by `pixel` is
+    // next[code * alphabet + pixel], 0 if there is none yet
+    std::vector<Uint16> next(static_cast<size_t>(MAX_CODES) * alphabet, 0);
+    int lastCode = endCode;
+    int codeSize = minimumCodeSize + 1;
+
+    std::vector<Uint8> data;
+    Uint32 bitBuffer = 0;
+    int bitCount = 0;
+    auto emit = [&](int code) {
+        bitBuffer |= static_cast<Uint32>(code) << bitCount;
+        bitCount += codeSize;
+        while (bitCount >= 8) {
+            data.push_back(static_cast<Uint8>(bitBuffer));
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+    };
+
+    // An index past the alphabet has no code, and would address past the dictionary
+    for (size_t i = 0; i < count; i++) {
+        if (pixels[i] >= alphabet) {
+            std::cerr << "Color " << static_cast<int>(pixels[i]) << " does not fit a " << minimumCodeSize
+                      << "-bit GIF color table" << std::endl;
+            return false;
+        }
+    }
+
+    emit(clearCode);
+    if (count > 0) {
+        int code = pixels[0];
+        for (size_t i = 1; i < count; i++) {
+            int pixel = pixels[i];
+            Uint16& entry = next[static_cast<size_t>(code) * alphabet + pixel];
+            if (entry != 0) {
+                code = entry;
+                continue;
+            }
+
+            emit(code);
+            entry = static_cast<Uint16>(++lastCode);
+            if (lastCode >= (1 << codeSize)) {
+                codeSize++;
+            }
+            if (lastCode == MAX_CODES - 1) {
+                // Dictionary full: start over
+                emit(clearCode);
+                std::fill(next.begin(), next.end(), 0);
+                lastCode = endCode;
+                codeSize = minimumCodeSize + 1;
+            }
+            code = pixel;
+        }
+        emit(code);
+    }
+    emit(endCode);
+    if (bitCount > 0) {
+        data.push_back(static_cast<Uint8>(bitBuffer));
+    }
+
+    // Sub-blocks of at most 255 bytes, then an empty one
+    out.push_back(static_cast<Uint8>(minimumCodeSize));
+    for (size_t offset = 0; offset < data.size(); offset += 255) {
+        size_t length = std::min<size_t>(255, data.size() - offset);
+        out.push_back(static_cast<Uint8>(length));
+        out.insert(out.end(), data.begin() + offset, data.begin() + offset + length);
+    }
+    out.push_back(0);
+    return true;
+}
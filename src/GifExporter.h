@@ -0,0 +1,60 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "BlendTable.h"
+#include "PackedIndices.h"
+#include "Palette.h"
+
+struct GifOptions {
+    std::string outputPath;
+    int depth = 2;
+    int size = 0;            // Side of the image at the smallest pulse; 0 means the output size up to 512
+    int framesPerSecond = 25;
+    int threads = 0;         // 0 means one per hardware core
+    BlendMode blend = BlendMode::Source;
+    std::vector<std::vector<Uint8>> rules;  // Pattern grid per color, empty for a copy of the sprite
+};
+
+// Records one full cycle of the editor's pulsing animation as a looping GIF.
+// Frames are drawn from palette indices with the palette as the global color
+// table, so nothing is quantized. Each frame is drawn and compressed on the
+// thread pool (alongside the frame before it, to find what changed) and only
+// the bounding rectangle of the changed pixels is stored; frames reach the
+// file in order through an OrderedWriter.
+class GifExporter {
+public:
+    explicit GifExporter(const GifOptions& options);
+    ~GifExporter() = default;
+
+    bool run(const SpriteView& sprite, const Palette& palette);
+
+    int getFrameCount() const { return frameCount; }
+    int getCanvasSize() const { return canvasSize; }
+    Uint64 getBytesWritten() const { return bytesWritten; }
+
+private:
+    static const int MAX_CODES = 4096;        // LZW codes are at most 12 bits
+    static const int MAX_IMAGE_SIZE = 4096;   // Deepest output that is animated
+
+    GifOptions options;
+    int frameCount;
+    int canvasSize;
+    Uint64 bytesWritten;
+
+    // The index image, displayed at its pulse size in the middle of the canvas
+    std::vector<Uint8> image;
+    int imageSize;
+    int displaySize;
+
+    // Draw frame into canvas x canvas indices; background is index 0
+    void drawFrame(int frame, Uint8* canvas) const;
+
+    // Graphic control extension, image descriptor and LZW data of one frame;
+    // false if the frame holds an index the color table does not cover
+    bool encodeFrame(int frame, int colorBits, std::vector<Uint8>& out) const;
+
+    // False, with nothing usable in out, if a pixel is not below 2^minimumCodeSize
+    static bool encodeLzw(const Uint8* pixels, size_t count, int minimumCodeSize, std::vector<Uint8>& out);
+};
@@ -0,0 +1,311 @@
+#include "ImageExporter.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "PngWriter.h"
+#include "ThreadPool.h"
+
+namespace {
+
+void writeLittleEndian(Uint8* target, Uint32 value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        target[i] = static_cast<Uint8>(value >> (i * 8));
+    }
+}
+
+}
+
+ImageExporter::ImageExporter(const ExportOptions& options)
+    : options(options), format(ImageFormat::PPM), imageSize(0), fileBytes(0), secondsElapsed(0.0) {}
+
+bool ImageExporter::getFormat(const std::string& path, ImageFormat& format) {
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return false;
+
+    std::string extension = path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (extension == "ppm") {
+        format = ImageFormat::PPM;
+    } else if (extension == "bmp") {
+        format = ImageFormat::BMP;
+    } else if (extension == "tga") {
+        format = ImageFormat::TGA;
+    } else if (extension == "png") {
+        format = ImageFormat::PNG;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool ImageExporter::planLayout(Layout& layout) const {
+    size_t size = static_cast<size_t>(imageSize);
+    layout.rowBytes = size * 3;
+    layout.bottomUp = false;
+    layout.bgr = false;
+
+    switch (format) {
+    case ImageFormat::PPM: {
+        char header[64];
+        layout.headerBytes = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", imageSize, imageSize);
+        break;
+    }
+    case ImageFormat::BMP:
+        layout.headerBytes = 54;
+        layout.rowBytes = (layout.rowBytes + 3) & ~static_cast<size_t>(3);
+        layout.bottomUp = true;
+        layout.bgr = true;
+        break;
+    case ImageFormat::PNG:
+        return false;
+    case ImageFormat::TGA:
+        if (imageSize > TGA_MAX_SIZE) {
+            std::cerr << "TGA images are limited to " << TGA_MAX_SIZE << " pixels per side" << std::endl;
+            return false;
+        }
+        layout.headerBytes = 18;
+        layout.bgr = true;
+        break;
+    }
+
+    if (layout.rowBytes > (SIZE_MAX - layout.headerBytes) / size) {
+        std::cerr << "Image is too large to map" << std::endl;
+        return false;
+    }
+    if (format == ImageFormat::BMP && layout.headerBytes + layout.rowBytes * size > 0xFFFFFFFFu) {
+        std::cerr << "BMP files are limited to 4 GB, use PPM instead" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void ImageExporter::writeHeader(Uint8* file) const {
+    switch (format) {
+    case ImageFormat::PPM: {
+        char header[64];
+        int length = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", imageSize, imageSize);
+        std::memcpy(file, header, length);
+        break;
+    }
+    case ImageFormat::BMP: {
+        // BITMAPFILEHEADER then BITMAPINFOHEADER, rows bottom-up
+        std::memset(file, 0, 54);
+        file[0] = 'B';
+        file[1] = 'M';
+        writeLittleEndian(file + 2, static_cast<Uint32>(fileBytes), 4);
+        writeLittleEndian(file + 10, 54, 4);
+        writeLittleEndian(file + 14, 40, 4);
+        writeLittleEndian(file + 18, static_cast<Uint32>(imageSize), 4);
+        writeLittleEndian(file + 22, static_cast<Uint32>(imageSize), 4);
+        writeLittleEndian(file + 26, 1, 2);
+        writeLittleEndian(file + 28, 24, 2);
+        writeLittleEndian(file + 34, static_cast<Uint32>(fileBytes - 54), 4);
+        writeLittleEndian(file + 38, 2835, 4);  // 72 DPI
+        writeLittleEndian(file + 42, 2835, 4);
+        break;
+    }
+    case ImageFormat::TGA:
+        std::memset(file, 0, 18);
+        file[2] = 2;  // Uncompressed true color
+        writeLittleEndian(file + 12, static_cast<Uint32>(imageSize), 2);
+        writeLittleEndian(file + 14, static_cast<Uint32>(imageSize), 2);
+        file[16] = 24;
+        file[17] = 0x20;  // Origin at the top left
+        break;
+    case ImageFormat::PNG:
+        break;
+    }
+}
+
+bool ImageExporter::run(const SpriteView& sprite, const Palette& palette) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    if (!getFormat(options.outputPath, format)) {
+        std::cerr << "Unsupported image format " << options.outputPath << " (use .ppm, .bmp, .tga or .png)" << std::endl;
+        return false;
+    }
+
+    RecursiveExpander expander(sprite, options.depth, BlendTable(palette, options.blend),
+                               options.rules);
+    int size = expander.getOutputSize();
+    if (options.scale < 1 || static_cast<long long>(size) * options.scale > 0x7FFFFFFF) {
+        std::cerr << "Image is too large" << std::endl;
+        return false;
+    }
+    imageSize = size * options.scale;
+
+    if (format == ImageFormat::PNG) {
+        bool ok = writePng(expander, palette);
+        secondsElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        return ok;
+    }
+
+    Layout layout;
+    if (!planLayout(layout)) return false;
+    fileBytes = layout.headerBytes + layout.rowBytes * imageSize;
+
+    // Reserve the blocks up front so a full disk fails here instead of as a
+    // fault in a worker halfway through the mapping
+    std::string tempPath = options.outputPath + ".tmp";
+    int fd = ::open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Could not create " << tempPath << std::endl;
+        return false;
+    }
+
+    int result = posix_fallocate(fd, 0, static_cast<off_t>(fileBytes));
+    if (result == EINVAL || result == EOPNOTSUPP) {
+        result = ftruncate(fd, static_cast<off_t>(fileBytes)) == 0 ? 0 : errno;
+    }
+    void* mapped = MAP_FAILED;
+    if (result == 0) {
+        mapped = mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Could not allocate " << (fileBytes >> 20) << " MB for " << tempPath << ": "
+                  << std::strerror(result != 0 ? result : errno) << std::endl;
+        ::close(fd);
+        unlink(tempPath.c_str());
+        return false;
+    }
+    Uint8* file = static_cast<Uint8*>(mapped);
+    madvise(file, fileBytes, MADV_SEQUENTIAL);
+
+    writeHeader(file);
+
+    // Index to the file's channel order once; background shows palette color 0
+    Uint8 colors[256][3];
+    for (int i = 0; i < 256; i++) {
+        SDL_Color color = palette.getColor(i);
+        colors[i][0] = layout.bgr ? color.b : color.r;
+        colors[i][1] = color.g;
+        colors[i][2] = layout.bgr ? color.r : color.b;
+    }
+
+    // One long-running task per worker; bands are claimed in order so the
+    // pages being written stay close together in the file
+    int bandCount = (size + BAND_ROWS - 1) / BAND_ROWS;
+    std::atomic<int> nextBand(0);
+    {
+        ThreadPool pool(options.threads);
+        for (int worker = 0; worker < pool.getThreadCount(); worker++) {
+            pool.submit([&] {
+                std::vector<Uint8> band(static_cast<size_t>(size) * BAND_ROWS);
+                for (int index = nextBand++; index < bandCount; index = nextBand++) {
+                    int firstRow = index * BAND_ROWS;
+                    int rows = std::min(BAND_ROWS, size - firstRow);
+                    expander.expandRows(firstRow, rows, band.data(), size);
+                    encodeBand(band.data(), size, firstRow, rows, options.scale, colors, layout, imageSize, file);
+                }
+            });
+        }
+        pool.waitIdle();
+    }
+
+    bool ok = munmap(file, fileBytes) == 0;
+    ok = (::close(fd) == 0) && ok;
+    ok = ok && rename(tempPath.c_str(), options.outputPath.c_str()) == 0;
+    if (!ok) {
+        std::cerr << "Could not write " << options.outputPath << std::endl;
+        unlink(tempPath.c_str());
+        return false;
+    }
+
+    secondsElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    return true;
+}
+
+bool ImageExporter::writePng(const RecursiveExpander& expander, const Palette& palette) {
+    int size = expander.getOutputSize();
+    int scale = options.scale;
+
+    Uint8 colors[256][3];
+    for (int i = 0; i < 256; i++) {
+        SDL_Color color = palette.getColor(i);
+        colors[i][0] = color.r;
+        colors[i][1] = color.g;
+        colors[i][2] = color.b;
+    }
+
+    // Expand the index rows under the requested image rows and scale them up
+    bool indexed = options.indexed;
+    PngWriter::RowSource source = [&](int firstRow, int rowCount, Uint8* out, size_t stride) {
+        int firstIndexRow = firstRow / scale;
+        int indexRows = (firstRow + rowCount - 1) / scale - firstIndexRow + 1;
+        std::vector<Uint8> indices(static_cast<size_t>(size) * indexRows);
+        expander.expandRows(firstIndexRow, indexRows, indices.data(), size);
+
+        for (int r = 0; r < rowCount; r++) {
+            const Uint8* row = &indices[static_cast<size_t>((firstRow + r) / scale - firstIndexRow) * size];
+            Uint8* target = out + r * stride;
+            for (int x = 0; x < size; x++) {
+                for (int k = 0; k < scale; k++) {
+                    if (indexed) {
+                        *target++ = row[x];
+                    } else {
+                        std::memcpy(target, colors[row[x]], 3);
+                        target += 3;
+                    }
+                }
+            }
+        }
+    };
+
+    PngOptions pngOptions;
+    pngOptions.threads = options.threads;
+    PngWriter writer(pngOptions);
+    // The color table covers every state, even ones past the palette
+    int colorCount = std::max(palette.getColorCount(), expander.getStateCount());
+    bool ok = indexed
+        ? writer.writeIndexed(options.outputPath, imageSize, imageSize, palette, colorCount, source)
+        : writer.writeRGB(options.outputPath, imageSize, imageSize, source);
+    fileBytes = writer.getBytesWritten();
+    return ok;
+}
+
+void ImageExporter::encodeBand(const Uint8* indices, int size, int firstRow, int rowCount, int scale,
+                               const Uint8 colors[256][3], const Layout& layout, int imageSize, Uint8* file) {
+    size_t pixelBytes = static_cast<size_t>(imageSize) * 3;
+
+    for (int r = 0; r < rowCount; r++) {
+        const Uint8* rowIndices = indices + static_cast<size_t>(r) * size;
+        const Uint8* encoded = nullptr;
+
+        // Encode the first of the scaled rows, copy it to the others; padding
+        // bytes are already zero in the freshly allocated file
+        for (int s = 0; s < scale; s++) {
+            size_t imageRow = static_cast<size_t>(firstRow + r) * scale + s;
+            if (layout.bottomUp) {
+                imageRow = imageSize - 1 - imageRow;
+            }
+            Uint8* target = file + layout.headerBytes + imageRow * layout.rowBytes;
+
+            if (encoded) {
+                std::memcpy(target, encoded, pixelBytes);
+                continue;
+            }
+
+            Uint8* pixel = target;
+            for (int x = 0; x < size; x++) {
+                const Uint8* rgb = colors[rowIndices[x]];
+                for (int k = 0; k < scale; k++) {
+                    pixel[0] = rgb[0];
+                    pixel[1] = rgb[1];
+                    pixel[2] = rgb[2];
+                    pixel += 3;
+                }
+            }
+            encoded = target;
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "BlendTable.h"
+#include "PackedIndices.h"
+#include "Palette.h"
+#include "RecursiveExpander.h"
+
+enum class ImageFormat {
+    PPM,  // Binary P6, RGB rows top-down
+    BMP,  // 24-bit uncompressed, BGR rows bottom-up padded to 4 bytes
+    TGA,  // Uncompressed true color, BGR rows top-down
+    PNG   // Deflated on all cores, palette-indexed unless asked for RGB
+};
+
+struct ExportOptions {
+    std::string outputPath;  // Format follows the extension: .ppm, .bmp, .tga or .png
+    int depth = 2;
+    int scale = 1;           // Each output pixel becomes scale x scale pixels
+    int threads = 0;         // 0 means one per hardware core
+    BlendMode blend = BlendMode::Source;
+    std::vector<std::vector<Uint8>> rules;  // Pattern grid per color, empty for a copy of the sprite
+    bool indexed = true;     // PNG only: palette image rather than RGB
+};
+
+// Writes the recursive output of one sprite for images too large to hold in
+// memory comfortably. The target file is preallocated at its final size and
+// mapped; worker threads each claim bands of rows, expand them and encode
+// them straight into the mapping, so there is no intermediate image and no
+// serial write phase. The file is built next to the target and renamed into
+// place once complete. PNG has no fixed layout, so it goes through PngWriter,
+// which compresses the bands in parallel instead.
+class ImageExporter {
+public:
+    explicit ImageExporter(const ExportOptions& options);
+    ~ImageExporter() = default;
+
+    // Export the expansion of a sprite
+    bool run(const SpriteView& sprite, const Palette& palette);
+
+    int getImageSize() const { return imageSize; }
+    size_t getFileBytes() const { return fileBytes; }
+    double getSecondsElapsed() const { return secondsElapsed; }
+
+    // Format from the path's extension; false if it is not a supported one
+    static bool getFormat(const std::string& path, ImageFormat& format);
+
+private:
+    static constexpr int BAND_ROWS = 64;
+    static const int TGA_MAX_SIZE = 65535;
+
+    // Where each encoded row goes in the file
+    struct Layout {
+        size_t headerBytes;
+        size_t rowBytes;   // Including padding
+        bool bottomUp;
+        bool bgr;
+    };
+
+    ExportOptions options;
+    ImageFormat format;
+    int imageSize;
+    size_t fileBytes;
+    double secondsElapsed;
+
+    bool planLayout(Layout& layout) const;
+    bool writePng(const RecursiveExpander& expander, const Palette& palette);
+    void writeHeader(Uint8* file) const;
+
+    static void encodeBand(const Uint8* indices, int size, int firstRow, int rowCount, int scale,
+                           const Uint8 colors[256][3], const Layout& layout, int imageSize, Uint8* file);
+};
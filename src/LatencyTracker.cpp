@@ -0,0 +1,82 @@
+#include "LatencyTracker.h"
+#include <algorithm>
+#include <iomanip>
+
+LatencyTracker::LatencyTracker(int sampleCapacity)
+    : pendingHead(0), pendingTail(0), sampleCount(0), nextSample(0) {
+    samples.resize(std::max(1, sampleCapacity), 0.0);
+    counterFrequency = SDL_GetPerformanceFrequency();
+}
+
+void LatencyTracker::markInput(Uint32 eventTicks, Uint64 sequence) {
+    int head = pendingHead.load(std::memory_order_relaxed);
+    int next = (head + 1) % MAX_PENDING_INPUTS;
+    if (next == pendingTail.load(std::memory_order_acquire)) {
+        return;  // Oldest inputs are kept, they carry the worst latency
+    }
+
+    // SDL event timestamps are only millisecond accurate, so convert the time
+    // the event spent in the queue to counter ticks and backdate "now" by it
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint32 queuedMs = SDL_GetTicks() - eventTicks;
+    Uint64 queuedTicks = static_cast<Uint64>(queuedMs) * counterFrequency / 1000;
+
+    pendingInputs[head].timestamp = (queuedTicks < now) ? now - queuedTicks : now;
+    pendingInputs[head].sequence = sequence;
+    pendingHead.store(next, std::memory_order_release);
+}
+
+void LatencyTracker::markPresent(Uint64 presentedSequence) {
+    int tail = pendingTail.load(std::memory_order_relaxed);
+    int head = pendingHead.load(std::memory_order_acquire);
+    if (tail == head) return;
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    int capacity = static_cast<int>(samples.size());
+
+    // Inputs are queued in sequence order, stop at the first one not presented yet
+    while (tail != head && pendingInputs[tail].sequence <= presentedSequence) {
+        double latencyMs = (now - pendingInputs[tail].timestamp) * 1000.0 / counterFrequency;
+        samples[nextSample] = latencyMs;
+        nextSample = (nextSample + 1) % capacity;
+        sampleCount = std::min(sampleCount + 1, capacity);
+        tail = (tail + 1) % MAX_PENDING_INPUTS;
+    }
+    pendingTail.store(tail, std::memory_order_release);
+}
+
+double LatencyTracker::getPercentile(double percentile) const {
+    if (sampleCount == 0) return 0.0;
+
+    std::vector<double> sorted(samples.begin(), samples.begin() + sampleCount);
+    int rank = static_cast<int>(percentile / 100.0 * (sampleCount - 1) + 0.5);
+    rank = std::max(0, std::min(sampleCount - 1, rank));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+
+    return sorted[rank];
+}
+
+void LatencyTracker::report(std::ostream& out) const {
+    if (sampleCount == 0) {
+        out << "Input latency: no samples yet" << std::endl;
+        return;
+    }
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+
+    out << std::fixed << std::setprecision(2)
+        << "Input latency over " << sampleCount << " events (ms):"
+        << " p50=" << getPercentile(50.0)
+        << " p90=" << getPercentile(90.0)
+        << " p99=" << getPercentile(99.0)
+        << " max=" << getPercentile(100.0) << std::endl;
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void LatencyTracker::reset() {
+    sampleCount = 0;
+    nextSample = 0;
+}
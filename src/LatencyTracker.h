@@ -0,0 +1,53 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+// Measures input-to-photon latency: each input event is timestamped when it is
+// polled, and resolved by the first present that reflects it.
+// markInput() and markPresent() may run on different threads (input and
+// render); everything else belongs to the thread calling markPresent().
+class LatencyTracker {
+public:
+    LatencyTracker(int sampleCapacity = 4096);
+    ~LatencyTracker() = default;
+
+    // Record an input event (eventTicks is the SDL event timestamp in ms) that
+    // will first be visible in the editor snapshot with the given sequence
+    void markInput(Uint32 eventTicks, Uint64 sequence);
+
+    // Record a present of the given snapshot; every input it reflects gets a latency sample
+    void markPresent(Uint64 presentedSequence);
+
+    // Number of samples currently held (bounded by the capacity)
+    int getSampleCount() const { return sampleCount; }
+
+    // Latency in milliseconds at the given percentile (0-100)
+    double getPercentile(double percentile) const;
+
+    // Print p50/p90/p99/max to the given stream
+    void report(std::ostream& out) const;
+
+    // Drop all collected samples
+    void reset();
+
+private:
+    static const int MAX_PENDING_INPUTS = 256;
+
+    struct PendingInput {
+        Uint64 timestamp;
+        Uint64 sequence;
+    };
+
+    // Single-producer/single-consumer ring from the document to the render side
+    PendingInput pendingInputs[MAX_PENDING_INPUTS];
+    alignas(64) std::atomic<int> pendingHead;
+    alignas(64) std::atomic<int> pendingTail;
+
+    std::vector<double> samples;  // Ring of the most recent latencies (ms)
+    int sampleCount;
+    int nextSample;
+
+    Uint64 counterFrequency;
+};
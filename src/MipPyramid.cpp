@@ -0,0 +1,146 @@
+#include "MipPyramid.h"
+#include <algorithm>
+#include <cstring>
+#include "CoverageTable.h"
+
+MipPyramid::MipPyramid(Uint32* pixels, int size)
+    : pixels(pixels), size(size), levelCount(getLevelCount(size)), levelRows(levelCount, 0) {}
+
+void MipPyramid::appendRows(const Uint32* rows, int rowCount) {
+    for (int r = 0; r < rowCount && levelRows[0] < size; r++) {
+        Uint32* target = pixels + static_cast<size_t>(levelRows[0]) * size;
+        if (rows + static_cast<size_t>(r) * size != target) {
+            std::memcpy(target, rows + static_cast<size_t>(r) * size, size * sizeof(Uint32));
+        }
+        levelRows[0]++;
+
+        // A completed pair of rows makes one row of the next level, which may complete a pair there
+        for (int level = 0; level + 1 < levelCount && levelRows[level] % 2 == 0; level++) {
+            int width = getLevelSize(size, level);
+            int nextRow = levelRows[level + 1];
+            if (nextRow >= getLevelSize(size, level + 1)) break;
+
+            const Uint32* top = pixels + getLevelOffset(size, level) + static_cast<size_t>(nextRow * 2) * width;
+            Uint32* out = pixels + getLevelOffset(size, level + 1) + static_cast<size_t>(nextRow) * (width / 2);
+            filterRows(top, top + width, width, out);
+            levelRows[level + 1]++;
+        }
+    }
+}
+
+void MipPyramid::build(Uint32* pixels, int size) {
+    MipPyramid pyramid(pixels, size);
+    pyramid.appendRows(pixels, size);
+}
+
+void MipPyramid::updateRegion(Uint32* pixels, int size, const SDL_Rect& rect) {
+    for (int level = 1; level < getLevelCount(size); level++) {
+        SDL_Rect levelRect = getLevelRect(size, level, rect);
+        int width = getLevelSize(size, level - 1);
+        for (int y = levelRect.y; y < levelRect.y + levelRect.h; y++) {
+            const Uint32* top = pixels + getLevelOffset(size, level - 1) + static_cast<size_t>(y * 2) * width + levelRect.x * 2;
+            Uint32* out = pixels + getLevelOffset(size, level) + static_cast<size_t>(y) * (width / 2) + levelRect.x;
+            filterRows(top, top + width, levelRect.w * 2, out);
+        }
+    }
+}
+
+SDL_Rect MipPyramid::getLevelRect(int size, int level, const SDL_Rect& rect) {
+    // A level pixel covers 2^level pixels of level 0 each way, so the start rounds down and the end up
+    if (rect.w <= 0 || rect.h <= 0) return SDL_Rect{0, 0, 0, 0};
+    int levelSize = getLevelSize(size, level);
+    int span = (1 << level) - 1;
+    int x0 = std::min(rect.x >> level, levelSize);
+    int y0 = std::min(rect.y >> level, levelSize);
+    int x1 = std::min((rect.x + rect.w + span) >> level, levelSize);
+    int y1 = std::min((rect.y + rect.h + span) >> level, levelSize);
+    return SDL_Rect{x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0)};
+}
+
+int MipPyramid::getLevelCount(int size) {
+    int count = 1;
+    while (size > 1) {
+        size /= 2;
+        count++;
+    }
+    return count;
+}
+
+int MipPyramid::getLevelSize(int size, int level) {
+    return size >> level;
+}
+
+size_t MipPyramid::getLevelOffset(int size, int level) {
+    size_t offset = 0;
+    for (int i = 0; i < level; i++) {
+        size_t levelSize = getLevelSize(size, i);
+        offset += levelSize * levelSize;
+    }
+    return offset;
+}
+
+size_t MipPyramid::getTotalPixels(int size) {
+    return getLevelOffset(size, getLevelCount(size));
+}
+
+int MipPyramid::selectLevel(int size, int displaySize) {
+    int level = 0;
+    while (level + 1 < getLevelCount(size) && getLevelSize(size, level + 1) >= displaySize) {
+        level++;
+    }
+    return level;
+}
+
+namespace {
+
+// Adds an encoded premultiplied pixel to sum as premultiplied linear RGB and coverage
+void addLinear(Uint32 pixel, float sum[4]) {
+    Uint32 alpha = pixel >> 24;
+    if (alpha == 0) return;
+
+    float coverage = alpha / 255.0f;
+    for (int channel = 0; channel < 3; channel++) {
+        Uint32 value = (pixel >> (16 - channel * 8)) & 0xFF;
+        Uint32 straight = std::min<Uint32>(255, (value * 255 + alpha / 2) / alpha);
+        sum[channel] += CoverageTable::srgbToLinear(static_cast<Uint8>(straight)) * coverage;
+    }
+    sum[3] += coverage;
+}
+
+}
+
+void MipPyramid::filterRows(const Uint32* top, const Uint32* bottom, int width, Uint32* out) {
+    int outWidth = width / 2;
+    for (int x = 0; x < outWidth; x++) {
+        Uint32 p0 = top[x * 2];
+        Uint32 p1 = top[x * 2 + 1];
+        Uint32 p2 = bottom[x * 2];
+        Uint32 p3 = bottom[x * 2 + 1];
+
+        // Flat areas, most of a pixel-art expansion, average to themselves
+        if (p0 == p1 && p0 == p2 && p0 == p3) {
+            out[x] = p0;
+            continue;
+        }
+
+        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        addLinear(p0, sum);
+        addLinear(p1, sum);
+        addLinear(p2, sum);
+        addLinear(p3, sum);
+        if (sum[3] <= 0.0f) {
+            out[x] = 0;
+            continue;
+        }
+
+        // Encoded like CoverageTable: the straight color, premultiplied by the mean coverage
+        float alpha = std::min(sum[3] * 0.25f, 1.0f);
+        float inverse = 1.0f / sum[3];
+        Uint32 result = static_cast<Uint32>(alpha * 255.0f + 0.5f) << 24;
+        for (int channel = 0; channel < 3; channel++) {
+            Uint32 value = static_cast<Uint32>(CoverageTable::linearToSrgb(sum[channel] * inverse) * alpha + 0.5f);
+            result |= value << (16 - channel * 8);
+        }
+        out[x] = result;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <vector>
+
+// Mip chain of a square image of premultiplied ARGB pixels, kept in a single
+// buffer: level 0 (the image itself) followed by every half-size level down
+// to 1x1. Odd sizes round down, dropping the last row and column.
+//
+// The chain is built while level 0 is produced: rows are appended top to
+// bottom, and each completed pair of rows is box filtered into the next level
+// right away, while it is still in cache. The filter averages in linear light,
+// encoding its result like CoverageTable, so minified levels keep the
+// brightness of the image; uniform 2x2 blocks are copied as they are.
+class MipPyramid {
+public:
+    // pixels must hold getTotalPixels(size) entries
+    MipPyramid(Uint32* pixels, int size);
+    ~MipPyramid() = default;
+
+    // Append the next rowCount rows of level 0
+    void appendRows(const Uint32* rows, int rowCount);
+
+    // Build the whole chain from level 0, already stored at the start of pixels
+    static void build(Uint32* pixels, int size);
+
+    // Refilter the part of every level below rect, a changed area of level 0
+    static void updateRegion(Uint32* pixels, int size, const SDL_Rect& rect);
+
+    // The pixels of level that depend on rect of level 0, clipped to the level
+    static SDL_Rect getLevelRect(int size, int level, const SDL_Rect& rect);
+
+    static int getLevelCount(int size);
+    static int getLevelSize(int size, int level);
+    static size_t getLevelOffset(int size, int level);
+    static size_t getTotalPixels(int size);
+
+    // Smallest level still at least displaySize wide, so it is only ever minified a little
+    static int selectLevel(int size, int displaySize);
+
+private:
+    Uint32* pixels;
+    int size;
+    int levelCount;
+    std::vector<int> levelRows;  // Rows completed in every level
+
+    // Average each 2x2 block of two rows into one row of width/2, in linear light
+    static void filterRows(const Uint32* top, const Uint32* bottom, int width, Uint32* out);
+};
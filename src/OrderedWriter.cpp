@@ -0,0 +1,70 @@
+#include "OrderedWriter.h"
+
+OrderedWriter::OrderedWriter(WriteFunction write, size_t maxBytesInFlight)
+    : write(std::move(write)), maxBytesInFlight(maxBytesInFlight), bytesInFlight(0),
+      nextIndex(0), finishing(false), failed(false), itemsWritten(0), bytesWritten(0) {
+    writerThread = std::thread(&OrderedWriter::writerLoop, this);
+}
+
+OrderedWriter::~OrderedWriter() {
+    finish();
+}
+
+void OrderedWriter::acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex);
+    spaceFreed.wait(lock, [this, bytes] {
+        return bytesInFlight + bytes <= maxBytesInFlight || bytesInFlight == 0;
+    });
+    bytesInFlight += bytes;
+}
+
+void OrderedWriter::submit(Uint64 index, std::vector<Uint8>&& data, size_t acquiredBytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending[index] = Item{std::move(data), acquiredBytes};
+    }
+    itemReady.notify_one();
+}
+
+void OrderedWriter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finishing = true;
+    }
+    itemReady.notify_one();
+    
+    if (writerThread.joinable()) {
+        writerThread.join();
+    }
+}
+
+void OrderedWriter::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    
+    while (true) {
+        itemReady.wait(lock, [this] {
+            return finishing || (!pending.empty() && pending.begin()->first == nextIndex);
+        });
+        
+        if (pending.empty() || pending.begin()->first != nextIndex) {
+            return;  // Finishing, and the next item will never come
+        }
+        
+        Item item = std::move(pending.begin()->second);
+        pending.erase(pending.begin());
+        
+        // Write without holding the lock so workers can keep submitting
+        lock.unlock();
+        if (!failed && !write(nextIndex, item.data)) {
+            failed = true;
+        }
+        itemsWritten++;
+        bytesWritten += item.data.size();
+        item.data = std::vector<Uint8>();
+        lock.lock();
+        
+        nextIndex++;
+        bytesInFlight -= item.acquiredBytes;
+        spaceFreed.notify_all();
+    }
+}
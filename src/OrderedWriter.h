@@ -0,0 +1,66 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Writes results that complete out of order strictly in index order, on its
+// own thread. Producers reserve memory with acquire() before starting work on
+// an item; the reservation is returned once the item is written, which bounds
+// the memory held by work in flight and buffered results (backpressure).
+// Indices must be submitted exactly once each, starting at 0.
+class OrderedWriter {
+public:
+    // Writes one item; returning false marks the writer as failed
+    using WriteFunction = std::function<bool(Uint64 index, const std::vector<Uint8>& data)>;
+
+    OrderedWriter(WriteFunction write, size_t maxBytesInFlight);
+    ~OrderedWriter();
+
+    // Block until bytes more may be in flight; a single oversized item is
+    // let through once nothing else is in flight
+    void acquire(size_t bytes);
+
+    // Hand over a finished item together with the bytes acquired for it
+    void submit(Uint64 index, std::vector<Uint8>&& data, size_t acquiredBytes);
+
+    // Wait until every submitted item is written and stop the writer thread
+    void finish();
+
+    // Mark the output as failed from a producer; nothing more is written
+    void fail() { failed = true; }
+    
+    bool hasFailed() const { return failed; }
+    Uint64 getItemsWritten() const { return itemsWritten; }
+    Uint64 getBytesWritten() const { return bytesWritten; }
+
+private:
+    struct Item {
+        std::vector<Uint8> data;
+        size_t acquiredBytes;
+    };
+
+    WriteFunction write;
+    size_t maxBytesInFlight;
+    size_t bytesInFlight;
+
+    std::map<Uint64, Item> pending;  // Finished items waiting for their turn
+    Uint64 nextIndex;
+    bool finishing;
+
+    std::atomic<bool> failed;
+    std::atomic<Uint64> itemsWritten;
+    std::atomic<Uint64> bytesWritten;
+
+    std::mutex mutex;
+    std::condition_variable itemReady;
+    std::condition_variable spaceFreed;
+    std::thread writerThread;
+
+    void writerLoop();
+};
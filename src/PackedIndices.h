@@ -0,0 +1,73 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <cstring>
+
+// Row-major color indices stored BITS (4 or 8) to an index; with 4 bits the
+// high nibble comes first. The width is a template argument so the inner
+// loops compile to straight shifts and masks; callers pick the
+// instantiation once per sprite, never per pixel.
+template <int BITS>
+struct PackedIndices {
+    static_assert(BITS == 4 || BITS == 8, "indices are 4 or 8 bits wide");
+
+    static constexpr int MAX_COLORS = 1 << BITS;
+
+    static size_t getSize(size_t count) {
+        return (BITS == 8) ? count : (count + 1) / 2;
+    }
+
+    static int get(const Uint8* data, size_t i) {
+        if (BITS == 8) return data[i];
+        Uint8 packed = data[i >> 1];
+        return (i & 1) ? (packed & 0x0F) : (packed >> 4);
+    }
+
+    static void set(Uint8* data, size_t i, int index) {
+        if (BITS == 8) {
+            data[i] = static_cast<Uint8>(index);
+        } else if (i & 1) {
+            data[i >> 1] = static_cast<Uint8>((data[i >> 1] & 0xF0) | (index & 0x0F));
+        } else {
+            data[i >> 1] = static_cast<Uint8>((data[i >> 1] & 0x0F) | (index & 0x0F) << 4);
+        }
+    }
+
+    // Expand count indices to one byte each
+    static void unpack(const Uint8* data, size_t count, Uint8* out) {
+        if (BITS == 8) {
+            std::memcpy(out, data, count);
+            return;
+        }
+        for (size_t i = 0; i + 1 < count; i += 2) {
+            out[i] = data[i >> 1] >> 4;
+            out[i + 1] = data[i >> 1] & 0x0F;
+        }
+        if (count & 1) {
+            out[count - 1] = data[count >> 1] >> 4;
+        }
+    }
+};
+
+// Zero-copy view of a sprite's packed color indices: a loaded or mapped
+// file, or the editor's own grid
+struct SpriteView {
+    int gridSize = 0;
+    int bitsPerIndex = 4;
+    const Uint8* data = nullptr;
+
+    int getIndex(int x, int y) const {
+        size_t i = static_cast<size_t>(y) * gridSize + x;
+        return (bitsPerIndex == 8) ? PackedIndices<8>::get(data, i) : PackedIndices<4>::get(data, i);
+    }
+
+    // Expand to one byte per pixel (gridSize * gridSize bytes)
+    void unpack(Uint8* out) const {
+        size_t count = static_cast<size_t>(gridSize) * gridSize;
+        if (bitsPerIndex == 8) {
+            PackedIndices<8>::unpack(data, count, out);
+        } else {
+            PackedIndices<4>::unpack(data, count, out);
+        }
+    }
+};
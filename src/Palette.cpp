@@ -1,29 +1,87 @@
 #include "Palette.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
 
-Palette::Palette() : currentColorIndex(0) {
+namespace {
+
+// PICO-8 inspired 16-color palette
+constexpr SDL_Color PICO8_COLORS[16] = {
+    {0, 0, 0, 255},         // Black
+    {29, 43, 83, 255},      // Dark Blue
+    {126, 37, 83, 255},     // Dark Purple
+    {0, 135, 81, 255},      // Dark Green
+    {171, 82, 54, 255},     // Brown
+    {95, 87, 79, 255},      // Dark Grey
+    {194, 195, 199, 255},   // Light Grey
+    {255, 241, 232, 255},   // White
+    {255, 0, 77, 255},      // Red
+    {255, 163, 0, 255},     // Orange
+    {255, 236, 39, 255},    // Yellow
+    {0, 228, 54, 255},      // Green
+    {41, 173, 255, 255},    // Blue
+    {131, 118, 156, 255},   // Indigo
+    {255, 119, 168, 255},   // Pink
+    {255, 204, 170, 255}    // Peach
+};
+
+constexpr Uint32 toARGB(const SDL_Color& color) {
+    return (static_cast<Uint32>(color.a) << 24) | (static_cast<Uint32>(color.r) << 16) |
+           (static_cast<Uint32>(color.g) << 8) | color.b;
+}
+
+struct ARGBTable {
+    Uint32 words[256];
+
+    constexpr ARGBTable() : words() {
+        for (int i = 0; i < 256; i++) {
+            words[i] = (i < 16) ? toARGB(PICO8_COLORS[i]) : toARGB({0, 0, 0, 255});
+        }
+    }
+};
+
+alignas(64) constexpr ARGBTable PICO8_ARGB;
+
+}
+
+Palette::Palette() : currentColorIndex(0), builtIn(true), revision(0) {
     initializePico8Colors();
 }
 
+Palette::Palette(const std::vector<SDL_Color>& colors) : currentColorIndex(0), builtIn(true), revision(0) {
+    setColors(colors);
+}
+
+void Palette::setColors(const std::vector<SDL_Color>& newColors) {
+    colors.assign(newColors.begin(), newColors.begin() + std::min<size_t>(newColors.size(), MAX_COLORS));
+    if (colors.empty()) {
+        initializePico8Colors();
+    }
+    if (currentColorIndex >= static_cast<int>(colors.size())) {
+        currentColorIndex = 0;
+    }
+    revision++;
+    
+    // Sprites saved by the editor carry the built-in palette; share its table
+    auto same = [](const SDL_Color& a, const SDL_Color& b) { return toARGB(a) == toARGB(b); };
+    builtIn = colors.size() == 16 && std::equal(colors.begin(), colors.end(), PICO8_COLORS, same);
+    if (!builtIn) {
+        customARGB.resize(256);
+        for (int i = 0; i < 256; i++) {
+            customARGB[i] = toARGB(getColor(i));
+        }
+    }
+}
+
 void Palette::initializePico8Colors() {
-    // PICO-8 inspired 16-color palette
-    colors = {
-        {0, 0, 0, 255},         // Black
-        {29, 43, 83, 255},      // Dark Blue
-        {126, 37, 83, 255},     // Dark Purple
-        {0, 135, 81, 255},      // Dark Green
-        {171, 82, 54, 255},     // Brown
-        {95, 87, 79, 255},      // Dark Grey
-        {194, 195, 199, 255},   // Light Grey
-        {255, 241, 232, 255},   // White
-        {255, 0, 77, 255},      // Red
-        {255, 163, 0, 255},     // Orange
-        {255, 236, 39, 255},    // Yellow
-        {0, 228, 54, 255},      // Green
-        {41, 173, 255, 255},    // Blue
-        {131, 118, 156, 255},   // Indigo
-        {255, 119, 168, 255},   // Pink
-        {255, 204, 170, 255}    // Peach
-    };
+    colors.assign(PICO8_COLORS, PICO8_COLORS + 16);
+}
+
+const Uint32* Palette::getARGBColors() const {
+    return builtIn ? PICO8_ARGB.words : customARGB.data();
 }
 
 SDL_Color Palette::getColor(int index) const {
@@ -33,16 +91,35 @@ SDL_Color Palette::getColor(int index) const {
     return {0, 0, 0, 255}; // Default to black
 }
 
+int Palette::findNearest(const SDL_Color& color, int firstIndex) const {
+    int nearest = 0;
+    int nearestDistance = -1;
+    for (int i = std::max(firstIndex, 0); i < static_cast<int>(colors.size()); i++) {
+        int dr = colors[i].r - color.r;
+        int dg = colors[i].g - color.g;
+        int db = colors[i].b - color.b;
+        int distance = dr * dr + dg * dg + db * db;
+        if (nearestDistance < 0 || distance < nearestDistance) {
+            nearest = i;
+            nearestDistance = distance;
+        }
+    }
+    return nearest;
+}
+
 void Palette::setCurrentColorIndex(int index) {
     if (index >= 0 && index < static_cast<int>(colors.size())) {
         currentColorIndex = index;
     }
 }
 
-void Palette::render(SDL_Renderer* renderer, int x, int y, int cellSize) {
+void Palette::render(SDL_Renderer* renderer, int x, int y, int cellSize) const {
+    int columns = getColumns();
+    cellSize = cellSize * 4 / columns;
+    
     for (int i = 0; i < static_cast<int>(colors.size()); i++) {
-        int col = i % 4;
-        int row = i / 4;
+        int col = i % columns;
+        int row = i / columns;
         
         SDL_Rect rect = {
             x + col * cellSize,
@@ -83,12 +160,14 @@ bool Palette::handleClick(int mouseX, int mouseY, int paletteX, int paletteY, in
     
     if (relativeX < 0 || relativeY < 0) return false;
     
+    int columns = getColumns();
+    cellSize = cellSize * 4 / columns;
     int col = relativeX / cellSize;
     int row = relativeY / cellSize;
     
-    if (col >= 4 || row >= 4) return false;
+    if (col >= columns || row >= columns) return false;
     
-    int colorIndex = row * 4 + col;
+    int colorIndex = row * columns + col;
     if (colorIndex < static_cast<int>(colors.size())) {
         setCurrentColorIndex(colorIndex);
         return true;
@@ -96,3 +175,90 @@ bool Palette::handleClick(int mouseX, int mouseY, int paletteX, int paletteY, in
     
     return false;
 }
+
+int Palette::getColumns() const {
+    // 4x4 for up to 16 colors, 8x8 up to 64, 16x16 up to 256
+    int columns = 4;
+    while (columns * columns < static_cast<int>(colors.size())) {
+        columns *= 2;
+    }
+    return columns;
+}
+
+bool Palette::loadFile(const std::string& path, Palette& palette) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Could not open palette " << path << std::endl;
+        return false;
+    }
+    
+    std::vector<SDL_Color> colors;
+    std::string line;
+    bool gimp = false;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        
+        if (!gimp) {
+            line.erase(std::min(line.find(';'), line.size()));  // Hex lists may carry "; comments"
+        }
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || (gimp && line[start] == '#')) continue;
+        
+        if (lineNumber == 1 && line.compare(start, 12, "GIMP Palette") == 0) {
+            gimp = true;
+            continue;
+        }
+        
+        SDL_Color color = {0, 0, 0, 255};
+        bool parsed;
+        if (gimp) {
+            // Name: and Columns: headers, then "R G B [name]" per color
+            if (line.find(':') != std::string::npos && !std::isdigit(static_cast<unsigned char>(line[start]))) {
+                continue;
+            }
+            std::istringstream fields(line);
+            int r = 0, g = 0, b = 0;
+            parsed = static_cast<bool>(fields >> r >> g >> b) && r >= 0 && r <= 255 && g >= 0 && g <= 255 &&
+                     b >= 0 && b <= 255;
+            if (parsed) {
+                color = {static_cast<Uint8>(r), static_cast<Uint8>(g), static_cast<Uint8>(b), 255};
+            }
+        } else {
+            // RRGGBB, optionally after a '#', with surrounding whitespace
+            size_t end = line.find_last_not_of(" \t");
+            std::string hex = line.substr(start, end + 1 - start);
+            if (hex[0] == '#') {
+                hex.erase(0, 1);
+            }
+            parsed = hex.size() == 6 && std::all_of(hex.begin(), hex.end(), [](char c) {
+                return std::isxdigit(static_cast<unsigned char>(c)) != 0;
+            });
+            if (parsed) {
+                unsigned long value = std::strtoul(hex.c_str(), nullptr, 16);
+                color = {static_cast<Uint8>(value >> 16), static_cast<Uint8>(value >> 8),
+                         static_cast<Uint8>(value), 255};
+            }
+        }
+        
+        if (!parsed) {
+            std::cerr << "Invalid color on line " << lineNumber << " of " << path << std::endl;
+            return false;
+        }
+        if (colors.size() == MAX_COLORS) {
+            std::cerr << "Palette " << path << " has more than " << MAX_COLORS << " colors" << std::endl;
+            return false;
+        }
+        colors.push_back(color);
+    }
+    
+    if (colors.empty()) {
+        std::cerr << "No colors in palette " << path << std::endl;
+        return false;
+    }
+    palette = Palette(colors);
+    return true;
+}
@@ -1,13 +1,18 @@
 #pragma once
 #include <SDL2/SDL.h>
+#include <string>
 #include <vector>
 
+// Up to 256 colors; the PICO-8 palette unless others are given or loaded
 class Palette {
 public:
+    static const int MAX_COLORS = 256;
+    
     Palette();
+    explicit Palette(const std::vector<SDL_Color>& colors);  // Colors past MAX_COLORS are dropped
     ~Palette() = default;
 
-    // Get color by index (0-15)
+    // Get color by index (0 to getColorCount() - 1)
     SDL_Color getColor(int index) const;
     
     // Get current selected color index
@@ -19,15 +24,42 @@ public:
     // Get total number of colors
     int getColorCount() const { return static_cast<int>(colors.size()); }
     
-    // Render palette UI
-    void render(SDL_Renderer* renderer, int x, int y, int cellSize);
+    // All colors, in index order
+    const std::vector<SDL_Color>& getColors() const { return colors; }
+    
+    // Replace the colors, keeping the selection if it still exists; reuses
+    // the storage, so swapping between palettes does not allocate
+    void setColors(const std::vector<SDL_Color>& newColors);
+    
+    // Incremented every time the colors are replaced
+    Uint64 getRevision() const { return revision; }
+    
+    // Index at or after firstIndex whose color is closest to color (0 if there is none)
+    int findNearest(const SDL_Color& color, int firstIndex = 0) const;
+    
+    // ARGB8888 word of every index 0-255; indices past the palette are opaque black
+    const Uint32* getARGBColors() const;
+    
+    // Render palette UI; cellSize is the cell of a 4x4 layout, larger
+    // palettes get more, smaller cells in the same square
+    void render(SDL_Renderer* renderer, int x, int y, int cellSize) const;
     
     // Handle mouse click on palette
     bool handleClick(int mouseX, int mouseY, int paletteX, int paletteY, int cellSize);
+    
+    // Read a GIMP palette (.gpl) or a list of RRGGBB hex colors (.hex, one per
+    // line, optionally after a # and before a ; comment)
+    static bool loadFile(const std::string& path, Palette& palette);
 
 private:
     std::vector<SDL_Color> colors;
     int currentColorIndex;
+    bool builtIn;                     // Colors are the PICO-8 palette, whose table is compiled in
+    std::vector<Uint32> customARGB;   // Table of any other palette
+    Uint64 revision;
     
     void initializePico8Colors();
+    
+    // Cells per row of the palette UI
+    int getColumns() const;
 };
@@ -1,29 +1,71 @@
 #include "PixelEditor.h"
+#include <algorithm>
+#include <cstdlib>
 
-PixelEditor::PixelEditor(int gridSize) : gridSize(gridSize) {
-    pixels.resize(gridSize, std::vector<int>(gridSize, 0));
+PixelEditor::PixelEditor(int gridSize) 
+    : gridSize(gridSize), bitsPerIndex(4), revision(0), changeListener(nullptr) {
+    indices.resize(PackedIndices<4>::getSize(static_cast<size_t>(gridSize) * gridSize), 0);
 }
 
 int PixelEditor::getPixel(int x, int y) const {
     if (x >= 0 && x < gridSize && y >= 0 && y < gridSize) {
-        return pixels[y][x];
+        return getView().getIndex(x, y);
     }
     return 0;
 }
 
 void PixelEditor::setPixel(int x, int y, int colorIndex) {
-    if (x >= 0 && x < gridSize && y >= 0 && y < gridSize) {
-        pixels[y][x] = colorIndex;
+    if (colorIndex < 0 || colorIndex > 255) return;
+    
+    int oldColor = getPixel(x, y);
+    if (x >= 0 && x < gridSize && y >= 0 && y < gridSize && oldColor != colorIndex) {
+        // Grids stay at 4 bits a pixel until a color past the first 16 is used
+        size_t i = static_cast<size_t>(y) * gridSize + x;
+        if (bitsPerIndex == 4 && colorIndex >= PackedIndices<4>::MAX_COLORS) {
+            std::vector<Uint8> wide(static_cast<size_t>(gridSize) * gridSize);
+            PackedIndices<4>::unpack(indices.data(), wide.size(), wide.data());
+            indices.swap(wide);
+            bitsPerIndex = 8;
+        }
+        
+        if (bitsPerIndex == 8) {
+            PackedIndices<8>::set(indices.data(), i, colorIndex);
+        } else {
+            PackedIndices<4>::set(indices.data(), i, colorIndex);
+        }
+        revision++;
+        
+        if (changeListener) {
+            changeListener->onPixelChanged(x, y, oldColor, colorIndex);
+        }
+    }
+}
+
+int PixelEditor::getMaxIndex() const {
+    int maxIndex = 0;
+    for (int y = 0; y < gridSize; y++) {
+        for (int x = 0; x < gridSize; x++) {
+            maxIndex = std::max(maxIndex, getPixel(x, y));
+        }
     }
+    return maxIndex;
 }
 
 void PixelEditor::clear() {
-    for (auto& row : pixels) {
-        std::fill(row.begin(), row.end(), 0);
+    for (int y = 0; y < gridSize; y++) {
+        for (int x = 0; x < gridSize; x++) {
+            setPixel(x, y, 0);
+        }
+    }
+    
+    // An empty grid fits 4 bits a pixel again
+    if (bitsPerIndex == 8) {
+        indices.assign(PackedIndices<4>::getSize(static_cast<size_t>(gridSize) * gridSize), 0);
+        bitsPerIndex = 4;
     }
 }
 
-void PixelEditor::render(SDL_Renderer* renderer, int offsetX, int offsetY, int cellSize) {
+void PixelEditor::render(SDL_Renderer* renderer, int offsetX, int offsetY, int cellSize) const {
     for (int y = 0; y < gridSize; y++) {
         for (int x = 0; x < gridSize; x++) {
             SDL_Rect rect = {
@@ -34,7 +76,7 @@ void PixelEditor::render(SDL_Renderer* renderer, int offsetX, int offsetY, int c
             };
             
             // Fill with background color (light gray for empty pixels)
-            if (pixels[y][x] == 0) {
+            if (getPixel(x, y) == 0) {
                 SDL_SetRenderDrawColor(renderer, 240, 240, 240, 255);
             } else {
                 // This will be handled by the main application with palette colors
@@ -50,18 +92,51 @@ void PixelEditor::render(SDL_Renderer* renderer, int offsetX, int offsetY, int c
 }
 
 bool PixelEditor::handleClick(int mouseX, int mouseY, int gridX, int gridY, int cellSize, int colorIndex) {
+    int pixelX, pixelY;
+    if (screenToCell(mouseX, mouseY, gridX, gridY, cellSize, pixelX, pixelY)) {
+        setPixel(pixelX, pixelY, colorIndex);
+        return true;
+    }
+    
+    return false;
+}
+
+bool PixelEditor::screenToCell(int mouseX, int mouseY, int gridX, int gridY, int cellSize,
+                               int& cellX, int& cellY) const {
     int relativeX = mouseX - gridX;
     int relativeY = mouseY - gridY;
     
-    if (relativeX < 0 || relativeY < 0) return false;
+    // Floor instead of truncating, so drags leaving the grid keep their direction
+    cellX = (relativeX >= 0) ? relativeX / cellSize : (relativeX - cellSize + 1) / cellSize;
+    cellY = (relativeY >= 0) ? relativeY / cellSize : (relativeY - cellSize + 1) / cellSize;
     
-    int pixelX = relativeX / cellSize;
-    int pixelY = relativeY / cellSize;
+    return cellX >= 0 && cellX < gridSize && cellY >= 0 && cellY < gridSize;
+}
+
+int PixelEditor::drawLine(int x0, int y0, int x1, int y1, int colorIndex) {
+    Uint64 revisionBefore = revision;
     
-    if (pixelX >= 0 && pixelX < gridSize && pixelY >= 0 && pixelY < gridSize) {
-        setPixel(pixelX, pixelY, colorIndex);
-        return true;
+    // Bresenham, so fast strokes between two motion samples have no gaps
+    int dx = std::abs(x1 - x0);
+    int dy = -std::abs(y1 - y0);
+    int stepX = (x0 < x1) ? 1 : -1;
+    int stepY = (y0 < y1) ? 1 : -1;
+    int error = dx + dy;
+    
+    while (true) {
+        setPixel(x0, y0, colorIndex);
+        if (x0 == x1 && y0 == y1) break;
+        
+        int doubled = 2 * error;
+        if (doubled >= dy) {
+            error += dy;
+            x0 += stepX;
+        }
+        if (doubled <= dx) {
+            error += dx;
+            y0 += stepY;
+        }
     }
     
-    return false;
+    return static_cast<int>(revision - revisionBefore);
 }
@@ -1,13 +1,21 @@
 #pragma once
 #include <SDL2/SDL.h>
 #include <vector>
+#include "PackedIndices.h"
+
+// Notified of every pixel that changes value
+class PixelChangeListener {
+public:
+    virtual ~PixelChangeListener() = default;
+    virtual void onPixelChanged(int x, int y, int oldColor, int newColor) = 0;
+};
 
 class PixelEditor {
 public:
     PixelEditor(int gridSize = 8);
     ~PixelEditor() = default;
 
-    // Get/Set pixel color at position
+    // Get/Set pixel color at position; indices outside 0-255 are ignored
     int getPixel(int x, int y) const;
     void setPixel(int x, int y, int colorIndex);
     
@@ -15,18 +23,43 @@ public:
     void clear();
     
     // Render the editing grid
-    void render(SDL_Renderer* renderer, int offsetX, int offsetY, int cellSize);
+    void render(SDL_Renderer* renderer, int offsetX, int offsetY, int cellSize) const;
     
     // Handle mouse click on grid
     bool handleClick(int mouseX, int mouseY, int gridX, int gridY, int cellSize, int colorIndex);
     
+    // Map a screen position to a cell (floored, may lie outside); true if inside the grid
+    bool screenToCell(int mouseX, int mouseY, int gridX, int gridY, int cellSize,
+                      int& cellX, int& cellY) const;
+    
+    // Paint a line of cells between two cells, clipped to the grid; returns pixels changed
+    int drawLine(int x0, int y0, int x1, int y1, int colorIndex);
+    
+    // Incremented every time a pixel actually changes value
+    Uint64 getRevision() const { return revision; }
+    
+    // Receive every change made through setPixel (nullptr to detach)
+    void setChangeListener(PixelChangeListener* listener) { changeListener = listener; }
+    
     // Get grid size
     int getGridSize() const { return gridSize; }
     
-    // Get pixel data for recursive rendering
-    const std::vector<std::vector<int>>& getPixelData() const { return pixels; }
+    // Highest color index on the grid
+    int getMaxIndex() const;
+    
+    // The grid as packed indices, valid until the next edit
+    SpriteView getView() const { return SpriteView{gridSize, bitsPerIndex, indices.data()}; }
+    
+    // Grids that pixels of a color expand into instead of copies of this one,
+    // indexed by color (empty for none); they are not part of the undo history
+    const std::vector<std::vector<Uint8>>& getRules() const { return rules; }
+    void setRules(const std::vector<std::vector<Uint8>>& newRules) { rules = newRules; }
 
 private:
     int gridSize;
-    std::vector<std::vector<int>> pixels;
+    int bitsPerIndex;            // 4 until an index above 15 is set, then 8
+    std::vector<Uint8> indices;  // Packed row-major grid, see PackedIndices
+    std::vector<std::vector<Uint8>> rules;
+    Uint64 revision;
+    PixelChangeListener* changeListener;
 };
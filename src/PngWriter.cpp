@@ -0,0 +1,259 @@
+#include "PngWriter.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <zlib.h>
+#include "OrderedWriter.h"
+#include "ThreadPool.h"
+
+namespace {
+
+void appendBigEndian(std::vector<Uint8>& out, Uint32 value) {
+    out.push_back(static_cast<Uint8>(value >> 24));
+    out.push_back(static_cast<Uint8>(value >> 16));
+    out.push_back(static_cast<Uint8>(value >> 8));
+    out.push_back(static_cast<Uint8>(value));
+}
+
+}
+
+PngWriter::PngWriter(const PngOptions& options) : options(options), bytesWritten(0) {}
+
+bool PngWriter::writeIndexed(const std::string& path, int width, int height, const Palette& palette,
+                             int colorCount, const RowSource& source) {
+    colorCount = std::max(1, std::min(colorCount, 256));
+
+    Format format;
+    format.width = width;
+    format.height = height;
+    format.colorType = 3;
+    format.bitDepth = 8;
+    while (format.bitDepth > 1 && colorCount <= (1 << (format.bitDepth / 2))) {
+        format.bitDepth /= 2;
+    }
+    format.sourceBytes = 1;
+    format.lineBytes = (static_cast<size_t>(width) * format.bitDepth + 7) / 8;
+
+    std::vector<Uint8> paletteChunk;
+    for (int index = 0; index < colorCount; index++) {
+        SDL_Color color = palette.getColor(index);
+        paletteChunk.push_back(color.r);
+        paletteChunk.push_back(color.g);
+        paletteChunk.push_back(color.b);
+    }
+    return write(path, format, paletteChunk, source);
+}
+
+bool PngWriter::writeRGB(const std::string& path, int width, int height, const RowSource& source) {
+    Format format;
+    format.width = width;
+    format.height = height;
+    format.colorType = 2;
+    format.bitDepth = 8;
+    format.sourceBytes = 3;
+    format.lineBytes = static_cast<size_t>(width) * 3;
+    return write(path, format, std::vector<Uint8>(), source);
+}
+
+bool PngWriter::write(const std::string& path, const Format& format, const std::vector<Uint8>& paletteChunk,
+                      const RowSource& source) {
+    bytesWritten = 0;
+    if (format.width < 1 || format.height < 1) return false;
+
+    std::string tempPath = path + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Could not create " << tempPath << std::endl;
+        return false;
+    }
+
+    // Signature, header, palette and the zlib stream header as a first IDAT
+    std::vector<Uint8> head = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    std::vector<Uint8> header;
+    appendBigEndian(header, static_cast<Uint32>(format.width));
+    appendBigEndian(header, static_cast<Uint32>(format.height));
+    header.push_back(static_cast<Uint8>(format.bitDepth));
+    header.push_back(static_cast<Uint8>(format.colorType));
+    header.push_back(0);  // Deflate
+    header.push_back(0);  // Adaptive filtering
+    header.push_back(0);  // No interlace
+    appendChunk(head, "IHDR", header.data(), header.size());
+    if (!paletteChunk.empty()) {
+        appendChunk(head, "PLTE", paletteChunk.data(), paletteChunk.size());
+    }
+
+    int level = std::max(1, std::min(options.compression, 9));
+    Uint8 streamHeader[2] = {0x78, static_cast<Uint8>((level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6)};
+    streamHeader[1] = static_cast<Uint8>(streamHeader[1] + 31 - (streamHeader[0] * 256 + streamHeader[1]) % 31);
+    appendChunk(head, "IDAT", streamHeader, 2);
+
+    bool ok = fwrite(head.data(), 1, head.size(), file) == head.size();
+
+    // Indexed rows go unfiltered, as the PNG spec advises for palette images;
+    // true color rows use the Up filter, which turns repeated rows into zeros
+    size_t scanlineBytes = format.lineBytes + 1;
+    int bandRows = static_cast<int>(std::max<size_t>(1, BAND_BYTES / scanlineBytes));
+    int contextRows = static_cast<int>((WINDOW_BYTES + scanlineBytes - 1) / scanlineBytes);
+    int bandCount = (format.height + bandRows - 1) / bandRows;
+    std::vector<uLong> bandAdler(bandCount);
+    std::vector<size_t> bandLength(bandCount);
+
+    OrderedWriter writer([file](Uint64, const std::vector<Uint8>& data) {
+        return fwrite(data.data(), 1, data.size(), file) == data.size();
+    }, options.maxBytesInFlight);
+
+    if (ok) {
+        ThreadPool pool(options.threads);
+
+        for (int band = 0; band < bandCount && !writer.hasFailed(); band++) {
+            int firstRow = band * bandRows;
+            int rowCount = std::min(bandRows, format.height - firstRow);
+            size_t bound = deflateBound(nullptr, static_cast<uLong>(rowCount * scanlineBytes)) + 64;
+            writer.acquire(bound);
+
+            pool.submit([&, band, firstRow, rowCount, bound] {
+                // Rows before the band rebuild the previous band's tail for the
+                // dictionary, plus one more as the Up filter's reference
+                int contextStart = std::max(0, firstRow - contextRows);
+                int sourceStart = std::max(0, contextStart - 1);
+                int sourceRows = firstRow + rowCount - sourceStart;
+                size_t sourceStride = static_cast<size_t>(format.width) * format.sourceBytes;
+
+                std::vector<Uint8> pixels(sourceStride * sourceRows);
+                source(sourceStart, sourceRows, pixels.data(), sourceStride);
+
+                std::vector<Uint8> packed(format.lineBytes * sourceRows);
+                for (int r = 0; r < sourceRows; r++) {
+                    packRow(format, &pixels[r * sourceStride], &packed[r * format.lineBytes]);
+                }
+
+                int filteredRows = firstRow + rowCount - contextStart;
+                std::vector<Uint8> filtered(scanlineBytes * filteredRows);
+                int skipped = contextStart - sourceStart;
+                filterRows(format, &packed[skipped * format.lineBytes], filteredRows,
+                           skipped > 0 ? packed.data() : nullptr, filtered.data());
+
+                size_t contextBytes = static_cast<size_t>(firstRow - contextStart) * scanlineBytes;
+                const Uint8* input = filtered.data() + contextBytes;
+                size_t inputBytes = static_cast<size_t>(rowCount) * scanlineBytes;
+                bandAdler[band] = adler32(adler32(0, nullptr, 0), input, static_cast<uInt>(inputBytes));
+                bandLength[band] = inputBytes;
+
+                // The chunk is built in place: length, type, data, CRC
+                std::vector<Uint8> chunk(8 + bound);
+                z_stream stream = {};
+                bool compressed = deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+                if (compressed && contextBytes > 0) {
+                    size_t dictionaryBytes = std::min(contextBytes, WINDOW_BYTES);
+                    compressed = deflateSetDictionary(&stream, input - dictionaryBytes,
+                                                      static_cast<uInt>(dictionaryBytes)) == Z_OK;
+                }
+                if (compressed) {
+                    stream.next_in = const_cast<Uint8*>(input);
+                    stream.avail_in = static_cast<uInt>(inputBytes);
+                    stream.next_out = chunk.data() + 8;
+                    stream.avail_out = static_cast<uInt>(bound);
+                    int flush = (band == bandCount - 1) ? Z_FINISH : Z_SYNC_FLUSH;
+                    int result = deflate(&stream, flush);
+                    
+                    // All input consumed, and the final block or the whole sync flush emitted;
+                    // a sync flush that filled the output may not have finished
+                    compressed = stream.avail_in == 0 &&
+                                 (flush == Z_FINISH ? result == Z_STREAM_END : result == Z_OK && stream.avail_out > 0);
+                }
+                size_t length = stream.total_out;
+                deflateEnd(&stream);
+                
+                // The band is still submitted, empty, so its reservation is returned
+                if (!compressed) {
+                    writer.fail();
+                    writer.submit(band, std::vector<Uint8>(), bound);
+                    return;
+                }
+
+                chunk.resize(8 + length);
+                chunk[0] = static_cast<Uint8>(length >> 24);
+                chunk[1] = static_cast<Uint8>(length >> 16);
+                chunk[2] = static_cast<Uint8>(length >> 8);
+                chunk[3] = static_cast<Uint8>(length);
+                std::memcpy(&chunk[4], "IDAT", 4);
+                appendBigEndian(chunk, static_cast<Uint32>(crc32(0, &chunk[4], static_cast<uInt>(length + 4))));
+
+                writer.submit(band, std::move(chunk), bound);
+            });
+        }
+        pool.waitIdle();
+    }
+    writer.finish();
+    ok = ok && !writer.hasFailed() && writer.getItemsWritten() == static_cast<Uint64>(bandCount);
+
+    // The stream's Adler-32 from the bands' checksums, in its own IDAT
+    uLong adler = adler32(0, nullptr, 0);
+    for (int band = 0; band < bandCount; band++) {
+        adler = adler32_combine(adler, bandAdler[band], static_cast<z_off_t>(bandLength[band]));
+    }
+    std::vector<Uint8> tail;
+    std::vector<Uint8> checksum;
+    appendBigEndian(checksum, static_cast<Uint32>(adler));
+    appendChunk(tail, "IDAT", checksum.data(), checksum.size());
+    appendChunk(tail, "IEND", nullptr, 0);
+
+    ok = ok && fwrite(tail.data(), 1, tail.size(), file) == tail.size();
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(tempPath.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        std::cerr << "Could not write " << path << std::endl;
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    bytesWritten = head.size() + writer.getBytesWritten() + tail.size();
+    return true;
+}
+
+void PngWriter::filterRows(const Format& format, const Uint8* packed, int rowCount, const Uint8* previous,
+                           Uint8* out) {
+    for (int r = 0; r < rowCount; r++) {
+        const Uint8* row = packed + r * format.lineBytes;
+        Uint8* target = out + r * (format.lineBytes + 1);
+
+        if (format.colorType == 3 || !previous) {
+            target[0] = 0;  // None
+            std::memcpy(target + 1, row, format.lineBytes);
+        } else {
+            target[0] = 2;  // Up
+            for (size_t i = 0; i < format.lineBytes; i++) {
+                target[1 + i] = static_cast<Uint8>(row[i] - previous[i]);
+            }
+        }
+        previous = row;
+    }
+}
+
+void PngWriter::packRow(const Format& format, const Uint8* pixels, Uint8* out) {
+    if (format.bitDepth == 8) {
+        std::memcpy(out, pixels, format.lineBytes);
+        return;
+    }
+
+    // Leftmost pixel in the high bits
+    int perByte = 8 / format.bitDepth;
+    Uint8 mask = static_cast<Uint8>((1 << format.bitDepth) - 1);
+    std::memset(out, 0, format.lineBytes);
+    for (int x = 0; x < format.width; x++) {
+        int shift = 8 - format.bitDepth * (x % perByte + 1);
+        out[x / perByte] |= static_cast<Uint8>((pixels[x] & mask) << shift);
+    }
+}
+
+void PngWriter::appendChunk(std::vector<Uint8>& out, const char type[4], const Uint8* data, size_t length) {
+    appendBigEndian(out, static_cast<Uint32>(length));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (length > 0) {
+        out.insert(out.end(), data, data + length);
+    }
+    appendBigEndian(out, static_cast<Uint32>(crc32(0, &out[start], static_cast<uInt>(length + 4))));
+}
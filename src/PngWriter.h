@@ -0,0 +1,73 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Palette.h"
+
+struct PngOptions {
+    int threads = 0;          // 0 means one per hardware core
+    int compression = 6;      // zlib level 1-9
+    size_t maxBytesInFlight = static_cast<size_t>(256) << 20;
+};
+
+// PNG encoder whose deflate runs on all cores. The image is cut into bands
+// of rows; each band is filtered and compressed on its own as a raw deflate
+// stream ended by a sync flush (the last one by a final block), so the bands
+// concatenate into a single zlib stream. A band is primed with the 32 KB of
+// filtered data before it as its dictionary, which keeps the ratio close to a
+// serial encode. Every band becomes its own IDAT chunk with its CRC computed
+// by the worker, and the Adler-32 of the whole stream is combined from the
+// bands' checksums. Compressed bands are written in order on a separate
+// thread while the memory they hold stays bounded.
+class PngWriter {
+public:
+    // Fill rowCount rows starting at firstRow, rows stride bytes apart: one
+    // palette index per pixel for indexed images, RGB for true color ones.
+    // Called from several threads at once.
+    using RowSource = std::function<void(int firstRow, int rowCount, Uint8* out, size_t stride)>;
+
+    explicit PngWriter(const PngOptions& options);
+    ~PngWriter() = default;
+
+    // Palette image with a PLTE chunk taken from palette; the bit depth is the
+    // smallest that holds colorCount entries (4 bits for 16 colors)
+    bool writeIndexed(const std::string& path, int width, int height, const Palette& palette,
+                      int colorCount, const RowSource& source);
+
+    // 8-bit RGB image
+    bool writeRGB(const std::string& path, int width, int height, const RowSource& source);
+
+    Uint64 getBytesWritten() const { return bytesWritten; }
+
+private:
+    static constexpr size_t BAND_BYTES = 1 << 20;   // Filtered bytes per band
+    static constexpr size_t WINDOW_BYTES = 32768;  // Deflate window, primed from the previous band
+
+    // How raw pixels become filtered scanlines
+    struct Format {
+        int width;
+        int height;
+        int colorType;        // 2 RGB, 3 indexed
+        int bitDepth;
+        int sourceBytes;      // Bytes per pixel the row source delivers
+        size_t lineBytes;     // Packed pixel bytes of one scanline, without the filter byte
+    };
+
+    PngOptions options;
+    Uint64 bytesWritten;
+
+    bool write(const std::string& path, const Format& format, const std::vector<Uint8>& paletteChunk,
+               const RowSource& source);
+
+    // Source pixels to packed scanline bytes (several indices per byte below 8 bits)
+    static void packRow(const Format& format, const Uint8* pixels, Uint8* out);
+
+    // Prefix packed rows with their filter byte; previous is the packed row
+    // above the first one, or null at the top of the image
+    static void filterRows(const Format& format, const Uint8* packed, int rowCount, const Uint8* previous,
+                           Uint8* out);
+
+    static void appendChunk(std::vector<Uint8>& out, const char type[4], const Uint8* data, size_t length);
+};
@@ -0,0 +1,415 @@
+#include "RecursiveExpander.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace {
+
+// One row of a level from its parent row: every parent pixel contributes one
+// row of its state's tile (a block, or the expansion of several levels).
+// With the tile side known at compile time each copy is a fixed-width move
+// the compiler unrolls instead of a memcpy call.
+template <int N>
+void expandTileRow(const Uint8* parent, int parentWidth, const Uint8* tiles, int tileRow, Uint8* destination) {
+    constexpr int CELLS = N * N;
+    const Uint8* row = tiles + tileRow * N;
+    for (int x = 0; x < parentWidth; x++) {
+        std::memcpy(destination + x * N, row + static_cast<size_t>(parent[x]) * CELLS, N);
+    }
+}
+
+void expandTileRow(const Uint8* parent, int parentWidth, const Uint8* tiles, int side, int tileRow,
+                   Uint8* destination) {
+    // Common sides get a specialized copy loop
+    switch (side) {
+        case 8:
+            expandTileRow<8>(parent, parentWidth, tiles, tileRow, destination);
+            return;
+        case 16:
+            expandTileRow<16>(parent, parentWidth, tiles, tileRow, destination);
+            return;
+        case 32:
+            expandTileRow<32>(parent, parentWidth, tiles, tileRow, destination);
+            return;
+        case 64:
+            expandTileRow<64>(parent, parentWidth, tiles, tileRow, destination);
+            return;
+    }
+
+    size_t cells = static_cast<size_t>(side) * side;
+    const Uint8* row = tiles + tileRow * side;
+    for (int x = 0; x < parentWidth; x++) {
+        std::memcpy(destination + x * side, row + parent[x] * cells, side);
+    }
+}
+
+}
+
+RecursiveExpander::RecursiveExpander(const Uint8* baseIndices, int baseSize, int depth, const BlendTable& blend,
+                                     const std::vector<std::vector<Uint8>>& rules)
+    : baseSize(baseSize), depth(std::max(1, std::min(depth, getMaxDepth(baseSize)))), blend(blend),
+      rules(rules), tileLevels(0), tileSide(1) {
+    base.assign(baseIndices, baseIndices + baseSize * baseSize);
+    initialize();
+}
+
+RecursiveExpander::RecursiveExpander(const SpriteView& sprite, int depth, const BlendTable& blend,
+                                     const std::vector<std::vector<Uint8>>& rules)
+    : baseSize(sprite.gridSize), depth(std::max(1, std::min(depth, getMaxDepth(sprite.gridSize)))),
+      blend(blend), rules(rules), tileLevels(0), tileSide(1) {
+    base.resize(static_cast<size_t>(baseSize) * baseSize);
+    sprite.unpack(base.data());
+    initialize();
+}
+
+void RecursiveExpander::initialize() {
+    // Rules of the wrong size are ignored
+    for (std::vector<Uint8>& rule : this->rules) {
+        if (rule.size() != static_cast<size_t>(baseSize) * baseSize) {
+            rule.clear();
+        }
+    }
+
+    outputSize = 1;
+    for (int level = 0; level < this->depth; level++) {
+        outputSize *= baseSize;
+    }
+
+    buildBlocks();
+}
+
+int RecursiveExpander::getMaxDepth(int baseSize) {
+    if (baseSize < 2) return 1;
+
+    int maxDepth = 0;
+    long long size = 1;
+    while (size * baseSize <= INT_MAX) {
+        size *= baseSize;
+        maxDepth++;
+    }
+    return maxDepth;
+}
+
+void RecursiveExpander::buildBlocks() {
+    int cells = baseSize * baseSize;
+    stateCount = 1 + *std::max_element(base.begin(), base.end());
+    zeroIsBackground = rules.empty() || rules[0].empty();
+
+    // A color with a rule becomes its grid; any other colored pixel becomes a
+    // copy of the base painted through the blend (in its own color unless
+    // compositing), and background stays background. Rules and blends can
+    // produce states the base does not use, which get blocks too.
+    blocks.clear();
+    for (int state = 0; state < stateCount; state++) {
+        bool hasRule = state < static_cast<int>(rules.size()) && !rules[state].empty();
+        for (int i = 0; i < cells; i++) {
+            Uint8 child = hasRule ? rules[state][i]
+                        : (state == 0) ? 0 : blend.blend(static_cast<Uint8>(state), base[i]);
+            blocks.push_back(child);
+            stateCount = std::max(stateCount, child + 1);
+        }
+    }
+
+    buildTiles();
+}
+
+void RecursiveExpander::buildTiles() {
+    // As many levels as fit a tile of TILE_MAX_SIDE, if that is at least two
+    // and the output is deeper than the tiles
+    tileLevels = 0;
+    tileSide = 1;
+    while (tileSide * baseSize <= TILE_MAX_SIDE &&
+           static_cast<size_t>(stateCount) * tileSide * baseSize * tileSide * baseSize <= TILE_MAX_BYTES) {
+        tileSide *= baseSize;
+        tileLevels++;
+    }
+    if (tileLevels < 2 || depth <= tileLevels) {
+        tileLevels = 0;
+        tileSide = 1;
+        tiles.clear();
+        return;
+    }
+
+    // Level by level: the tiles one level deeper are the blocks with every
+    // cell replaced by the tile of its state
+    std::vector<Uint8> current = blocks;
+    int side = baseSize;
+    for (int level = 1; level < tileLevels; level++) {
+        int nextSide = side * baseSize;
+        size_t nextCells = static_cast<size_t>(nextSide) * nextSide;
+        std::vector<Uint8> next(stateCount * nextCells);
+        for (int state = 0; state < stateCount; state++) {
+            const Uint8* block = getBlock(state);
+            Uint8* tile = &next[state * nextCells];
+            for (int row = 0; row < nextSide; row++) {
+                expandTileRow(block + (row / side) * baseSize, baseSize, current.data(), side, row % side,
+                              tile + static_cast<size_t>(row) * nextSide);
+            }
+        }
+        current.swap(next);
+        side = nextSide;
+    }
+    tiles.swap(current);
+}
+
+void RecursiveExpander::expandRows(int firstRow, int rowCount, Uint8* out, size_t stride) const {
+    // The last levels come from the tiles if there are any, otherwise the
+    // output rows are one level below their parent rows
+    int step = (tileLevels > 0) ? tileLevels : 1;
+    int side = (tileLevels > 0) ? tileSide : baseSize;
+    const Uint8* source = (tileLevels > 0) ? tiles.data() : blocks.data();
+    int parentLevel = depth - 1 - step;
+
+    RowCache cache;
+    cache.rows.resize(std::max(0, parentLevel + 1));
+    cache.rowIndex.assign(cache.rows.size(), -1);
+
+    for (int r = 0; r < rowCount; r++) {
+        int row = firstRow + r;
+        Uint8* target = out + r * stride;
+
+        if (depth == 1) {
+            std::memcpy(target, &base[row * baseSize], baseSize);
+            continue;
+        }
+
+        fillRow(cache, parentLevel, row / side);
+        const std::vector<Uint8>& parent = cache.rows[parentLevel];
+        expandTileRow(parent.data(), static_cast<int>(parent.size()), source, side, row % side, target);
+    }
+}
+
+void RecursiveExpander::fillRow(RowCache& cache, int level, int row) const {
+    if (cache.rowIndex[level] == row) return;
+
+    std::vector<Uint8>& destination = cache.rows[level];
+    if (level == 0) {
+        destination.assign(&base[row * baseSize], &base[row * baseSize] + baseSize);
+    } else {
+        fillRow(cache, level - 1, row / baseSize);
+        const std::vector<Uint8>& parent = cache.rows[level - 1];
+        destination.resize(parent.size() * baseSize);
+        expandTileRow(parent.data(), static_cast<int>(parent.size()), blocks.data(), baseSize, row % baseSize,
+                      destination.data());
+    }
+    cache.rowIndex[level] = row;
+}
+
+void RecursiveExpander::expandRegion(int x, int y, int width, int height, Uint8* out, size_t stride) const {
+    if (width <= 0 || height <= 0) return;
+    SDL_Rect region = {x, y, width, height};
+    expandNode(base.data(), outputSize / baseSize, 0, 0, region, out, stride);
+}
+
+void RecursiveExpander::expandNode(const Uint8* block, int childSize, int originX, int originY,
+                                   const SDL_Rect& region, Uint8* out, size_t stride) const {
+    int cells = baseSize * baseSize;
+
+    for (int j = 0; j < baseSize; j++) {
+        int top = originY + j * childSize;
+        int clipTop = std::max(top, region.y);
+        int clipBottom = std::min(top + childSize, region.y + region.h);
+        if (clipTop >= clipBottom) continue;
+
+        for (int i = 0; i < baseSize; i++) {
+            int left = originX + i * childSize;
+            int clipLeft = std::max(left, region.x);
+            int clipRight = std::min(left + childSize, region.x + region.w);
+            if (clipLeft >= clipRight) continue;
+
+            Uint8 state = block[j * baseSize + i];
+            Uint8* target = out + static_cast<size_t>(clipTop - region.y) * stride + (clipLeft - region.x);
+            if (childSize == 1) {
+                *target = state;
+            } else if (state == 0 && zeroIsBackground) {
+                for (int row = clipTop; row < clipBottom; row++) {
+                    std::memset(target + static_cast<size_t>(row - clipTop) * stride, 0, clipRight - clipLeft);
+                }
+            } else {
+                expandNode(&blocks[static_cast<size_t>(state) * cells], childSize / baseSize, left, top,
+                           region, out, stride);
+            }
+        }
+    }
+}
+
+Uint8 RecursiveExpander::getState(int level, int x, int y) const {
+    int side = 1;  // Pixels of the depth-`level` expansion under one base pixel
+    for (int l = 1; l < level; l++) {
+        side *= baseSize;
+    }
+
+    Uint8 state = base[(y / side) * baseSize + x / side];
+    while (side > 1) {
+        x %= side;
+        y %= side;
+        side /= baseSize;
+        state = blocks[static_cast<size_t>(state) * baseSize * baseSize + (y / side) * baseSize + x / side];
+    }
+    return state;
+}
+
+size_t RecursiveExpander::applyEdit(int x, int y, Uint8 index, Uint8* image, size_t stride, SDL_Rect* dirty) {
+    if (dirty) {
+        *dirty = {0, 0, 0, 0};
+    }
+    if (x < 0 || x >= baseSize || y < 0 || y >= baseSize) return 0;
+
+    int cells = baseSize * baseSize;
+    int position = y * baseSize + x;
+    if (base[position] == index) return 0;
+
+    // Remember each state's entry at the edited position to see which blocks change
+    std::vector<Uint8> oldEntries(stateCount);
+    for (int state = 0; state < stateCount; state++) {
+        oldEntries[state] = blocks[static_cast<size_t>(state) * cells + position];
+    }
+    int oldStateCount = stateCount;
+
+    base[position] = index;
+    buildBlocks();
+
+    EditWalk walk;
+    walk.position = position;
+    walk.changed.assign(stateCount, false);
+    for (int state = 0; state < stateCount; state++) {
+        walk.changed[state] = state >= oldStateCount ||
+                              blocks[static_cast<size_t>(state) * cells + position] != oldEntries[state];
+    }
+
+    // States whose expansion can contain a changed state; everything else is left alone
+    walk.reaches = walk.changed;
+    bool grew = true;
+    while (grew) {
+        grew = false;
+        for (int state = 0; state < stateCount; state++) {
+            if (walk.reaches[state]) continue;
+            const Uint8* block = &blocks[static_cast<size_t>(state) * cells];
+            for (int i = 0; i < cells; i++) {
+                if (walk.reaches[block[i]]) {
+                    walk.reaches[state] = true;
+                    grew = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    walk.levelSize.resize(depth + 1);
+    walk.levelSize[0] = outputSize;
+    for (int level = 1; level <= depth; level++) {
+        walk.levelSize[level] = walk.levelSize[level - 1] / baseSize;
+    }
+    walk.image = image;
+    walk.stride = stride;
+    walk.written = 0;
+    walk.minX = outputSize;
+    walk.minY = outputSize;
+    walk.maxX = 0;
+    walk.maxY = 0;
+
+    double total = static_cast<double>(outputSize) * outputSize;
+    if (estimateEditPixels(walk) * 2 >= total) {
+        expandRows(0, outputSize, image, stride);
+        if (dirty) {
+            *dirty = {0, 0, outputSize, outputSize};
+        }
+        return static_cast<size_t>(outputSize) * outputSize;
+    }
+
+    visitEdit(walk, 0, base.data(), true, 0, 0);
+
+    if (dirty && walk.written > 0) {
+        *dirty = {walk.minX, walk.minY, walk.maxX - walk.minX, walk.maxY - walk.minY};
+    }
+    return walk.written;
+}
+
+double RecursiveExpander::estimateEditPixels(const EditWalk& walk) const {
+    int cells = baseSize * baseSize;
+
+    // The square under the edited position of the base itself, plus the one under
+    // the edited position of every node in a changed state: count nodes per state
+    double pixels = static_cast<double>(walk.levelSize[1]) * walk.levelSize[1];
+    std::vector<double> nodes(stateCount, 0.0);
+    for (int i = 0; i < cells; i++) {
+        nodes[base[i]] += 1.0;
+    }
+
+    for (int level = 1; level < depth; level++) {
+        double size = walk.levelSize[level + 1];
+        std::vector<double> next(stateCount, 0.0);
+        for (int state = 0; state < stateCount; state++) {
+            if (nodes[state] == 0.0) continue;
+            if (walk.changed[state]) {
+                pixels += nodes[state] * size * size;
+            }
+
+            const Uint8* block = &blocks[static_cast<size_t>(state) * cells];
+            for (int i = 0; i < cells; i++) {
+                next[block[i]] += nodes[state];
+            }
+        }
+        nodes.swap(next);
+    }
+
+    return pixels;
+}
+
+void RecursiveExpander::visitEdit(EditWalk& walk, int level, const Uint8* block, bool changed,
+                                  int originX, int originY) const {
+    int cells = baseSize * baseSize;
+    int childSize = walk.levelSize[level + 1];
+
+    if (changed) {
+        int childX = originX + (walk.position % baseSize) * childSize;
+        int childY = originY + (walk.position / baseSize) * childSize;
+        writeState(walk, block[walk.position], level + 1, childX, childY);
+    }
+
+    if (level + 1 >= depth) return;
+
+    for (int i = 0; i < cells; i++) {
+        if (i == walk.position && changed) continue;
+
+        Uint8 state = block[i];
+        if (!walk.reaches[state]) continue;
+
+        visitEdit(walk, level + 1, &blocks[static_cast<size_t>(state) * cells], walk.changed[state],
+                  originX + (i % baseSize) * childSize, originY + (i / baseSize) * childSize);
+    }
+}
+
+void RecursiveExpander::writeState(EditWalk& walk, Uint8 state, int level, int originX, int originY) const {
+    int size = walk.levelSize[level];
+    Uint8* target = walk.image + static_cast<size_t>(originY) * walk.stride + originX;
+
+    if (level == depth) {
+        *target = state;
+    } else if (state == 0 && zeroIsBackground) {
+        for (int row = 0; row < size; row++) {
+            std::memset(target + row * walk.stride, 0, size);
+        }
+    } else if (level == depth - 1) {
+        const Uint8* block = &blocks[static_cast<size_t>(state) * baseSize * baseSize];
+        for (int row = 0; row < baseSize; row++) {
+            std::memcpy(target + row * walk.stride, block + row * baseSize, baseSize);
+        }
+    } else {
+        // Recurse without counting: the square is accounted for below
+        size_t written = walk.written;
+        int childSize = walk.levelSize[level + 1];
+        const Uint8* block = &blocks[static_cast<size_t>(state) * baseSize * baseSize];
+        for (int i = 0; i < baseSize * baseSize; i++) {
+            writeState(walk, block[i], level + 1,
+                       originX + (i % baseSize) * childSize, originY + (i / baseSize) * childSize);
+        }
+        walk.written = written;
+    }
+
+    walk.written += static_cast<size_t>(size) * size;
+    walk.minX = std::min(walk.minX, originX);
+    walk.minY = std::min(walk.minY, originY);
+    walk.maxX = std::max(walk.maxX, originX + size);
+    walk.maxY = std::max(walk.maxY, originY + size);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <vector>
+#include "BlendTable.h"
+#include "PackedIndices.h"
+
+// Headless core of the recursive rendering: expands a base grid to depth d,
+// producing baseSize^d x baseSize^d palette indices (0 is background).
+// Depth 1 is the grid itself, depth 2 is what RecursiveRenderer draws: every
+// non-zero pixel becomes a copy of the grid painted in that pixel's color.
+//
+// The expansion is a substitution: a pixel with index s at one level becomes
+// the block blocks[s] at the next. With a BlendTable, blocks[s] holds each
+// grid pixel composited with s instead of s itself; the substitution, and
+// every cost below, stay the same. A color may also have a rule of its own,
+// any baseSize x baseSize grid it becomes instead of a copy of the base,
+// which makes this a general 2D substitution system; a rule for index 0
+// lets the background expand as well.
+//
+// Rows are generated top-down from their parent rows, so any band of rows can
+// be produced independently. The expansion of every state over the last few
+// levels is precomputed as a tile of up to TILE_MAX_SIDE pixels, so an output
+// row costs one copy of a tile row per TILE_MAX_SIDE pixels or so, whatever
+// the depth and the rules.
+class RecursiveExpander {
+public:
+    // rules[s], if not empty, is the baseSize x baseSize grid that color s becomes
+    RecursiveExpander(const Uint8* baseIndices, int baseSize, int depth, const BlendTable& blend = BlendTable(),
+                      const std::vector<std::vector<Uint8>>& rules = {});
+    
+    // Expand a sprite's packed grid, a file, library entry or the editor's, as is
+    RecursiveExpander(const SpriteView& sprite, int depth, const BlendTable& blend = BlendTable(),
+                      const std::vector<std::vector<Uint8>>& rules = {});
+    ~RecursiveExpander() = default;
+
+    int getBaseSize() const { return baseSize; }
+    int getDepth() const { return depth; }
+    const BlendTable& getBlend() const { return blend; }
+
+    // Width and height of the expanded image
+    int getOutputSize() const { return outputSize; }
+
+    // Expand rows [firstRow, firstRow + rowCount) into out, one index per pixel.
+    // Safe to call from several threads at once.
+    void expandRows(int firstRow, int rowCount, Uint8* out, size_t stride) const;
+
+    // Expand the rectangle [x, x + width) x [y, y + height) into out, visiting
+    // only the nodes that overlap it. Safe to call from several threads at once.
+    void expandRegion(int x, int y, int width, int height, Uint8* out, size_t stride) const;
+
+    // Index of the pixel at (x, y) of the depth-`level` expansion, 1 <= level <= depth
+    Uint8 getState(int level, int x, int y) const;
+
+    // States are 0..getStateCount()-1; a state's block is baseSize x baseSize states
+    int getStateCount() const { return stateCount; }
+    const Uint8* getBlock(int state) const { return &blocks[static_cast<size_t>(state) * baseSize * baseSize]; }
+
+    // Index of a base pixel as the expander currently sees it
+    Uint8 getBaseIndex(int x, int y) const { return base[y * baseSize + x]; }
+
+    // Change one base pixel and bring image, a full output of this expander
+    // (rows stride bytes apart), up to date. Only the output blocks whose
+    // substitution path passes through the edited position are rewritten,
+    // unless that would touch most of the image, in which case the whole
+    // image is regenerated. Returns the number of output pixels written;
+    // dirty, if given, receives their bounding rectangle.
+    size_t applyEdit(int x, int y, Uint8 index, Uint8* image, size_t stride, SDL_Rect* dirty = nullptr);
+
+    // Largest depth whose output size still fits in an int
+    static int getMaxDepth(int baseSize);
+
+private:
+    static const int TILE_MAX_SIDE = 64;                 // Widest precomputed tile
+    static const size_t TILE_MAX_BYTES = 1 << 20;        // Tiles of all states together
+
+    // Rows of every level above the output that are currently expanded
+    struct RowCache {
+        std::vector<std::vector<Uint8>> rows;
+        std::vector<int> rowIndex;
+    };
+
+    int baseSize;
+    int depth;
+    int outputSize;
+    int stateCount;
+    bool zeroIsBackground;  // State 0 only ever expands to 0
+    std::vector<Uint8> base;
+    std::vector<Uint8> blocks;  // stateCount blocks of baseSize x baseSize
+    BlendTable blend;
+    std::vector<std::vector<Uint8>> rules;
+
+    // Expansion of every state over tileLevels levels, tileSide x tileSide
+    // each; tileLevels is 0 when tiles would not save anything
+    int tileLevels;
+    int tileSide;
+    std::vector<Uint8> tiles;
+
+    // What applyEdit needs while walking the substitution tree
+    struct EditWalk {
+        int position;
+        std::vector<bool> changed;   // The state's block differs at position
+        std::vector<bool> reaches;   // The state's expansion contains a changed state
+        std::vector<int> levelSize;  // Side of one node's square at each level
+        Uint8* image;
+        size_t stride;
+        size_t written;
+        int minX, minY, maxX, maxY;
+    };
+
+    // Validate the rules and size the output once base is set
+    void initialize();
+    void buildBlocks();
+    void buildTiles();
+
+    // Make cache hold row `row` of level `level` (the base is level 0)
+    void fillRow(RowCache& cache, int level, int row) const;
+    void expandNode(const Uint8* block, int childSize, int originX, int originY, const SDL_Rect& region,
+                    Uint8* out, size_t stride) const;
+    double estimateEditPixels(const EditWalk& walk) const;
+    void visitEdit(EditWalk& walk, int level, const Uint8* block, bool changed, int originX, int originY) const;
+    void writeState(EditWalk& walk, Uint8 state, int level, int originX, int originY) const;
+};
@@ -1,14 +1,148 @@
 #include "RecursiveRenderer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include "CoverageTable.h"
+#include "MipPyramid.h"
 
-RecursiveRenderer::RecursiveRenderer(int baseSize, int outputSize) 
-    : baseSize(baseSize), outputSize(outputSize) {
+RecursiveRenderer::RecursiveRenderer(int baseSize, int outputSize, int depth, size_t cacheBytes) 
+    : baseSize(baseSize), outputSize(outputSize), depth(1), filtered(true), blendMode(BlendMode::Source),
+      cache(cacheBytes), texture(nullptr), textureSize(0), textureLevels(1), premultipliedBlending(true),
+      refineTexture(nullptr), refineTextureSize(0),
+      workingResolved(false) {
     scaleFactor = outputSize / baseSize;
     startTime = SDL_GetTicks();  // Initialize start time
+    baseIndices.resize(baseSize * baseSize, 0);
+    setDepth(depth);
+}
+
+RecursiveRenderer::~RecursiveRenderer() {
+    releaseTexture();
+}
+
+void RecursiveRenderer::setDepth(int newDepth) {
+    depth = std::max(1, std::min(newDepth, RecursiveExpander::getMaxDepth(baseSize)));
+}
+
+void RecursiveRenderer::setRules(const std::vector<std::vector<Uint8>>& newRules) {
+    if (newRules == rules) return;
+    
+    // The working expansion was built with the old rules
+    rules = newRules;
+    expander.reset();
+    progressive.reset();
+}
+
+void RecursiveRenderer::releaseTexture() {
+    if (texture) {
+        SDL_DestroyTexture(texture);
+        texture = nullptr;
+    }
+    if (refineTexture) {
+        SDL_DestroyTexture(refineTexture);
+        refineTexture = nullptr;
+    }
+    for (SDL_Texture* mipTexture : mipTextures) {
+        if (mipTexture) {
+            SDL_DestroyTexture(mipTexture);
+        }
+    }
+    mipTextures.clear();
+    mipTextureSizes.clear();
+    textureLevels = 1;
+    textureSize = 0;
+    refineTextureSize = 0;
+    textureKey = RenderKey();
+    progressive.reset();
 }
 
 void RecursiveRenderer::render(SDL_Renderer* renderer, const PixelEditor& editor, 
                               const Palette& palette, int offsetX, int offsetY) {
-    const auto& pixelData = editor.getPixelData();
+    if (editor.getGridSize() != baseSize) return;
+    setRules(editor.getRules());
+    render(renderer, editor.getView(), palette, offsetX, offsetY);
+}
+
+void RecursiveRenderer::render(SDL_Renderer* renderer, const SpriteView& sprite,
+                              const Palette& palette, int offsetX, int offsetY) {
+    if (sprite.gridSize != baseSize) return;
+    
+    sprite.unpack(baseIndices.data());
+    renderBase(renderer, palette, offsetX, offsetY);
+}
+
+void RecursiveRenderer::renderBase(SDL_Renderer* renderer, const Palette& palette, int offsetX, int offsetY) {
+    // Composited states depend on the palette, so the working expansion goes with an old table
+    if (!blend.matches(palette, blendMode)) {
+        blend = BlendTable(palette, blendMode);
+        expander.reset();
+    }
+    
+    // Once sub-pixels are smaller than screen pixels, draw their area average
+    // at about screen resolution instead of the full expansion
+    int maxDisplaySize = scaleFactor * baseSize * 2;  // Largest pulsating size
+    bool averaged = filtered && getLevelSize(depth) > maxDisplaySize;
+    
+    int renderDepth = depth;
+    int coverageLevel = 0;
+    int factor = 1;
+    int imageSize;
+    if (averaged) {
+        // Smallest level at least as large as the display, then the largest
+        // whole box filter that keeps it so
+        coverageLevel = 1;
+        while (getLevelSize(coverageLevel) < maxDisplaySize) {
+            coverageLevel++;
+        }
+        int levelSize = getLevelSize(coverageLevel);
+        for (factor = levelSize / maxDisplaySize; factor > 1 && levelSize % factor != 0; factor--) {
+        }
+        imageSize = levelSize / factor;
+    } else {
+        while (renderDepth > 1 && getLevelSize(renderDepth) > MAX_TEXTURE_SIZE) {
+            renderDepth--;
+        }
+        imageSize = getLevelSize(renderDepth);
+    }
+    
+    // Only touch the texture when the render it shows is out of date
+    RenderKey key = RenderCache::makeKey(baseIndices.data(), baseSize, palette, renderDepth, imageSize,
+                                         blendMode, rules);
+    if (progressive && progressive->key == key) {
+        continueProgressive(renderer, palette);
+    } else if (!texture || key != textureKey) {
+        progressive.reset();
+        
+        RenderCache::Buffer image = cache.find(key);
+        if (image) {
+            if (!uploadTexture(renderer, *image, imageSize)) return;
+            textureKey = std::move(key);
+        } else if (averaged || static_cast<double>(imageSize) * imageSize <= MAX_FRAME_PIXELS) {
+            // If the texture shows the working image, a patch only needs its changed rectangle
+            bool textureCurrent = texture && !workingKey.identity.empty() && textureKey == workingKey &&
+                                  workingResolved == averaged && textureSize == imageSize;
+            SDL_Rect dirty;
+            bool rebuilt = averaged ? resolveImage(palette, coverageLevel, factor, dirty)
+                                    : expandImage(palette, renderDepth, imageSize, dirty);
+            
+            // Patched states are as cheap to patch back to, so only rebuilt images are cached
+            if (rebuilt) {
+                cache.insert(key, std::make_shared<const std::vector<Uint32>>(workingPixels));
+            }
+            bool uploaded = (rebuilt || !textureCurrent) ? uploadTexture(renderer, workingPixels, imageSize)
+                                                         : uploadRegion(workingPixels, imageSize, dirty);
+            workingKey = key;
+            if (!uploaded) return;
+            textureKey = std::move(key);
+        } else {
+            startProgressive(renderer, palette, std::move(key), renderDepth);
+        }
+    }
+    if (!texture) return;
+    
+    // Averaged images are resampled smoothly, exact ones keep hard pixel edges
+    SDL_SetTextureScaleMode(texture, averaged ? SDL_ScaleModeLinear : SDL_ScaleModeNearest);
     
     // Get the current pulsating scale factor
     float pulsatingScale = getPulsatingScaleFactor();
@@ -18,54 +152,369 @@ void RecursiveRenderer::render(SDL_Renderer* renderer, const PixelEditor& editor
     int centerOffsetX = (scaleFactor * baseSize - adjustedScaleFactor * baseSize) / 2;
     int centerOffsetY = (scaleFactor * baseSize - adjustedScaleFactor * baseSize) / 2;
     
-    // Render each pixel of the base grid as a scaled-down version of the entire image
-    for (int y = 0; y < baseSize; y++) {
-        for (int x = 0; x < baseSize; x++) {
-            int sourceColorIndex = pixelData[y][x];
+    SDL_Rect destination = {
+        offsetX + centerOffsetX,
+        offsetY + centerOffsetY,
+        adjustedScaleFactor * baseSize,
+        adjustedScaleFactor * baseSize
+    };
+    
+    if (!progressive || !progressive->expander || progressive->nextRow == 0) {
+        // The animation samples the pre-filtered level closest above its current size
+        int level = (textureLevels > 1) ? MipPyramid::selectLevel(textureSize, destination.w) : 0;
+        level = std::min(level, textureLevels - 1);
+        SDL_Texture* source = (level == 0) ? texture : mipTextures[level - 1];
+        SDL_SetTextureScaleMode(source, averaged ? SDL_ScaleModeLinear : SDL_ScaleModeNearest);
+        SDL_RenderCopy(renderer, source, nullptr, &destination);
+        return;
+    }
+    
+    // Finished rows of the finer level on top, the coarser image below them.
+    // Bands are whole multiples of baseSize rows, so the split is exact.
+    int split = destination.h * progressive->nextRow / progressive->size;
+    SDL_Rect refinedSource = {0, 0, progressive->size, progressive->nextRow};
+    SDL_Rect refinedDestination = {destination.x, destination.y, destination.w, split};
+    SDL_RenderCopy(renderer, refineTexture, &refinedSource, &refinedDestination);
+    
+    int coarseRow = textureSize * progressive->nextRow / progressive->size;
+    SDL_Rect coarseSource = {0, coarseRow, textureSize, textureSize - coarseRow};
+    SDL_Rect coarseDestination = {destination.x, destination.y + split, destination.w, destination.h - split};
+    SDL_RenderCopy(renderer, texture, &coarseSource, &coarseDestination);
+}
+
+void RecursiveRenderer::startProgressive(SDL_Renderer* renderer, const Palette& palette, RenderKey key,
+                                         int targetDepth) {
+    // The deepest level that still fits in a frame is shown right away
+    int level = targetDepth - 1;
+    while (level > 1 && static_cast<double>(getLevelSize(level)) * getLevelSize(level) > MAX_FRAME_PIXELS) {
+        level--;
+    }
+    
+    int levelSize = getLevelSize(level);
+    RenderKey levelKey = RenderCache::makeKey(baseIndices.data(), baseSize, palette, level, levelSize,
+                                              blendMode, rules);
+    if (!texture || levelKey != textureKey) {
+        RenderCache::Buffer image = cache.find(levelKey);
+        if (!image) {
+            SDL_Rect dirty;
+            expandImage(palette, level, levelSize, dirty);
+            workingKey = levelKey;
+            image = std::make_shared<const std::vector<Uint32>>(workingPixels);
+            cache.insert(levelKey, image);
+        }
+        if (!uploadTexture(renderer, *image, levelSize)) return;
+        textureKey = std::move(levelKey);
+    }
+    
+    progressive = std::make_unique<ProgressiveRender>();
+    progressive->key = std::move(key);
+    progressive->targetDepth = targetDepth;
+    progressive->level = level + 1;
+    progressive->size = 0;
+    progressive->nextRow = 0;
+    buildColorTable(palette, progressive->colors);
+    
+    continueProgressive(renderer, palette);
+}
+
+void RecursiveRenderer::continueProgressive(SDL_Renderer* renderer, const Palette& palette) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(PROGRESSIVE_BUDGET_MS);
+    const int bandRows = baseSize * 8;
+    ProgressiveRender& job = *progressive;
+    
+    while (true) {
+        if (!job.expander) {
+            job.expander = std::make_unique<RecursiveExpander>(baseIndices.data(), baseSize, job.level, blend, rules);
+            job.size = job.expander->getOutputSize();
+            job.nextRow = 0;
+            
+            // Keep the whole level only if the cache can hold it. Reserving does not
+            // touch the memory, so a large level costs nothing until rows arrive.
+            size_t levelPixels = static_cast<size_t>(job.size) * job.size;
+            job.pixels = std::make_shared<std::vector<Uint32>>();
+            if (levelPixels * sizeof(Uint32) <= cache.getMaxBytes()) {
+                job.pixels->reserve(levelPixels);
+            }
+            job.band.resize(static_cast<size_t>(job.size) * std::min(bandRows, job.size));
+            job.bandColors.resize(job.band.size());
+            if (!createTexture(renderer, refineTexture, refineTextureSize, job.size)) {
+                progressive.reset();
+                return;
+            }
+        }
+        
+        bool wholeLevel = job.pixels->capacity() > 0;
+        while (job.nextRow < job.size && std::chrono::steady_clock::now() < deadline) {
+            int rows = std::min(bandRows, job.size - job.nextRow);
+            job.expander->expandRows(job.nextRow, rows, job.band.data(), job.size);
+            
+            size_t count = static_cast<size_t>(rows) * job.size;
+            for (size_t i = 0; i < count; i++) {
+                job.bandColors[i] = job.colors[job.band[i]];
+            }
             
-            // Only render recursive copy if the source pixel is not dark (not black/index 0)
-            if (sourceColorIndex != 0) {
-                int pixelX = offsetX + centerOffsetX + x * adjustedScaleFactor;
-                int pixelY = offsetY + centerOffsetY + y * adjustedScaleFactor;
-                
-                // Get the color for this recursive copy from the source pixel
-                SDL_Color sourceColor = palette.getColor(sourceColorIndex);
-                
-                renderPixelRecursive(renderer, editor, palette, pixelX, pixelY, adjustedScaleFactor, sourceColor);
+            SDL_Rect bandRect = {0, job.nextRow, job.size, rows};
+            SDL_UpdateTexture(refineTexture, &bandRect, job.bandColors.data(), job.size * sizeof(Uint32));
+            if (wholeLevel) {
+                job.pixels->insert(job.pixels->end(), job.bandColors.begin(), job.bandColors.begin() + count);
             }
+            job.nextRow += rows;
         }
+        if (job.nextRow < job.size) return;
+        
+        // Level complete: it becomes the image the next level refines
+        RenderKey levelKey = (job.level == job.targetDepth)
+            ? job.key
+            : RenderCache::makeKey(baseIndices.data(), baseSize, palette, job.level, job.size, blendMode, rules);
+        if (wholeLevel) {
+            cache.insert(levelKey, job.pixels);
+        }
+        std::swap(texture, refineTexture);
+        std::swap(textureSize, refineTextureSize);
+        textureKey = std::move(levelKey);
+        
+        if (job.level == job.targetDepth) {
+            progressive.reset();
+            return;
+        }
+        
+        job.level++;
+        job.expander.reset();
+        if (std::chrono::steady_clock::now() >= deadline) return;
     }
 }
 
-void RecursiveRenderer::renderPixelRecursive(SDL_Renderer* renderer, const PixelEditor& editor, 
-                                           const Palette& palette, int x, int y, int size, SDL_Color sourceColor) {
-    const auto& pixelData = editor.getPixelData();
-    int pixelSize = size / baseSize;
+bool RecursiveRenderer::expandImage(const Palette& palette, int levelDepth, int imageSize, SDL_Rect& dirty) {
+    Uint32 colors[256];
+    buildColorTable(palette, colors);
+    
+    bool patched = updateExpansion(levelDepth, dirty);
     
-    // If pixel size is too small, just fill with a single color
-    if (pixelSize < 1) {
-        pixelSize = 1;
+    // Recolor only what the patch touched, unless the previous colors are unusable
+    bool rebuilt = !patched || workingKey.identity.empty() || workingResolved ||
+                   workingPixels.size() != expandedIndices.size() ||
+                   std::memcmp(colors, workingColors, sizeof(colors)) != 0;
+    if (rebuilt) {
+        dirty = {0, 0, imageSize, imageSize};
+        workingPixels.resize(expandedIndices.size());
     }
     
-    for (int py = 0; py < baseSize; py++) {
-        for (int px = 0; px < baseSize; px++) {
-            int colorIndex = pixelData[py][px];
-            
-            // Only paint pixels that are not dark (not black/index 0) in the source image
-            if (colorIndex != 0) {
-                SDL_Rect rect = {
-                    x + px * pixelSize,
-                    y + py * pixelSize,
-                    pixelSize,
-                    pixelSize
-                };
-                
-                // Use the source color for this recursive copy
-                SDL_SetRenderDrawColor(renderer, sourceColor.r, sourceColor.g, sourceColor.b, sourceColor.a);
-                SDL_RenderFillRect(renderer, &rect);
+    for (int y = dirty.y; y < dirty.y + dirty.h; y++) {
+        size_t row = static_cast<size_t>(y) * imageSize;
+        for (int x = dirty.x; x < dirty.x + dirty.w; x++) {
+            workingPixels[row + x] = colors[expandedIndices[row + x]];
+        }
+    }
+    
+    std::memcpy(workingColors, colors, sizeof(colors));
+    workingResolved = false;
+    return rebuilt;
+}
+
+bool RecursiveRenderer::resolveImage(const Palette& palette, int level, int factor, SDL_Rect& dirty) {
+    Uint32 colors[256];
+    buildColorTable(palette, colors);
+    
+    SDL_Rect levelDirty;
+    bool patched = updateExpansion(level, levelDirty);
+    
+    int levelSize = getLevelSize(level);
+    int imageSize = levelSize / factor;
+    CoverageTable coverage(*expander, palette, depth - level);
+    
+    // With levels still to average, every state's coverage depends on the whole
+    // grid, so only a resolve of the level itself can be patched
+    bool rebuilt = !patched || level != depth || workingKey.identity.empty() || !workingResolved ||
+                   workingPixels.size() != MipPyramid::getTotalPixels(imageSize) ||
+                   std::memcmp(colors, workingColors, sizeof(colors)) != 0;
+    std::memcpy(workingColors, colors, sizeof(colors));
+    workingResolved = true;
+    
+    if (!rebuilt) {
+        if (levelDirty.w <= 0 || levelDirty.h <= 0) {
+            dirty = {0, 0, 0, 0};
+            return false;
+        }
+        
+        // Whole rows of image pixels over the patch, then the mip levels below them
+        int firstRow = levelDirty.y / factor;
+        int endRow = (levelDirty.y + levelDirty.h + factor - 1) / factor;
+        coverage.resolve(expandedIndices.data() + static_cast<size_t>(firstRow) * factor * levelSize, levelSize,
+                         endRow - firstRow, depth - level, factor, workingPixels.data() + static_cast<size_t>(firstRow) * imageSize);
+        
+        int firstColumn = levelDirty.x / factor;
+        int endColumn = (levelDirty.x + levelDirty.w + factor - 1) / factor;
+        dirty = {firstColumn, firstRow, endColumn - firstColumn, endRow - firstRow};
+        MipPyramid::updateRegion(workingPixels.data(), imageSize, dirty);
+        return false;
+    }
+    
+    // The mip chain follows the image in the same buffer, filtered band by band as rows are resolved
+    workingPixels.resize(MipPyramid::getTotalPixels(imageSize));
+    MipPyramid pyramid(workingPixels.data(), imageSize);
+    const int bandRows = 32;
+    for (int row = 0; row < imageSize; row += bandRows) {
+        int rows = std::min(bandRows, imageSize - row);
+        Uint32* band = workingPixels.data() + static_cast<size_t>(row) * imageSize;
+        coverage.resolve(expandedIndices.data() + static_cast<size_t>(row) * factor * levelSize, levelSize,
+                         rows, depth - level, factor, band);
+        pyramid.appendRows(band, rows);
+    }
+    dirty = {0, 0, imageSize, imageSize};
+    return true;
+}
+
+bool RecursiveRenderer::updateExpansion(int levelDepth, SDL_Rect& dirty) {
+    int imageSize = getLevelSize(levelDepth);
+    
+    // A few pixels away from the working expansion: patch it instead of starting over
+    int edits = 0;
+    bool incremental = expander && expander->getDepth() == levelDepth;
+    for (int i = 0; incremental && i < baseSize * baseSize; i++) {
+        if (expander->getBaseIndex(i % baseSize, i / baseSize) != baseIndices[i] &&
+            ++edits > MAX_INCREMENTAL_EDITS) {
+            incremental = false;
+        }
+    }
+    
+    if (!incremental) {
+        expander = std::make_unique<RecursiveExpander>(baseIndices.data(), baseSize, levelDepth, blend, rules);
+        expandedIndices.resize(static_cast<size_t>(imageSize) * imageSize);
+        expander->expandRows(0, imageSize, expandedIndices.data(), imageSize);
+        dirty = {0, 0, imageSize, imageSize};
+        return false;
+    }
+    
+    int minX = imageSize, minY = imageSize, maxX = 0, maxY = 0;
+    for (int i = 0; i < baseSize * baseSize; i++) {
+        SDL_Rect changed;
+        if (expander->applyEdit(i % baseSize, i / baseSize, baseIndices[i], expandedIndices.data(),
+                                imageSize, &changed) > 0) {
+            minX = std::min(minX, changed.x);
+            minY = std::min(minY, changed.y);
+            maxX = std::max(maxX, changed.x + changed.w);
+            maxY = std::max(maxY, changed.y + changed.h);
+        }
+    }
+    
+    dirty = (maxX > minX) ? SDL_Rect{minX, minY, maxX - minX, maxY - minY} : SDL_Rect{0, 0, 0, 0};
+    return true;
+}
+
+int RecursiveRenderer::getLevelSize(int levelDepth) const {
+    int size = 1;
+    for (int level = 0; level < levelDepth; level++) {
+        size *= baseSize;
+    }
+    return size;
+}
+
+void RecursiveRenderer::buildColorTable(const Palette& palette, Uint32 colors[256]) {
+    // The palette's ARGB words; index 0 is left transparent like the background it stands for
+    std::memcpy(colors, palette.getARGBColors(), 256 * sizeof(Uint32));
+    colors[0] = 0;
+}
+
+bool RecursiveRenderer::createTexture(SDL_Renderer* renderer, SDL_Texture*& target, int& targetSize, int imageSize) {
+    if (target && targetSize == imageSize) return true;
+    
+    if (target) {
+        SDL_DestroyTexture(target);
+    }
+    target = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                               imageSize, imageSize);
+    targetSize = target ? imageSize : 0;
+    if (!target) {
+        std::cerr << "Could not create recursive texture! SDL_Error: " << SDL_GetError() << std::endl;
+        return false;
+    }
+    
+    // Pixels are premultiplied (exact renders trivially so, alpha is 0 or 255);
+    // renderers without custom blend modes fall back to straight alpha, and
+    // uploads are converted for them
+    SDL_BlendMode premultiplied = SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+    premultipliedBlending = SDL_SetTextureBlendMode(target, premultiplied) == 0;
+    if (!premultipliedBlending) {
+        SDL_SetTextureBlendMode(target, SDL_BLENDMODE_BLEND);
+    }
+    return true;
+}
+
+bool RecursiveRenderer::uploadTexture(SDL_Renderer* renderer, const std::vector<Uint32>& pixels, int imageSize) {
+    if (!createTexture(renderer, texture, textureSize, imageSize)) {
+        textureKey = RenderKey();
+        return false;
+    }
+    
+    // Buffers larger than the image carry its mip chain; every level gets a texture
+    textureLevels = 1;
+    if (pixels.size() == MipPyramid::getTotalPixels(imageSize)) {
+        textureLevels = MipPyramid::getLevelCount(imageSize);
+        mipTextures.resize(textureLevels - 1, nullptr);
+        mipTextureSizes.resize(textureLevels - 1, 0);
+        
+        for (int level = 1; level < textureLevels; level++) {
+            int levelSize = MipPyramid::getLevelSize(imageSize, level);
+            if (!createTexture(renderer, mipTextures[level - 1], mipTextureSizes[level - 1], levelSize)) {
+                textureLevels = level;
+                break;
             }
+            int pitch = levelSize;
+            const Uint32* levelPixels = prepareUpload(pixels.data() + MipPyramid::getLevelOffset(imageSize, level),
+                                                      levelSize, levelSize, pitch);
+            SDL_UpdateTexture(mipTextures[level - 1], nullptr, levelPixels, pitch * sizeof(Uint32));
         }
     }
+    
+    int pitch = imageSize;
+    const Uint32* imagePixels = prepareUpload(pixels.data(), imageSize, imageSize, pitch);
+    return SDL_UpdateTexture(texture, nullptr, imagePixels, pitch * sizeof(Uint32)) == 0;
+}
+
+bool RecursiveRenderer::uploadRegion(const std::vector<Uint32>& pixels, int imageSize, const SDL_Rect& dirty) {
+    for (int level = 0; level < textureLevels; level++) {
+        SDL_Rect rect = MipPyramid::getLevelRect(imageSize, level, dirty);
+        if (rect.w <= 0 || rect.h <= 0) continue;
+        
+        int levelSize = MipPyramid::getLevelSize(imageSize, level);
+        const Uint32* source = pixels.data() + MipPyramid::getLevelOffset(imageSize, level) +
+                               static_cast<size_t>(rect.y) * levelSize + rect.x;
+        int pitch = levelSize;
+        source = prepareUpload(source, rect.w, rect.h, pitch);
+        SDL_Texture* target = (level == 0) ? texture : mipTextures[level - 1];
+        if (SDL_UpdateTexture(target, &rect, source, pitch * sizeof(Uint32)) != 0) {
+            textureKey = RenderKey();
+            return false;
+        }
+    }
+    return true;
+}
+
+const Uint32* RecursiveRenderer::prepareUpload(const Uint32* pixels, int width, int height, int& pitch) {
+    if (premultipliedBlending) return pixels;
+    
+    straightPixels.resize(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++) {
+        const Uint32* row = pixels + static_cast<size_t>(y) * pitch;
+        Uint32* out = straightPixels.data() + static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; x++) {
+            Uint32 alpha = row[x] >> 24;
+            if (alpha == 0 || alpha == 255) {
+                out[x] = row[x];
+                continue;
+            }
+            Uint32 straight = alpha << 24;
+            for (int shift = 0; shift < 24; shift += 8) {
+                Uint32 value = (row[x] >> shift) & 0xFF;
+                straight |= std::min<Uint32>(255, (value * 255 + alpha / 2) / alpha) << shift;
+            }
+            out[x] = straight;
+        }
+    }
+    pitch = width;
+    return straightPixels.data();
 }
 
 float RecursiveRenderer::getPulsatingScaleFactor() const {
@@ -73,10 +522,14 @@ float RecursiveRenderer::getPulsatingScaleFactor() const {
     Uint32 currentTime = SDL_GetTicks();
     float elapsedTime = (currentTime - startTime) / 1000.0f;  // Convert to seconds
     
-    // Create a sinusoidal wave that completes one cycle every 10 seconds
-    // sin(2π * t / 10) oscillates between -1 and 1
-    // We map this to a scale range between 0.5 and 1.5 for a nice pulsating effect
-    float sineWave = sin(2.0f * M_PI * elapsedTime / 10.0f);
+    return getPulseScale(elapsedTime);
+}
+
+float RecursiveRenderer::getPulseScale(float seconds) {
+    // Create a sinusoidal wave that completes one cycle every PULSE_PERIOD_SECONDS
+    // sin(2π * t / period) oscillates between -1 and 1
+    // We map this to a scale range between 1.0 and 2.0 for a nice pulsating effect
+    float sineWave = sin(2.0f * M_PI * seconds / PULSE_PERIOD_SECONDS);
     float scaleFactor = 1.5f + 0.5f * sineWave;  // Range: 1.0 to 2.0
     
     return scaleFactor;
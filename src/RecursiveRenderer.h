@@ -1,31 +1,167 @@
 #pragma once
 #include <SDL2/SDL.h>
 #include <cmath>
+#include <memory>
+#include <vector>
+#include "BlendTable.h"
 #include "PixelEditor.h"
 #include "Palette.h"
+#include "RecursiveExpander.h"
+#include "RenderCache.h"
+#include "SpriteFile.h"
 
+// Draws the recursive expansion of a grid. The expansion is rendered into a
+// pixel buffer once per (grid, palette, depth) and kept in a RenderCache, so
+// states seen before (undo/redo, toggling a pixel back) are only a texture
+// upload; unchanged frames just redraw the texture. New states a few pixels
+// away from the last expansion are patched in place rather than re-expanded,
+// and only the changed rectangle is uploaded.
+// Renders too large for one frame are built progressively: the deepest level
+// that fits a frame is shown at once, then each finer level is expanded in
+// row bands under a per-frame time budget, drawn over the coarser image as
+// its rows finish. When the expansion is finer than the screen, each screen
+// pixel instead shows the linear-light average of the sub-pixels it covers,
+// computed from per-level coverage tables at about display resolution, so
+// any depth costs the same. Averaged images carry a mip pyramid, and the
+// pulsating animation draws the pre-filtered level nearest its current size.
 class RecursiveRenderer {
 public:
-    RecursiveRenderer(int baseSize = 8, int outputSize = 64);
-    ~RecursiveRenderer() = default;
+    RecursiveRenderer(int baseSize = 8, int outputSize = 64, int depth = 2,
+                      size_t cacheBytes = DEFAULT_CACHE_BYTES);
+    ~RecursiveRenderer();
 
     // Render the recursive pattern
     void render(SDL_Renderer* renderer, const PixelEditor& editor, const Palette& palette, 
                 int offsetX, int offsetY);
     
+    // Render a sprite straight from a file or library mapping
+    void render(SDL_Renderer* renderer, const SpriteView& sprite, const Palette& palette,
+                int offsetX, int offsetY);
+    
     // Get output dimensions
     int getOutputSize() const { return outputSize; }
     int getBaseSize() const { return baseSize; }
+    
+    // Recursion depth of the preview; depth 2 is one level of copies
+    int getDepth() const { return depth; }
+    void setDepth(int newDepth);
+    
+    const RenderCache& getCache() const { return cache; }
+    
+    // How each copy colors the grid's pixels; Source paints it flat
+    BlendMode getBlendMode() const { return blendMode; }
+    void setBlendMode(BlendMode mode) { blendMode = mode; }
+    
+    // Per-color pattern grids the expansion substitutes (see RecursiveExpander);
+    // the editor's are taken from it on every render
+    const std::vector<std::vector<Uint8>>& getRules() const { return rules; }
+    void setRules(const std::vector<std::vector<Uint8>>& newRules);
+    
+    // Average sub-pixels smaller than a screen pixel (default) or show every one
+    bool isFiltered() const { return filtered; }
+    void setFiltered(bool enabled) { filtered = enabled; }
+    
+    // True while a deep render is still being refined
+    bool isRefining() const { return progressive != nullptr; }
+    
+    // Destroy the textures; call before the SDL renderer that owns them is destroyed
+    void releaseTexture();
+    
+    // Length of one cycle of the pulsing animation
+    static constexpr float PULSE_PERIOD_SECONDS = 10.0f;
+    
+    // Scale of the pulsing animation `seconds` into it, between 1.0 and 2.0
+    static float getPulseScale(float seconds);
 
 private:
+    static const size_t DEFAULT_CACHE_BYTES = 16 << 20;
+    static const int MAX_INCREMENTAL_EDITS = 16;  // More changed pixels than this re-expand everything
+    static const int MAX_FRAME_PIXELS = 512 * 512;  // Larger renders are built progressively
+    static constexpr int PROGRESSIVE_BUDGET_MS = 6;  // Refinement time per frame
+    static const int MAX_TEXTURE_SIZE = 4096;       // Deepest exact render that is drawn
+    
+    // Deep render being refined over several frames
+    struct ProgressiveRender {
+        RenderKey key;    // Final render being built
+        int targetDepth;  // Its depth
+        int level;        // Depth currently being expanded
+        int size;         // Side of that level's image
+        int nextRow;      // Rows of that level finished and uploaded
+        std::unique_ptr<RecursiveExpander> expander;
+        std::shared_ptr<std::vector<Uint32>> pixels;  // Finished rows, if the level can be cached
+        std::vector<Uint8> band;
+        std::vector<Uint32> bandColors;
+        Uint32 colors[256];
+    };
+    
     int baseSize;
     int outputSize;
     int scaleFactor;
+    int depth;
+    bool filtered;
+    BlendMode blendMode;
+    BlendTable blend;  // Table for blendMode and the palette last drawn
+    std::vector<std::vector<Uint8>> rules;
     Uint32 startTime;  // Time when renderer was created
+    std::vector<Uint8> baseIndices;  // Base grid being rendered, one index per pixel
+    
+    RenderCache cache;
+    SDL_Texture* texture;
+    int textureSize;
+    RenderKey textureKey;  // Render currently uploaded to the texture
+    int textureLevels;     // Mip levels of that render, level 0 in texture
+    std::vector<SDL_Texture*> mipTextures;
+    std::vector<int> mipTextureSizes;
+    bool premultipliedBlending;          // False if the renderer only blends straight alpha
+    std::vector<Uint32> straightPixels;  // Uploads converted for straight alpha
+    
+    // Level being refined, shown over the texture as its rows finish
+    std::unique_ptr<ProgressiveRender> progressive;
+    SDL_Texture* refineTexture;
+    int refineTextureSize;
+    
+    // Working expansion, patched as the grid is edited. Its pixels are never
+    // shared: the cache gets its own copy of fully rebuilt images only.
+    std::unique_ptr<RecursiveExpander> expander;
+    std::vector<Uint8> expandedIndices;
+    std::vector<Uint32> workingPixels;  // Colors of expandedIndices, or their average with its mip chain
+    bool workingResolved;               // workingPixels holds the average
+    RenderKey workingKey;               // Render workingPixels holds, empty if out of date
+    Uint32 workingColors[256];
     
     // Calculate current pulsating scale factor based on time
     float getPulsatingScaleFactor() const;
     
-    void renderPixelRecursive(SDL_Renderer* renderer, const PixelEditor& editor, 
-                             const Palette& palette, int x, int y, int size, SDL_Color sourceColor);
+    void renderBase(SDL_Renderer* renderer, const Palette& palette, int offsetX, int offsetY);
+    
+    // Bring workingPixels to baseIndices expanded to levelDepth as ARGB pixels;
+    // background is transparent. True if every pixel was rewritten, otherwise
+    // dirty bounds the changed ones.
+    bool expandImage(const Palette& palette, int levelDepth, int imageSize, SDL_Rect& dirty);
+    
+    // Bring workingPixels to the full-depth output averaged down to level's
+    // resolution divided by factor, like expandImage
+    bool resolveImage(const Palette& palette, int level, int factor, SDL_Rect& dirty);
+    
+    // Bring the working expansion to baseIndices at levelDepth; false if it was
+    // rebuilt, otherwise dirty bounds the patched pixels
+    bool updateExpansion(int levelDepth, SDL_Rect& dirty);
+    
+    void startProgressive(SDL_Renderer* renderer, const Palette& palette, RenderKey key, int targetDepth);
+    
+    // Refine until the frame budget runs out; the texture advances level by level
+    void continueProgressive(SDL_Renderer* renderer, const Palette& palette);
+    
+    int getLevelSize(int levelDepth) const;
+    static void buildColorTable(const Palette& palette, Uint32 colors[256]);
+    
+    bool createTexture(SDL_Renderer* renderer, SDL_Texture*& target, int& targetSize, int imageSize);
+    bool uploadTexture(SDL_Renderer* renderer, const std::vector<Uint32>& pixels, int imageSize);
+    
+    // Upload only dirty of an image already in the texture, and what it covers in each mip level
+    bool uploadRegion(const std::vector<Uint32>& pixels, int imageSize, const SDL_Rect& dirty);
+    
+    // width x height pixels (pitch apart) as the textures take them: premultiplied,
+    // or un-premultiplied into straightPixels for the straight-alpha fallback
+    const Uint32* prepareUpload(const Uint32* pixels, int width, int height, int& pitch);
 };
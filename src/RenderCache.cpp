@@ -0,0 +1,126 @@
+#include "RenderCache.h"
+
+RenderCache::RenderCache(size_t maxBytes)
+    : maxBytes(maxBytes), bytesUsed(0), hits(0), misses(0) {}
+
+RenderKey RenderCache::makeKey(const Uint8* indices, int gridSize, const Palette& palette,
+                               int depth, int outputSize, BlendMode blendMode,
+                               const std::vector<std::vector<Uint8>>& rules) {
+    RenderKey key;
+    size_t cells = static_cast<size_t>(gridSize) * gridSize;
+    const auto& colors = palette.getColors();
+    key.identity.reserve(cells + 9 + colors.size() * 4);
+
+    key.identity.assign(indices, indices + cells);
+    key.identity.push_back(static_cast<Uint8>(gridSize));
+    key.identity.push_back(static_cast<Uint8>(depth));
+    key.identity.push_back(static_cast<Uint8>(blendMode));
+    for (int shift = 0; shift < 32; shift += 8) {
+        key.identity.push_back(static_cast<Uint8>(outputSize >> shift));
+    }
+    for (const SDL_Color& color : colors) {
+        key.identity.push_back(color.r);
+        key.identity.push_back(color.g);
+        key.identity.push_back(color.b);
+        key.identity.push_back(color.a);
+    }
+
+    // Rules are grid-sized, so each one is its color followed by a fixed number of cells
+    for (size_t index = 0; index < rules.size(); index++) {
+        if (rules[index].size() != cells) continue;
+        key.identity.push_back(static_cast<Uint8>(index));
+        key.identity.insert(key.identity.end(), rules[index].begin(), rules[index].end());
+    }
+
+    // FNV-1a
+    Uint64 hash = 0xCBF29CE484222325ULL;
+    for (Uint8 byte : key.identity) {
+        hash = (hash ^ byte) * 0x100000001B3ULL;
+    }
+    key.hash = hash;
+    return key;
+}
+
+RenderCache::Buffer RenderCache::find(const RenderKey& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = findEntry(key);
+    if (entry == entries.end()) {
+        misses++;
+        return nullptr;
+    }
+
+    hits++;
+    entries.splice(entries.begin(), entries, entry);
+    return entry->buffer;
+}
+
+void RenderCache::insert(const RenderKey& key, Buffer buffer) {
+    if (!buffer) return;
+
+    size_t bytes = buffer->size() * sizeof(Uint32) + key.identity.size();
+    if (bytes > maxBytes) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto existing = findEntry(key);
+    if (existing != entries.end()) {
+        erase(existing);
+    }
+
+    while (bytesUsed + bytes > maxBytes && !entries.empty()) {
+        erase(std::prev(entries.end()));
+    }
+
+    entries.push_front(Entry{key, std::move(buffer), bytes});
+    lookup.emplace(key.hash, entries.begin());
+    bytesUsed += bytes;
+}
+
+void RenderCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    lookup.clear();
+    bytesUsed = 0;
+}
+
+Uint64 RenderCache::getHits() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+Uint64 RenderCache::getMisses() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+size_t RenderCache::getBytesUsed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytesUsed;
+}
+
+size_t RenderCache::getEntryCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+std::list<RenderCache::Entry>::iterator RenderCache::findEntry(const RenderKey& key) {
+    auto range = lookup.equal_range(key.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->key.identity == key.identity) {
+            return it->second;
+        }
+    }
+    return entries.end();
+}
+
+void RenderCache::erase(std::list<Entry>::iterator entry) {
+    auto range = lookup.equal_range(entry->key.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == entry) {
+            lookup.erase(it);
+            break;
+        }
+    }
+
+    bytesUsed -= entry->bytes;
+    entries.erase(entry);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "BlendTable.h"
+#include "Palette.h"
+
+// Everything a finished render depends on: the grid's pixel indices, the
+// palette, the recursion depth, the output size, the blend mode and the
+// substitution rules. The hash picks the bucket, the identity bytes are
+// compared so collisions cannot mix renders.
+struct RenderKey {
+    Uint64 hash = 0;
+    std::vector<Uint8> identity;
+
+    bool operator==(const RenderKey& other) const {
+        return hash == other.hash && identity == other.identity;
+    }
+    bool operator!=(const RenderKey& other) const { return !(*this == other); }
+};
+
+// Finished renders (ARGB8888 pixels) under a byte budget with least recently
+// used eviction. Buffers are shared and immutable, so a caller can keep using
+// one after it has been evicted. Safe to use from several threads.
+class RenderCache {
+public:
+    using Buffer = std::shared_ptr<const std::vector<Uint32>>;
+
+    explicit RenderCache(size_t maxBytes);
+    ~RenderCache() = default;
+
+    static RenderKey makeKey(const Uint8* indices, int gridSize, const Palette& palette,
+                             int depth, int outputSize, BlendMode blendMode = BlendMode::Source,
+                             const std::vector<std::vector<Uint8>>& rules = {});
+
+    // The cached render for key, or null; a hit makes it the most recently used
+    Buffer find(const RenderKey& key);
+
+    // Store a render, evicting the least recently used ones to stay in budget.
+    // Renders larger than the whole budget are not kept.
+    void insert(const RenderKey& key, Buffer buffer);
+
+    void clear();
+
+    Uint64 getHits() const;
+    Uint64 getMisses() const;
+    size_t getBytesUsed() const;
+    size_t getEntryCount() const;
+    size_t getMaxBytes() const { return maxBytes; }
+
+private:
+    struct Entry {
+        RenderKey key;
+        Buffer buffer;
+        size_t bytes;
+    };
+
+    size_t maxBytes;
+    size_t bytesUsed;
+    Uint64 hits;
+    Uint64 misses;
+
+    std::list<Entry> entries;  // Most recently used first
+    std::unordered_multimap<Uint64, std::list<Entry>::iterator> lookup;
+    mutable std::mutex mutex;
+
+    std::list<Entry>::iterator findEntry(const RenderKey& key);
+    void erase(std::list<Entry>::iterator entry);
+};
@@ -0,0 +1,346 @@
+#include "SessionJournal.h"
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SessionJournal::SessionJournal(int gridSize, int checkpointInterval)
+    : gridSize(gridSize), checkpointInterval(checkpointInterval), recordsSinceCheckpoint(0),
+      fileDescriptor(-1), mapping(nullptr), capacity(0), writeOffset(0), flushedOffset(0),
+      headerDirty(false), stopping(false) {
+    grid.resize(gridSize * gridSize, 0);
+}
+
+SessionJournal::~SessionJournal() {
+    close();
+}
+
+bool SessionJournal::recover(const std::string& path, PixelEditor& editor, Palette& palette) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+    
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return false;
+    
+    const Uint8* data = static_cast<const Uint8*>(mapped);
+    const Header* header = reinterpret_cast<const Header*>(data);
+    int editorGridSize = editor.getGridSize();
+    size_t gridBytes = static_cast<size_t>(editorGridSize) * editorGridSize;
+    
+    if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION ||
+        header->gridSize != static_cast<Uint32>(editorGridSize)) {
+        munmap(mapped, size);
+        return false;
+    }
+    
+    // Bytes taken by the checkpoint or palette record at offset with its
+    // payload, 0 unless the whole record made it to disk
+    auto payloadSize = [&](size_t offset) -> size_t {
+        const Record* record = reinterpret_cast<const Record*>(data + offset);
+        if (record->type != RECORD_CHECKPOINT && record->type != RECORD_PALETTE) return 0;
+        if (record->position < 1 || record->position > Palette::MAX_COLORS) return 0;
+        
+        size_t bytes = record->position * sizeof(SDL_Color) + (record->type == RECORD_CHECKPOINT ? gridBytes : 0);
+        size_t total = sizeof(Record) * (1 + payloadRecords(bytes));
+        if (offset + total > size || record->payload != checksum(data + offset + sizeof(Record), bytes)) return 0;
+        return total;
+    };
+    auto isCheckpoint = [&](size_t offset) {
+        return offset >= sizeof(Header) && offset + sizeof(Record) <= size &&
+               reinterpret_cast<const Record*>(data + offset)->type == RECORD_CHECKPOINT && payloadSize(offset) > 0;
+    };
+    
+    // The header normally points at the latest checkpoint; if the disk lost that
+    // write, walk the records and take the last complete checkpoint instead
+    size_t start = static_cast<size_t>(header->checkpointOffset);
+    if (!isCheckpoint(start)) {
+        start = 0;
+        size_t offset = sizeof(Header);
+        while (offset + sizeof(Record) <= size) {
+            const Record* record = reinterpret_cast<const Record*>(data + offset);
+            if (record->type == RECORD_PIXEL) {
+                offset += sizeof(Record);
+                continue;
+            }
+            size_t length = payloadSize(offset);
+            if (length == 0) break;
+            if (record->type == RECORD_CHECKPOINT) {
+                start = offset;
+            }
+            offset += length;
+        }
+    }
+    
+    if (start == 0) {
+        munmap(mapped, size);
+        return false;
+    }
+    
+    // Replay the checkpoint and everything appended after it
+    std::vector<SDL_Color> colors;
+    size_t offset = start;
+    while (offset + sizeof(Record) <= size) {
+        const Record* record = reinterpret_cast<const Record*>(data + offset);
+        if (record->type == RECORD_PIXEL) {
+            if (record->position < gridBytes) {
+                editor.setPixel(record->position % editorGridSize, record->position / editorGridSize, record->color);
+            }
+            offset += sizeof(Record);
+            continue;
+        }
+        
+        size_t length = payloadSize(offset);
+        if (length == 0) break;  // End of the journal, or a record torn by a crash
+        
+        const Uint8* payload = data + offset + sizeof(Record);
+        if (record->type == RECORD_CHECKPOINT) {
+            for (size_t i = 0; i < gridBytes; i++) {
+                editor.setPixel(static_cast<int>(i % editorGridSize), static_cast<int>(i / editorGridSize), payload[i]);
+            }
+            payload += gridBytes;
+        }
+        const SDL_Color* payloadColors = reinterpret_cast<const SDL_Color*>(payload);
+        colors.assign(payloadColors, payloadColors + record->position);
+        offset += length;
+    }
+    palette.setColors(colors);
+    
+    munmap(mapped, size);
+    return true;
+}
+
+bool SessionJournal::open(const std::string& path, const PixelEditor& editor, const Palette& palette) {
+    close();
+    
+    // Build the new journal next to the old one and swap it in once it is durable
+    std::string tempPath = path + ".tmp";
+    fileDescriptor = ::open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fileDescriptor < 0) {
+        std::cerr << "Could not create journal " << tempPath << std::endl;
+        return false;
+    }
+    
+    capacity = GROWTH_BYTES;
+    size_t largestCheckpoint = grid.size() + Palette::MAX_COLORS * sizeof(SDL_Color);
+    while (capacity < sizeof(Header) + sizeof(Record) * (2 + payloadRecords(largestCheckpoint))) {
+        capacity += GROWTH_BYTES;
+    }
+    
+    void* mapped = MAP_FAILED;
+    if (ftruncate(fileDescriptor, static_cast<off_t>(capacity)) == 0) {
+        mapped = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    }
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Could not map journal " << tempPath << std::endl;
+        ::close(fileDescriptor);
+        fileDescriptor = -1;
+        unlink(tempPath.c_str());
+        return false;
+    }
+    mapping = static_cast<Uint8*>(mapped);
+    
+    Header* header = reinterpret_cast<Header*>(mapping);
+    header->magic = JOURNAL_MAGIC;
+    header->version = JOURNAL_VERSION;
+    header->gridSize = static_cast<Uint32>(gridSize);
+    header->checkpointOffset = 0;
+    
+    for (int y = 0; y < gridSize; y++) {
+        for (int x = 0; x < gridSize; x++) {
+            grid[y * gridSize + x] = static_cast<Uint8>(editor.getPixel(x, y));
+        }
+    }
+    colors = palette.getColors();
+    
+    writeOffset = sizeof(Header);
+    writeCheckpoint();
+    
+    flushedOffset = writeOffset;
+    headerDirty = false;
+    if (msync(mapping, flushedOffset, MS_SYNC) != 0 || rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "Could not write journal " << path << std::endl;
+        munmap(mapping, capacity);
+        mapping = nullptr;
+        ::close(fileDescriptor);
+        fileDescriptor = -1;
+        unlink(tempPath.c_str());
+        return false;
+    }
+    
+    stopping = false;
+    flushThread = std::thread(&SessionJournal::flushLoop, this);
+    return true;
+}
+
+void SessionJournal::close() {
+    if (flushThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mappingMutex);
+            stopping = true;
+        }
+        flushCondition.notify_one();
+        flushThread.join();
+    }
+    
+    releaseRetiredMappings();
+    if (mapping) {
+        munmap(mapping, capacity);
+        mapping = nullptr;
+    }
+    if (fileDescriptor >= 0) {
+        ::close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+}
+
+void SessionJournal::recordPixel(int x, int y, int colorIndex) {
+    if (!mapping || x < 0 || x >= gridSize || y < 0 || y >= gridSize) return;
+    
+    grid[y * gridSize + x] = static_cast<Uint8>(colorIndex);
+    if (!reserve(sizeof(Record))) return;
+    
+    size_t offset = writeOffset.load(std::memory_order_relaxed);
+    Record* record = reinterpret_cast<Record*>(mapping + offset);
+    record->color = static_cast<Uint8>(colorIndex);
+    record->position = static_cast<Uint16>(y * gridSize + x);
+    record->payload = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    record->type = RECORD_PIXEL;
+    writeOffset.store(offset + sizeof(Record), std::memory_order_release);
+    
+    if (++recordsSinceCheckpoint >= checkpointInterval) {
+        writeCheckpoint();
+    }
+}
+
+void SessionJournal::recordPalette(const Palette& palette) {
+    if (!mapping) return;
+    
+    colors = palette.getColors();
+    if (!writePayload(RECORD_PALETTE)) return;
+    
+    if (++recordsSinceCheckpoint >= checkpointInterval) {
+        writeCheckpoint();
+    }
+}
+
+bool SessionJournal::reserve(size_t bytes) {
+    // Keep one zeroed record after the data so readers always find the end
+    size_t needed = writeOffset.load(std::memory_order_relaxed) + bytes + sizeof(Record);
+    if (needed <= capacity) return true;
+    
+    std::lock_guard<std::mutex> lock(mappingMutex);
+    
+    size_t newCapacity = capacity;
+    while (newCapacity < needed) {
+        newCapacity += GROWTH_BYTES;
+    }
+    
+    void* mapped = MAP_FAILED;
+    if (ftruncate(fileDescriptor, static_cast<off_t>(newCapacity)) == 0) {
+        mapped = mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    }
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Could not grow journal, changes are no longer saved" << std::endl;
+        return false;
+    }
+    
+    // The flusher may be syncing the old mapping outside the lock
+    retiredMappings.push_back(RetiredMapping{mapping, capacity});
+    mapping = static_cast<Uint8*>(mapped);
+    capacity = newCapacity;
+    return true;
+}
+
+void SessionJournal::writeCheckpoint() {
+    size_t offset = writeOffset.load(std::memory_order_relaxed);
+    if (!writePayload(RECORD_CHECKPOINT)) return;
+    
+    reinterpret_cast<Header*>(mapping)->checkpointOffset = offset;
+    headerDirty = true;
+    recordsSinceCheckpoint = 0;
+}
+
+bool SessionJournal::writePayload(RecordType type) {
+    size_t gridBytes = (type == RECORD_CHECKPOINT) ? grid.size() : 0;
+    size_t colorBytes = colors.size() * sizeof(SDL_Color);
+    size_t bytes = sizeof(Record) * (1 + payloadRecords(gridBytes + colorBytes));
+    if (!reserve(bytes)) return false;
+    
+    size_t offset = writeOffset.load(std::memory_order_relaxed);
+    Record* record = reinterpret_cast<Record*>(mapping + offset);
+    Uint8* payload = mapping + offset + sizeof(Record);
+    std::memcpy(payload, grid.data(), gridBytes);
+    std::memcpy(payload + gridBytes, colors.data(), colorBytes);
+    record->color = 0;
+    record->position = static_cast<Uint16>(colors.size());
+    record->payload = checksum(payload, gridBytes + colorBytes);
+    std::atomic_thread_fence(std::memory_order_release);
+    record->type = type;
+    writeOffset.store(offset + bytes, std::memory_order_release);
+    return true;
+}
+
+void SessionJournal::flushLoop() {
+    std::unique_lock<std::mutex> lock(mappingMutex);
+    while (!stopping) {
+        flushCondition.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+        flushDirtyRange(lock);
+    }
+    flushDirtyRange(lock);
+}
+
+void SessionJournal::flushDirtyRange(std::unique_lock<std::mutex>& lock) {
+    // Take the range under the lock, then sync without it, so an edit that
+    // grows the journal never waits for the disk. A checkpoint is complete
+    // before it marks the header, so taking the flag first keeps it in range.
+    bool flushHeader = headerDirty.exchange(false);
+    Uint8* flushMapping = mapping;
+    size_t end = writeOffset.load(std::memory_order_acquire);
+    lock.unlock();
+    
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (end > flushedOffset) {
+        size_t begin = flushedOffset & ~(pageSize - 1);
+        msync(flushMapping + begin, end - begin, MS_SYNC);
+        flushedOffset = end;
+    }
+    
+    // The checkpoint offset only counts once the checkpoint itself is on disk
+    if (flushHeader) {
+        msync(flushMapping, sizeof(Header), MS_SYNC);
+    }
+    
+    lock.lock();
+    releaseRetiredMappings();
+}
+
+void SessionJournal::releaseRetiredMappings() {
+    for (const RetiredMapping& retired : retiredMappings) {
+        munmap(retired.address, retired.size);
+    }
+    retiredMappings.clear();
+}
+
+size_t SessionJournal::payloadRecords(size_t bytes) {
+    return (bytes + sizeof(Record) - 1) / sizeof(Record);
+}
+
+Uint32 SessionJournal::checksum(const Uint8* data, size_t length) {
+    // FNV-1a
+    Uint32 hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Palette.h"
+#include "PixelEditor.h"
+
+// Crash-safe autosave: every pixel change is appended as a fixed 8-byte record
+// to a memory-mapped, append-only file, and every palette replacement as a
+// record followed by the colors. A checkpoint holding the whole grid and the
+// palette is written every checkpointInterval records and its offset kept in
+// the file header, so recovery only replays the records after the latest
+// checkpoint.
+// Appending is a plain memory store; a background thread msyncs the dirty
+// range in batches, so nothing on the editing path waits for the disk.
+class SessionJournal {
+public:
+    SessionJournal(int gridSize, int checkpointInterval = 4096);
+    ~SessionJournal();
+
+    // Rebuild the editor and palette from the journal at path; false if there is no usable journal
+    static bool recover(const std::string& path, PixelEditor& editor, Palette& palette);
+
+    // Start a fresh journal at path whose first record is a checkpoint of editor
+    // and palette. The previous journal is only replaced once the new one is on disk.
+    bool open(const std::string& path, const PixelEditor& editor, const Palette& palette);
+
+    // Flush everything, stop the flush thread and unmap the file
+    void close();
+
+    bool isOpen() const { return mapping != nullptr; }
+
+    // Append one pixel change; only touches the disk when the file has to grow
+    void recordPixel(int x, int y, int colorIndex);
+
+    // Append a palette replacement
+    void recordPalette(const Palette& palette);
+
+private:
+    static const Uint32 JOURNAL_MAGIC = 0x4A585052;  // "RPXJ"
+    static const Uint32 JOURNAL_VERSION = 2;
+    static const size_t GROWTH_BYTES = 1 << 20;
+    static constexpr int FLUSH_INTERVAL_MS = 1000;
+
+    // Records with a payload keep the color count in position and a checksum
+    // of the payload bytes in payload
+    enum RecordType : Uint8 {
+        RECORD_END = 0,         // Zero-filled space after the last record
+        RECORD_PIXEL = 1,
+        RECORD_CHECKPOINT = 2,  // Followed by the grid, one byte per pixel, then the colors, padded to records
+        RECORD_PALETTE = 3      // Followed by the colors, padded to records
+    };
+
+    struct Header {
+        Uint32 magic;
+        Uint32 version;
+        Uint32 gridSize;
+        Uint32 reserved;
+        Uint64 checkpointOffset;  // Latest complete checkpoint, 0 if none
+        Uint8 padding[40];
+    };
+
+    // The type is stored last, so a record with a type is always complete
+    struct Record {
+        Uint8 type;
+        Uint8 color;
+        Uint16 position;
+        Uint32 payload;
+    };
+
+    int gridSize;
+    int checkpointInterval;
+    int recordsSinceCheckpoint;
+    std::vector<Uint8> grid;  // Mirror of the journaled state, source of checkpoints
+    std::vector<SDL_Color> colors;
+
+    int fileDescriptor;
+    Uint8* mapping;
+    size_t capacity;
+    std::atomic<size_t> writeOffset;
+    size_t flushedOffset;
+    std::atomic<bool> headerDirty;
+
+    std::thread flushThread;
+    std::mutex mappingMutex;  // Held while the mapping is replaced or the flusher takes its range
+    
+    // Mappings replaced by a larger one, unmapped once no sync can still be using them
+    struct RetiredMapping {
+        Uint8* address;
+        size_t size;
+    };
+    std::vector<RetiredMapping> retiredMappings;
+    std::condition_variable flushCondition;
+    bool stopping;
+
+    bool reserve(size_t bytes);
+    void writeCheckpoint();
+    bool writePayload(RecordType type);
+    void flushLoop();
+    void flushDirtyRange(std::unique_lock<std::mutex>& lock);
+    void releaseRetiredMappings();
+
+    // Records taken by a payload of this many bytes
+    static size_t payloadRecords(size_t bytes);
+    static Uint32 checksum(const Uint8* data, size_t length);
+};
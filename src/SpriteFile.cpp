@@ -0,0 +1,169 @@
+#include "SpriteFile.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <dirent.h>
+
+namespace {
+
+template <int BITS>
+void packGrid(const PixelEditor& editor, Uint8* out) {
+    SpriteView grid = editor.getView();
+    size_t count = static_cast<size_t>(grid.gridSize) * grid.gridSize;
+    
+    // The editor already stores its grid packed, usually at the width wanted
+    if (grid.bitsPerIndex == BITS) {
+        std::memcpy(out, grid.data, PackedIndices<BITS>::getSize(count));
+        return;
+    }
+    
+    for (int y = 0; y < grid.gridSize; y++) {
+        for (int x = 0; x < grid.gridSize; x++) {
+            PackedIndices<BITS>::set(out, static_cast<size_t>(y) * grid.gridSize + x, grid.getIndex(x, y));
+        }
+    }
+}
+
+// True if every index of the grid refers to one of colorCount colors
+template <int BITS>
+bool indicesBelow(const Uint8* data, size_t count, int colorCount) {
+    if (colorCount >= PackedIndices<BITS>::MAX_COLORS) return true;
+    for (size_t i = 0; i < count; i++) {
+        if (PackedIndices<BITS>::get(data, i) >= colorCount) return false;
+    }
+    return true;
+}
+
+}
+
+bool SpriteFile::listDirectory(const std::string& directory, std::vector<std::string>& paths) {
+    DIR* entries = opendir(directory.c_str());
+    if (!entries) {
+        std::cerr << "Could not read directory " << directory << std::endl;
+        return false;
+    }
+    
+    while (dirent* entry = readdir(entries)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".rps") == 0) {
+            paths.push_back(directory + "/" + name);
+        }
+    }
+    closedir(entries);
+    
+    std::sort(paths.begin(), paths.end());
+    return true;
+}
+
+int SpriteFile::getBitsPerIndex(int colorCount) {
+    return (colorCount <= PackedIndices<4>::MAX_COLORS) ? 4 : 8;
+}
+
+size_t SpriteFile::packedSize(int gridSize, int bitsPerIndex) {
+    size_t count = static_cast<size_t>(gridSize) * gridSize;
+    return (bitsPerIndex == 8) ? PackedIndices<8>::getSize(count) : PackedIndices<4>::getSize(count);
+}
+
+void SpriteFile::pack(const PixelEditor& editor, int bitsPerIndex, Uint8* out) {
+    if (bitsPerIndex == 8) {
+        packGrid<8>(editor, out);
+    } else {
+        packGrid<4>(editor, out);
+    }
+}
+
+bool SpriteFile::save(const std::string& path, const PixelEditor& editor, const Palette& palette) {
+    Header header;
+    header.magic = SPRITE_MAGIC;
+    header.version = SPRITE_VERSION;
+    header.gridSize = static_cast<Uint16>(editor.getGridSize());
+    
+    // Every index on the grid needs a color to be read back, even one past the palette
+    int colorCount = std::max(palette.getColorCount(), editor.getMaxIndex() + 1);
+    std::vector<SDL_Color> colors(colorCount);
+    for (int index = 0; index < colorCount; index++) {
+        colors[index] = palette.getColor(index);
+    }
+    header.bitsPerIndex = getBitsPerIndex(colorCount);
+    header.colorCount = static_cast<Uint16>(colorCount);
+    
+    std::vector<Uint8> pixels(packedSize(header.gridSize, header.bitsPerIndex));
+    pack(editor, header.bitsPerIndex, pixels.data());
+    
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Could not write sprite " << path << std::endl;
+        return false;
+    }
+    
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(colors.data(), sizeof(SDL_Color), colors.size(), file) == colors.size() &&
+              fwrite(pixels.data(), 1, pixels.size(), file) == pixels.size();
+    ok = (fclose(file) == 0) && ok;
+    
+    if (!ok) {
+        std::cerr << "Could not write sprite " << path << std::endl;
+    }
+    return ok;
+}
+
+bool SpriteFile::load(const std::string& path, PixelEditor& editor, Palette& palette) {
+    std::vector<Uint8> pixels;
+    SpriteView sprite;
+    Palette loadedPalette;
+    if (!read(path, pixels, sprite, loadedPalette)) return false;
+    
+    if (sprite.gridSize != editor.getGridSize()) {
+        std::cerr << "Sprite " << path << " is " << sprite.gridSize << "x" << sprite.gridSize
+                  << ", the editor is " << editor.getGridSize() << "x" << editor.getGridSize() << std::endl;
+        return false;
+    }
+    
+    for (int y = 0; y < sprite.gridSize; y++) {
+        for (int x = 0; x < sprite.gridSize; x++) {
+            editor.setPixel(x, y, sprite.getIndex(x, y));
+        }
+    }
+    
+    palette.setColors(loadedPalette.getColors());
+    return true;
+}
+
+bool SpriteFile::read(const std::string& path, std::vector<Uint8>& data, SpriteView& sprite, Palette& palette) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    
+    Header header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == SPRITE_MAGIC && header.version == SPRITE_VERSION &&
+              header.gridSize > 0 && header.gridSize <= MAX_GRID_SIZE &&
+              (header.bitsPerIndex == 4 || header.bitsPerIndex == 8) &&
+              header.colorCount > 0 && header.colorCount <= Palette::MAX_COLORS;
+    
+    std::vector<SDL_Color> colors;
+    if (ok) {
+        colors.resize(header.colorCount);
+        data.resize(packedSize(header.gridSize, header.bitsPerIndex));
+        ok = fread(colors.data(), sizeof(SDL_Color), colors.size(), file) == colors.size() &&
+             fread(data.data(), 1, data.size(), file) == data.size();
+    }
+    if (ok) {
+        size_t count = static_cast<size_t>(header.gridSize) * header.gridSize;
+        ok = (header.bitsPerIndex == 8) ? indicesBelow<8>(data.data(), count, header.colorCount)
+                                        : indicesBelow<4>(data.data(), count, header.colorCount);
+    }
+    fclose(file);
+    
+    if (!ok) {
+        std::cerr << "Not a valid sprite file: " << path << std::endl;
+        return false;
+    }
+    
+    sprite.gridSize = header.gridSize;
+    sprite.bitsPerIndex = header.bitsPerIndex;
+    sprite.data = data.data();
+    palette = Palette(colors);
+    return true;
+}
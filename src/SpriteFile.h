@@ -0,0 +1,50 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "PixelEditor.h"
+#include "PackedIndices.h"
+#include "Palette.h"
+
+// Compact binary sprite format (.rps): a small header, the palette as RGBA
+// and the grid as packed indices, 4 bits wide for up to 16 colors and 8 bits
+// for up to 256. An 8x8 sprite takes 108 bytes.
+// Multi-byte fields are little-endian, as on every platform we build for.
+class SpriteFile {
+public:
+    // Save the editor grid and the palette
+    static bool save(const std::string& path, const PixelEditor& editor, const Palette& palette);
+
+    // Load into the editor (grid sizes must match) and replace the palette
+    static bool load(const std::string& path, PixelEditor& editor, Palette& palette);
+    
+    // Read a sprite of any size up to MAX_GRID_SIZE whose indices all fit
+    // its palette; sprite points into data afterwards
+    static bool read(const std::string& path, std::vector<Uint8>& data, SpriteView& sprite, Palette& palette);
+
+    // Paths of the sprites (.rps) in a directory, sorted by name
+    static bool listDirectory(const std::string& directory, std::vector<std::string>& paths);
+
+    // Narrowest index width for a palette: 4 bits up to 16 colors, else 8
+    static int getBitsPerIndex(int colorCount);
+
+    // Bytes taken by a packed grid
+    static size_t packedSize(int gridSize, int bitsPerIndex);
+
+    // Pack the editor grid into packedSize() bytes at out
+    static void pack(const PixelEditor& editor, int bitsPerIndex, Uint8* out);
+
+    static const Uint32 SPRITE_MAGIC = 0x50535052;  // "RPSP"
+    static const Uint16 SPRITE_VERSION = 1;
+    static const int MAX_GRID_SIZE = 256;  // Edit histories address pixels with 16 bits
+
+private:
+    struct Header {
+        Uint32 magic;
+        Uint16 version;
+        Uint16 gridSize;
+        Uint16 bitsPerIndex;
+        Uint16 colorCount;
+    };
+};
@@ -0,0 +1,216 @@
+#include "SpriteLibrary.h"
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SpriteLibrary::SpriteLibrary()
+    : mapping(nullptr), mappingSize(0), records(nullptr), spriteCount(0) {}
+
+SpriteLibrary::~SpriteLibrary() {
+    close();
+}
+
+bool SpriteLibrary::open(const std::string& path) {
+    close();
+    
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Could not open sprite library " << path << std::endl;
+        return false;
+    }
+    
+    struct stat info;
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(Header)) {
+        mappingSize = static_cast<size_t>(info.st_size);
+        mapped = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Could not map sprite library " << path << std::endl;
+        return false;
+    }
+    mapping = static_cast<const Uint8*>(mapped);
+    
+    const Header* header = reinterpret_cast<const Header*>(mapping);
+    bool valid = header->magic == LIBRARY_MAGIC && header->version == LIBRARY_VERSION &&
+                 header->indexOffset <= mappingSize &&
+                 header->spriteCount <= (mappingSize - header->indexOffset) / sizeof(Record) &&
+                 header->paletteOffset <= header->indexOffset;
+    
+    // Palettes are few and small, they are the only part that gets parsed
+    size_t offset = static_cast<size_t>(header->paletteOffset);
+    for (Uint32 i = 0; valid && i < header->paletteCount; i++) {
+        Uint32 colorCount = 0;
+        valid = offset + sizeof(colorCount) <= header->indexOffset;
+        if (!valid) break;
+        
+        std::memcpy(&colorCount, mapping + offset, sizeof(colorCount));
+        offset += sizeof(colorCount);
+        valid = colorCount > 0 && colorCount <= 256 && offset + colorCount * sizeof(SDL_Color) <= header->indexOffset;
+        if (!valid) break;
+        
+        const SDL_Color* colors = reinterpret_cast<const SDL_Color*>(mapping + offset);
+        palettes.emplace_back(std::vector<SDL_Color>(colors, colors + colorCount));
+        offset += colorCount * sizeof(SDL_Color);
+    }
+    
+    if (!valid) {
+        std::cerr << "Not a valid sprite library: " << path << std::endl;
+        close();
+        return false;
+    }
+    
+    records = reinterpret_cast<const Record*>(mapping + header->indexOffset);
+    spriteCount = header->spriteCount;
+    
+    // Sprites are usually visited in order
+    madvise(const_cast<Uint8*>(mapping), mappingSize, MADV_SEQUENTIAL);
+    return true;
+}
+
+void SpriteLibrary::close() {
+    if (mapping) {
+        munmap(const_cast<Uint8*>(mapping), mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    records = nullptr;
+    spriteCount = 0;
+    palettes.clear();
+}
+
+bool SpriteLibrary::getSprite(Uint64 index, SpriteView& sprite) const {
+    if (index >= spriteCount) return false;
+    
+    // Same limits as a sprite file; anything else is a corrupt record
+    const Record& record = records[index];
+    if (record.gridSize == 0 || record.gridSize > SpriteFile::MAX_GRID_SIZE ||
+        (record.bitsPerIndex != 4 && record.bitsPerIndex != 8)) {
+        return false;
+    }
+    size_t size = SpriteFile::packedSize(record.gridSize, record.bitsPerIndex);
+    if (record.dataOffset > mappingSize || size > mappingSize - record.dataOffset) {
+        return false;
+    }
+    
+    sprite.gridSize = record.gridSize;
+    sprite.bitsPerIndex = record.bitsPerIndex;
+    sprite.data = mapping + record.dataOffset;
+    return true;
+}
+
+const Palette& SpriteLibrary::getSpritePalette(Uint64 index) const {
+    static const Palette defaultPalette;
+    if (index >= spriteCount || records[index].paletteIndex >= palettes.size()) {
+        return defaultPalette;
+    }
+    return palettes[records[index].paletteIndex];
+}
+
+SpriteLibraryWriter::SpriteLibraryWriter() : file(nullptr), dataOffset(0) {}
+
+SpriteLibraryWriter::~SpriteLibraryWriter() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool SpriteLibraryWriter::open(const std::string& path) {
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Could not create sprite library " << path << std::endl;
+        return false;
+    }
+    
+    // The real header is written by finish()
+    SpriteLibrary::Header header = {};
+    dataOffset = sizeof(header);
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+int SpriteLibraryWriter::addPalette(const Palette& palette) {
+    if (palettes.size() > MAX_PALETTES) return -1;
+    palettes.push_back(palette);
+    return static_cast<int>(palettes.size()) - 1;
+}
+
+bool SpriteLibraryWriter::addSprite(const PixelEditor& editor, int paletteIndex) {
+    if (paletteIndex < 0 || paletteIndex >= static_cast<int>(palettes.size())) return false;
+    if (editor.getMaxIndex() >= palettes[paletteIndex].getColorCount()) {
+        std::cerr << "Sprite uses color " << editor.getMaxIndex() << ", its palette has "
+                  << palettes[paletteIndex].getColorCount() << std::endl;
+        return false;
+    }
+    
+    int bitsPerIndex = SpriteFile::getBitsPerIndex(palettes[paletteIndex].getColorCount());
+    packed.resize(SpriteFile::packedSize(editor.getGridSize(), bitsPerIndex));
+    SpriteFile::pack(editor, bitsPerIndex, packed.data());
+    
+    SpriteView sprite;
+    sprite.gridSize = editor.getGridSize();
+    sprite.bitsPerIndex = bitsPerIndex;
+    sprite.data = packed.data();
+    return addSprite(sprite, paletteIndex);
+}
+
+bool SpriteLibraryWriter::addSprite(const SpriteView& sprite, int paletteIndex) {
+    if (!file || paletteIndex < 0 || paletteIndex >= static_cast<int>(palettes.size())) return false;
+    if (sprite.gridSize < 1 || sprite.gridSize > SpriteFile::MAX_GRID_SIZE ||
+        (sprite.bitsPerIndex != 4 && sprite.bitsPerIndex != 8)) {
+        return false;
+    }
+    
+    size_t size = SpriteFile::packedSize(sprite.gridSize, sprite.bitsPerIndex);
+    if (fwrite(sprite.data, 1, size, file) != size) return false;
+    
+    SpriteLibrary::Record record = {};
+    record.dataOffset = dataOffset;
+    record.gridSize = static_cast<Uint16>(sprite.gridSize);
+    record.bitsPerIndex = static_cast<Uint8>(sprite.bitsPerIndex);
+    record.paletteIndex = static_cast<Uint16>(paletteIndex);
+    records.push_back(record);
+    
+    dataOffset += size;
+    return true;
+}
+
+bool SpriteLibraryWriter::finish() {
+    if (!file) return false;
+    
+    SpriteLibrary::Header header = {};
+    header.magic = SpriteLibrary::LIBRARY_MAGIC;
+    header.version = SpriteLibrary::LIBRARY_VERSION;
+    header.spriteCount = records.size();
+    header.paletteOffset = dataOffset;
+    header.paletteCount = static_cast<Uint32>(palettes.size());
+    
+    bool ok = true;
+    Uint64 offset = dataOffset;
+    for (const auto& palette : palettes) {
+        Uint32 colorCount = static_cast<Uint32>(palette.getColorCount());
+        ok = ok && fwrite(&colorCount, sizeof(colorCount), 1, file) == 1 &&
+             fwrite(palette.getColors().data(), sizeof(SDL_Color), colorCount, file) == colorCount;
+        offset += sizeof(colorCount) + colorCount * sizeof(SDL_Color);
+    }
+    
+    // Keep the record index aligned for direct access through the mapping
+    static const Uint8 zeros[8] = {};
+    size_t padding = static_cast<size_t>((8 - offset % 8) % 8);
+    ok = ok && fwrite(zeros, 1, padding, file) == padding;
+    header.indexOffset = offset + padding;
+    
+    ok = ok && fwrite(records.data(), sizeof(SpriteLibrary::Record), records.size(), file) == records.size();
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    file = nullptr;
+    
+    if (!ok) {
+        std::cerr << "Could not write sprite library" << std::endl;
+    }
+    return ok;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "PixelEditor.h"
+#include "Palette.h"
+#include "SpriteFile.h"
+
+// Container for very large numbers of sprites (.rpl):
+//   header | packed sprite data ... | palettes | record index
+// Every sprite has a fixed-size record, so sprite i is found in O(1). The file
+// is memory-mapped and sprites are handed out as SpriteViews into the mapping;
+// nothing is parsed or copied when the library is opened, except the palettes.
+class SpriteLibrary {
+public:
+    SpriteLibrary();
+    ~SpriteLibrary();
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return mapping != nullptr; }
+
+    Uint64 getSpriteCount() const { return spriteCount; }
+
+    // View of sprite i inside the mapping; false if out of range or corrupt
+    bool getSprite(Uint64 index, SpriteView& sprite) const;
+
+    // Palette used by sprite i
+    const Palette& getSpritePalette(Uint64 index) const;
+
+    int getPaletteCount() const { return static_cast<int>(palettes.size()); }
+    const Palette& getPalette(int index) const { return palettes[index]; }
+
+private:
+    friend class SpriteLibraryWriter;
+
+    static const Uint32 LIBRARY_MAGIC = 0x4C535052;  // "RPSL"
+    static const Uint32 LIBRARY_VERSION = 1;
+
+    struct Header {
+        Uint32 magic;
+        Uint32 version;
+        Uint64 spriteCount;
+        Uint64 indexOffset;
+        Uint64 paletteOffset;
+        Uint32 paletteCount;
+        Uint32 reserved;
+        Uint8 padding[24];
+    };
+
+    // 16 bytes per sprite
+    struct Record {
+        Uint64 dataOffset;
+        Uint16 gridSize;
+        Uint8 bitsPerIndex;
+        Uint8 reserved;
+        Uint16 paletteIndex;
+        Uint16 flags;
+    };
+
+    const Uint8* mapping;
+    size_t mappingSize;
+    const Record* records;
+    Uint64 spriteCount;
+    std::vector<Palette> palettes;
+};
+
+// Streams sprites into a new library; records and palettes are written by finish()
+class SpriteLibraryWriter {
+public:
+    SpriteLibraryWriter();
+    ~SpriteLibraryWriter();
+
+    bool open(const std::string& path);
+
+    // Add a palette, returns its index for addSprite(), or -1 once records cannot address more
+    int addPalette(const Palette& palette);
+
+    // Append a sprite using a palette added before
+    bool addSprite(const PixelEditor& editor, int paletteIndex);
+    bool addSprite(const SpriteView& sprite, int paletteIndex);
+
+    // Write palettes, the record index and the final header
+    bool finish();
+
+private:
+    static const size_t MAX_PALETTES = 0xFFFF;  // Records store a 16-bit palette index
+
+    FILE* file;
+    Uint64 dataOffset;
+    std::vector<SpriteLibrary::Record> records;
+    std::vector<Palette> palettes;
+    std::vector<Uint8> packed;
+};
@@ -0,0 +1,140 @@
+#include "SpriteSymmetry.h"
+#include <algorithm>
+#include <cstring>
+
+void SpriteSymmetry::canonicalize(const Uint8* indices, int gridSize, CanonicalForm& form) {
+    bool fourBit = std::all_of(indices, indices + gridSize * gridSize, [](Uint8 index) { return index < 16; });
+    
+    if (gridSize == 8 && fourBit) {
+        canonicalize8x8(indices, form);
+    } else {
+        canonicalizeGeneric(indices, gridSize, form);
+    }
+}
+
+int SpriteSymmetry::inverse(int orientation) {
+    // (mirror . transpose)^-1 = transpose . mirror, which mirrors the other axis
+    if (orientation & 4) {
+        return 4 | ((orientation & 1) << 1) | ((orientation & 2) >> 1);
+    }
+    return orientation;
+}
+
+void SpriteSymmetry::transformImage(const Uint8* source, int size, int bytesPerPixel,
+                                    int orientation, Uint8* destination) {
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int tx = x;
+            int ty = y;
+            if (orientation & 4) std::swap(tx, ty);
+            if (orientation & 1) tx = size - 1 - tx;
+            if (orientation & 2) ty = size - 1 - ty;
+            
+            std::memcpy(destination + (static_cast<size_t>(ty) * size + tx) * bytesPerPixel,
+                        source + (static_cast<size_t>(y) * size + x) * bytesPerPixel, bytesPerPixel);
+        }
+    }
+}
+
+Uint64 SpriteSymmetry::transpose8x8(Uint64 plane) {
+    // Swap bit (x, y) with bit (y, x) in three delta swaps
+    const Uint64 k1 = 0x5500550055005500ULL;
+    const Uint64 k2 = 0x3333000033330000ULL;
+    const Uint64 k4 = 0x0F0F0F0F00000000ULL;
+    Uint64 t;
+    t = k4 & (plane ^ (plane << 28));
+    plane ^= t ^ (t >> 28);
+    t = k2 & (plane ^ (plane << 14));
+    plane ^= t ^ (t >> 14);
+    t = k1 & (plane ^ (plane << 7));
+    plane ^= t ^ (t >> 7);
+    return plane;
+}
+
+Uint64 SpriteSymmetry::mirror8x8(Uint64 plane) {
+    // Reverse the bits of every byte, i.e. x -> 7 - x on every row
+    plane = ((plane >> 1) & 0x5555555555555555ULL) | ((plane & 0x5555555555555555ULL) << 1);
+    plane = ((plane >> 2) & 0x3333333333333333ULL) | ((plane & 0x3333333333333333ULL) << 2);
+    plane = ((plane >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((plane & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return plane;
+}
+
+Uint64 SpriteSymmetry::hashWords(const Uint64* words, int count) {
+    // splitmix64 finalizer folded over the words
+    Uint64 hash = 0x9E3779B97F4A7C15ULL * static_cast<Uint64>(count + 1);
+    for (int i = 0; i < count; i++) {
+        hash ^= words[i];
+        hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+        hash ^= hash >> 31;
+    }
+    return hash;
+}
+
+void SpriteSymmetry::canonicalize8x8(const Uint8* indices, CanonicalForm& form) {
+    // Bit (y * 8 + x) of plane b is bit b of the index at (x, y)
+    Uint64 planes[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 64; i++) {
+        for (int bit = 0; bit < 4; bit++) {
+            planes[bit] |= static_cast<Uint64>((indices[i] >> bit) & 1) << i;
+        }
+    }
+    
+    Uint64 best[4] = {0, 0, 0, 0};
+    int bestOrientation = -1;
+    
+    for (int orientation = 0; orientation < ORIENTATION_COUNT; orientation++) {
+        Uint64 variant[4];
+        for (int bit = 0; bit < 4; bit++) {
+            Uint64 plane = planes[bit];
+            if (orientation & 4) plane = transpose8x8(plane);
+            if (orientation & 1) plane = mirror8x8(plane);
+            if (orientation & 2) plane = __builtin_bswap64(plane);  // Rows are bytes
+            variant[bit] = plane;
+        }
+        
+        // Lowest variant wins, most significant plane first
+        bool better = bestOrientation < 0;
+        for (int bit = 3; bit >= 0 && !better; bit--) {
+            if (variant[bit] != best[bit]) {
+                better = variant[bit] < best[bit];
+                break;
+            }
+        }
+        if (better) {
+            std::memcpy(best, variant, sizeof(best));
+            bestOrientation = orientation;
+        }
+    }
+    
+    form.orientation = bestOrientation;
+    form.hash = hashWords(best, 4);
+    form.identity.resize(sizeof(best) + 1);
+    form.identity[0] = 8;
+    std::memcpy(&form.identity[1], best, sizeof(best));
+}
+
+void SpriteSymmetry::canonicalizeGeneric(const Uint8* indices, int gridSize, CanonicalForm& form) {
+    size_t cells = static_cast<size_t>(gridSize) * gridSize;
+    std::vector<Uint8> best;
+    std::vector<Uint8> variant(cells);
+    int bestOrientation = -1;
+    
+    for (int orientation = 0; orientation < ORIENTATION_COUNT; orientation++) {
+        transformImage(indices, gridSize, 1, orientation, variant.data());
+        if (bestOrientation < 0 || variant < best) {
+            best = variant;
+            bestOrientation = orientation;
+        }
+    }
+    
+    // Hash eight indices per word
+    std::vector<Uint64> words((cells + 7) / 8, 0);
+    std::memcpy(words.data(), best.data(), cells);
+    
+    form.orientation = bestOrientation;
+    form.hash = hashWords(words.data(), static_cast<int>(words.size())) ^ static_cast<Uint64>(gridSize);
+    form.identity.resize(cells + 1);
+    form.identity[0] = static_cast<Uint8>(gridSize);
+    std::memcpy(&form.identity[1], best.data(), cells);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+
+// Canonical form of a grid under the 8 symmetries of the square (the D4 group).
+// Grids equal up to rotation or reflection share the same canonical form, so
+// work done for one (e.g. a render) can be reused for the others by
+// re-orienting the result: expansion commutes with every symmetry.
+//
+// Orientation o is applied as: transpose if o & 4, then mirror x if o & 1,
+// then mirror y if o & 2.
+struct CanonicalForm {
+    Uint64 hash = 0;
+    int orientation = 0;           // canonical grid = transformGrid(grid, orientation)
+    std::vector<Uint8> identity;   // Exact canonical content, to rule out hash collisions
+};
+
+class SpriteSymmetry {
+public:
+    static const int ORIENTATION_COUNT = 8;
+
+    // Canonical form of a grid of indices (one byte per pixel)
+    static void canonicalize(const Uint8* indices, int gridSize, CanonicalForm& form);
+
+    // Orientation that undoes the given one
+    static int inverse(int orientation);
+
+    // Re-orient a square image of size x size pixels of bytesPerPixel bytes
+    static void transformImage(const Uint8* source, int size, int bytesPerPixel,
+                               int orientation, Uint8* destination);
+
+private:
+    // 8x8 grids with 4-bit indices: four 64-bit bit planes, transformed with bit tricks
+    static void canonicalize8x8(const Uint8* indices, CanonicalForm& form);
+    static void canonicalizeGeneric(const Uint8* indices, int gridSize, CanonicalForm& form);
+
+    static Uint64 transpose8x8(Uint64 plane);
+    static Uint64 mirror8x8(Uint64 plane);
+    static Uint64 hashWords(const Uint64* words, int count);
+};
@@ -0,0 +1,59 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount) : runningTasks(0), stopping(false) {
+    if (threadCount <= 0) {
+        threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    
+    for (int i = 0; i < threadCount; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+    
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return tasks.empty() && runningTasks == 0; });
+}
+
+void ThreadPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    
+    while (true) {
+        taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (tasks.empty()) return;  // Stopping and nothing left to do
+        
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        runningTasks++;
+        
+        lock.unlock();
+        task();
+        lock.lock();
+        
+        runningTasks--;
+        if (tasks.empty() && runningTasks == 0) {
+            idle.notify_all();
+        }
+    }
+}
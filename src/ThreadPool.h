@@ -0,0 +1,34 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling tasks from a shared queue
+class ThreadPool {
+public:
+    // threadCount 0 means one thread per hardware core
+    explicit ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+
+    int getThreadCount() const { return static_cast<int>(workers.size()); }
+
+    // Queue a task; it runs on whichever worker is free first
+    void submit(std::function<void()> task);
+
+    // Block until the queue is empty and no task is running
+    void waitIdle();
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable idle;
+    int runningTasks;
+    bool stopping;
+
+    void workerLoop();
+};
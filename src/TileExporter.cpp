@@ -0,0 +1,362 @@
+#include "TileExporter.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "CoverageTable.h"
+#include "PngWriter.h"
+#include "ThreadPool.h"
+
+TileExporter::TileExporter(const TileOptions& options)
+    : options(options), tilePositions(0), tilesWritten(0), bytesWritten(0), levelCount(0), colorCount(0) {}
+
+bool TileExporter::run(const SpriteView& sprite, const Palette& palette) {
+    if (options.tileSize < 16 || options.tileSize > 4096) {
+        std::cerr << "Tile size must be between 16 and 4096" << std::endl;
+        return false;
+    }
+
+    size_t dot = options.outputPath.find_last_of('.');
+    size_t slash = options.outputPath.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        std::cerr << "Tile output must be a .dzi path" << std::endl;
+        return false;
+    }
+    tileDirectory = options.outputPath.substr(0, dot) + "_files";
+
+    RecursiveExpander expander(sprite, options.depth, BlendTable(palette, options.blend),
+                               options.rules);
+    int imageSize = expander.getOutputSize();
+    colorCount = std::max(palette.getColorCount(), expander.getStateCount());
+
+    // Level 0 is 1 x 1, the last level is the full output
+    int maxLevel = 0;
+    while ((1LL << maxLevel) < imageSize) {
+        maxLevel++;
+    }
+    levelCount = maxLevel + 1;
+
+    tilePositions = 0;
+    for (int level = maxLevel; level >= 0; level--) {
+        Uint64 size = (static_cast<Uint64>(imageSize) + (1ULL << (maxLevel - level)) - 1) >> (maxLevel - level);
+        Uint64 tiles = (size + options.tileSize - 1) / options.tileSize;
+        tilePositions += tiles * tiles;
+    }
+    if (tilePositions > MAX_TILE_POSITIONS) {
+        std::cerr << "Depth " << options.depth << " needs " << tilePositions << " tiles, more than "
+                  << MAX_TILE_POSITIONS << "; lower the depth or raise the tile size" << std::endl;
+        return false;
+    }
+
+    mkdir(tileDirectory.c_str(), 0755);
+    for (int level = 0; level <= maxLevel; level++) {
+        mkdir((tileDirectory + "/" + std::to_string(level)).c_str(), 0755);
+    }
+
+    float linear[256][3];
+    for (int i = 0; i < 256; i++) {
+        SDL_Color color = palette.getColor(i);
+        linear[i][0] = CoverageTable::srgbToLinear(color.r);
+        linear[i][1] = CoverageTable::srgbToLinear(color.g);
+        linear[i][2] = CoverageTable::srgbToLinear(color.b);
+    }
+
+    ThreadPool pool(options.threads);
+    Level child;
+    Level current;
+    planFullLevel(expander, current);
+
+    for (int levelIndex = maxLevel; levelIndex >= 0; levelIndex--) {
+        if (levelIndex < maxLevel) {
+            planParentLevel(child, current);
+        }
+
+        int uniqueTiles = static_cast<int>(current.firstPosition.size());
+        current.pixels.assign(uniqueTiles, std::vector<float>());
+        std::vector<std::string> files(uniqueTiles);
+        for (int tile = 0; tile < uniqueTiles; tile++) {
+            pool.submit([&, tile, levelIndex] {
+                files[tile] = (levelIndex == maxLevel)
+                    ? drawFullTile(expander, palette, linear, current, tile, levelIndex)
+                    : drawParentTile(child, current, tile, levelIndex);
+            });
+        }
+        pool.waitIdle();
+
+        for (const std::string& file : files) {
+            if (file.empty()) return false;
+        }
+        if (!linkPositions(current, levelIndex, files)) return false;
+
+        // Only the level below is needed to average the next one
+        child = std::move(current);
+        current = Level();
+    }
+
+    return writeDescriptor(imageSize);
+}
+
+void TileExporter::planFullLevel(const RecursiveExpander& expander, Level& level) const {
+    int tileSize = options.tileSize;
+    int baseSize = expander.getBaseSize();
+    int depth = expander.getDepth();
+    level.size = expander.getOutputSize();
+    level.columns = (level.size + tileSize - 1) / tileSize;
+    level.rows = level.columns;
+
+    // Nodes of the smallest side at least a tile: a tile lies within 2 x 2 of them
+    int nodeLevel = depth;
+    int nodeSide = 1;
+    while (nodeLevel > 0 && nodeSide < tileSize) {
+        nodeSide *= baseSize;
+        nodeLevel--;
+    }
+
+    // A tile is its offset into its nodes, its clipped size and their states
+    std::map<std::vector<int>, int> unique;
+    std::vector<int> key;
+    level.positions.resize(static_cast<size_t>(level.columns) * level.rows);
+    for (int row = 0; row < level.rows; row++) {
+        for (int column = 0; column < level.columns; column++) {
+            int x = column * tileSize;
+            int y = row * tileSize;
+            int width = std::min(tileSize, level.size - x);
+            int height = std::min(tileSize, level.size - y);
+
+            key.assign({x % nodeSide, y % nodeSide, width, height});
+            if (nodeLevel > 0) {
+                for (int nodeY = y / nodeSide; nodeY <= (y + height - 1) / nodeSide; nodeY++) {
+                    for (int nodeX = x / nodeSide; nodeX <= (x + width - 1) / nodeSide; nodeX++) {
+                        key.push_back(expander.getState(nodeLevel, nodeX, nodeY));
+                    }
+                }
+            }
+
+            int position = row * level.columns + column;
+            auto found = unique.emplace(key, static_cast<int>(level.firstPosition.size()));
+            if (found.second) {
+                level.firstPosition.push_back(position);
+                level.widths.push_back(width);
+                level.heights.push_back(height);
+            }
+            level.positions[position] = found.first->second;
+        }
+    }
+}
+
+void TileExporter::planParentLevel(const Level& child, Level& level) const {
+    int tileSize = options.tileSize;
+    level.size = (child.size + 1) / 2;
+    level.columns = (level.size + tileSize - 1) / tileSize;
+    level.rows = level.columns;
+
+    // A parent is its clipped size and the (up to) four tiles it averages
+    std::map<std::vector<int>, int> unique;
+    std::vector<int> key;
+    level.positions.resize(static_cast<size_t>(level.columns) * level.rows);
+    for (int row = 0; row < level.rows; row++) {
+        for (int column = 0; column < level.columns; column++) {
+            int width = std::min(tileSize, level.size - column * tileSize);
+            int height = std::min(tileSize, level.size - row * tileSize);
+
+            key.assign({width, height});
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    int childColumn = column * 2 + dx;
+                    int childRow = row * 2 + dy;
+                    bool inside = childColumn < child.columns && childRow < child.rows;
+                    key.push_back(inside ? child.positions[childRow * child.columns + childColumn] : -1);
+                }
+            }
+
+            int position = row * level.columns + column;
+            auto found = unique.emplace(key, static_cast<int>(level.firstPosition.size()));
+            if (found.second) {
+                level.firstPosition.push_back(position);
+                level.widths.push_back(width);
+                level.heights.push_back(height);
+            }
+            level.positions[position] = found.first->second;
+        }
+    }
+}
+
+std::string TileExporter::drawFullTile(const RecursiveExpander& expander, const Palette& palette,
+                                       const float linear[256][3], Level& level, int tile, int levelIndex) {
+    int position = level.firstPosition[tile];
+    int column = position % level.columns;
+    int row = position / level.columns;
+    int width = level.widths[tile];
+    int height = level.heights[tile];
+
+    std::vector<Uint8> indices(static_cast<size_t>(width) * height);
+    expander.expandRegion(column * options.tileSize, row * options.tileSize, width, height, indices.data(), width);
+
+    std::vector<float>& pixels = level.pixels[tile];
+    std::vector<Uint8> rgb(indices.size() * 3);
+    pixels.resize(indices.size() * 3);
+    for (size_t i = 0; i < indices.size(); i++) {
+        SDL_Color color = palette.getColor(indices[i]);
+        rgb[i * 3] = color.r;
+        rgb[i * 3 + 1] = color.g;
+        rgb[i * 3 + 2] = color.b;
+        std::copy(linear[indices[i]], linear[indices[i]] + 3, &pixels[i * 3]);
+    }
+
+    return storeTile(getTilePath(levelIndex, column, row), width, height, rgb, &indices, &palette);
+}
+
+std::string TileExporter::drawParentTile(const Level& child, Level& level, int tile, int levelIndex) {
+    int tileSize = options.tileSize;
+    int position = level.firstPosition[tile];
+    int column = position % level.columns;
+    int row = position / level.columns;
+    int width = level.widths[tile];
+    int height = level.heights[tile];
+
+    // Each pixel is the mean of the (up to) 2 x 2 pixels under it, in linear light
+    std::vector<float>& pixels = level.pixels[tile];
+    std::vector<Uint8> rgb(static_cast<size_t>(width) * height * 3);
+    pixels.resize(rgb.size());
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float sum[3] = {0.0f, 0.0f, 0.0f};
+            int count = 0;
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    int childX = (column * tileSize + x) * 2 + dx;
+                    int childY = (row * tileSize + y) * 2 + dy;
+                    if (childX >= child.size || childY >= child.size) continue;
+
+                    int childTile = child.positions[(childY / tileSize) * child.columns + childX / tileSize];
+                    const float* source = &child.pixels[childTile][
+                        (static_cast<size_t>(childY % tileSize) * child.widths[childTile] + childX % tileSize) * 3];
+                    sum[0] += source[0];
+                    sum[1] += source[1];
+                    sum[2] += source[2];
+                    count++;
+                }
+            }
+
+            size_t offset = (static_cast<size_t>(y) * width + x) * 3;
+            for (int channel = 0; channel < 3; channel++) {
+                pixels[offset + channel] = sum[channel] / count;
+                rgb[offset + channel] = CoverageTable::linearToSrgb(pixels[offset + channel]);
+            }
+        }
+    }
+
+    return storeTile(getTilePath(levelIndex, column, row), width, height, rgb, nullptr, nullptr);
+}
+
+std::string TileExporter::storeTile(const std::string& path, int width, int height, const std::vector<Uint8>& rgb,
+                                    const std::vector<Uint8>* indices, const Palette* palette) {
+    std::vector<Uint8> content = rgb;
+    for (int shift = 0; shift < 32; shift += 8) {
+        content.push_back(static_cast<Uint8>(width >> shift));
+    }
+
+    // FNV-1a
+    Uint64 hash = 0xCBF29CE484222325ULL;
+    for (Uint8 byte : content) {
+        hash = (hash ^ byte) * 0x100000001B3ULL;
+    }
+
+    // Claim the content before encoding so identical tiles drawn at the same
+    // time are written once; positions are only linked after every write
+    {
+        std::lock_guard<std::mutex> lock(contentMutex);
+        auto range = contents.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second.first == content) {
+                return it->second.second;
+            }
+        }
+        contents.emplace(hash, std::make_pair(std::move(content), path));
+    }
+
+    PngOptions pngOptions;
+    pngOptions.threads = 1;
+    PngWriter writer(pngOptions);
+    bool ok;
+    if (indices) {
+        ok = writer.writeIndexed(path, width, height, *palette, colorCount,
+            [&](int firstRow, int rowCount, Uint8* out, size_t stride) {
+                for (int r = 0; r < rowCount; r++) {
+                    std::copy_n(&(*indices)[static_cast<size_t>(firstRow + r) * width], width, out + r * stride);
+                }
+            });
+    } else {
+        ok = writer.writeRGB(path, width, height, [&](int firstRow, int rowCount, Uint8* out, size_t stride) {
+            for (int r = 0; r < rowCount; r++) {
+                std::copy_n(&rgb[static_cast<size_t>(firstRow + r) * width * 3], width * 3, out + r * stride);
+            }
+        });
+    }
+    if (!ok) return std::string();
+
+    std::lock_guard<std::mutex> lock(contentMutex);
+    tilesWritten++;
+    bytesWritten += writer.getBytesWritten();
+    return path;
+}
+
+bool TileExporter::linkPositions(const Level& level, int levelIndex, std::vector<std::string>& files) {
+    for (int row = 0; row < level.rows; row++) {
+        for (int column = 0; column < level.columns; column++) {
+            int tile = level.positions[row * level.columns + column];
+            std::string path = getTilePath(levelIndex, column, row);
+            if (path == files[tile]) continue;
+
+            unlink(path.c_str());
+            if (link(files[tile].c_str(), path.c_str()) == 0) continue;
+
+            // Past the file system's link limit, start over from a fresh copy
+            if (errno != EMLINK || !copyFile(files[tile], path)) {
+                std::cerr << "Could not link " << path << std::endl;
+                return false;
+            }
+            files[tile] = path;
+        }
+    }
+    return true;
+}
+
+bool TileExporter::copyFile(const std::string& from, const std::string& to) {
+    FILE* source = fopen(from.c_str(), "rb");
+    if (!source) return false;
+    FILE* target = fopen(to.c_str(), "wb");
+    bool ok = target != nullptr;
+
+    char buffer[65536];
+    size_t length;
+    while (ok && (length = fread(buffer, 1, sizeof(buffer), source)) > 0) {
+        ok = fwrite(buffer, 1, length, target) == length;
+    }
+    fclose(source);
+    ok = target && (fclose(target) == 0) && ok;
+    return ok;
+}
+
+std::string TileExporter::getTilePath(int levelIndex, int column, int row) const {
+    return tileDirectory + "/" + std::to_string(levelIndex) + "/" + std::to_string(column) + "_" +
+           std::to_string(row) + ".png";
+}
+
+bool TileExporter::writeDescriptor(int imageSize) const {
+    FILE* file = fopen(options.outputPath.c_str(), "w");
+    if (!file) {
+        std::cerr << "Could not write " << options.outputPath << std::endl;
+        return false;
+    }
+
+    fprintf(file,
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" TileSize=\"%d\" Overlap=\"0\" Format=\"png\">\n"
+            "  <Size Width=\"%d\" Height=\"%d\"/>\n"
+            "</Image>\n",
+            options.tileSize, imageSize, imageSize);
+    return fclose(file) == 0;
+}
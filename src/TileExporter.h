@@ -0,0 +1,90 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "BlendTable.h"
+#include "PackedIndices.h"
+#include "Palette.h"
+#include "RecursiveExpander.h"
+
+struct TileOptions {
+    std::string outputPath;  // The .dzi descriptor; tiles go to <name>_files/<level>/<column>_<row>.png
+    int depth = 3;
+    int tileSize = 256;
+    int threads = 0;         // 0 means one per hardware core
+    BlendMode blend = BlendMode::Source;
+    std::vector<std::vector<Uint8>> rules;  // Pattern grid per color, empty for a copy of the sprite
+};
+
+// Writes a Deep Zoom (DZI) tile pyramid of a depth-d output for static web
+// viewers. Self-similarity makes most tiles identical, so tiles are
+// identified before any pixel is drawn: at full resolution by the states of
+// the substitution nodes a tile covers and its offset within them, at every
+// coarser level by the tiles it is averaged from. Each unique tile is drawn
+// and encoded once, in parallel; tiles whose pixels still match are written
+// once more than that, and every other position is a hardlink, so the
+// pyramid's size follows its unique content rather than its area.
+class TileExporter {
+public:
+    explicit TileExporter(const TileOptions& options);
+    ~TileExporter() = default;
+
+    bool run(const SpriteView& sprite, const Palette& palette);
+
+    Uint64 getTilePositions() const { return tilePositions; }
+    Uint64 getTilesWritten() const { return tilesWritten; }
+    Uint64 getBytesWritten() const { return bytesWritten; }
+    int getLevelCount() const { return levelCount; }
+
+private:
+    static constexpr Uint64 MAX_TILE_POSITIONS = 1 << 22;
+
+    // The tiles of one pyramid level: per position, the index of its unique
+    // tile; per unique tile, its size and linear RGB pixels
+    struct Level {
+        int size;      // Image side at this level
+        int columns;
+        int rows;
+        std::vector<int> positions;
+        std::vector<int> widths;
+        std::vector<int> heights;
+        std::vector<std::vector<float>> pixels;
+        std::vector<int> firstPosition;  // Where each unique tile first appears
+    };
+
+    TileOptions options;
+    std::string tileDirectory;
+    Uint64 tilePositions;
+    Uint64 tilesWritten;
+    Uint64 bytesWritten;
+    int levelCount;
+    int colorCount;  // Color table of indexed tiles: every state, even ones past the palette
+
+    // Encoded tiles by pixel hash, shared by every level
+    std::mutex contentMutex;
+    std::unordered_multimap<Uint64, std::pair<std::vector<Uint8>, std::string>> contents;
+
+    void planFullLevel(const RecursiveExpander& expander, Level& level) const;
+    void planParentLevel(const Level& child, Level& level) const;
+
+    // Draw a unique tile into its level and store it; return the file holding it
+    std::string drawFullTile(const RecursiveExpander& expander, const Palette& palette,
+                             const float linear[256][3], Level& level, int tile, int levelIndex);
+    std::string drawParentTile(const Level& child, Level& level, int tile, int levelIndex);
+
+    // Write a tile's PNG at path unless an identical one exists; returns the
+    // file holding it. Full-resolution tiles come with indices and are indexed.
+    std::string storeTile(const std::string& path, int width, int height, const std::vector<Uint8>& rgb,
+                          const std::vector<Uint8>* indices, const Palette* palette);
+
+    static bool copyFile(const std::string& from, const std::string& to);
+
+    // Hardlink every position of a level to the file holding its tile
+    bool linkPositions(const Level& level, int levelIndex, std::vector<std::string>& files);
+    std::string getTilePath(int levelIndex, int column, int row) const;
+    bool writeDescriptor(int imageSize) const;
+};
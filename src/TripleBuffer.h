@@ -0,0 +1,45 @@
+#pragma once
+#include <atomic>
+
+// Lock-free single-producer/single-consumer triple buffer.
+// The writer fills getWriteBuffer() and publishes it; the reader picks up the
+// most recently published slot with update(). Neither side ever blocks, and
+// the reader never sees a slot that is being written.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : back(0), middle(1), front(2) {}
+
+    // Writer side: slot to fill before publish()
+    T& getWriteBuffer() { return slots[back]; }
+
+    // Writer side: hand the filled slot to the reader
+    void publish() {
+        int previous = middle.exchange(back | FRESH_BIT, std::memory_order_acq_rel);
+        back = previous & INDEX_MASK;
+    }
+
+    // Reader side: switch to the newest published slot, false if nothing new
+    bool update() {
+        if ((middle.load(std::memory_order_acquire) & FRESH_BIT) == 0) {
+            return false;
+        }
+        int previous = middle.exchange(front, std::memory_order_acq_rel);
+        front = previous & INDEX_MASK;
+        return true;
+    }
+
+    // Reader side: current slot, valid until the next update()
+    const T& read() const { return slots[front]; }
+
+private:
+    static const int INDEX_MASK = 3;
+    static const int FRESH_BIT = 4;
+
+    T slots[3];
+
+    // Each index is touched by a different party, keep them on separate cache lines
+    alignas(64) int back;
+    alignas(64) std::atomic<int> middle;
+    alignas(64) int front;
+};
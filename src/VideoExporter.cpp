@@ -0,0 +1,215 @@
+#include "VideoExporter.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "OrderedWriter.h"
+#include "RecursiveExpander.h"
+#include "RecursiveRenderer.h"
+#include "ThreadPool.h"
+
+VideoExporter::VideoExporter(const VideoOptions& options)
+    : options(options), frameCount(0), secondsElapsed(0.0), imageSize(0) {}
+
+bool VideoExporter::getFormat(const std::string& path, VideoFormat& format) {
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".y4m") == 0) {
+        format = VideoFormat::Y4M;
+    } else if (path.size() > 4 && path.compare(path.size() - 4, 4, ".rgb") == 0) {
+        format = VideoFormat::RGB;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool VideoExporter::run(const SpriteView& sprite, const Palette& palette) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    if (options.width < 2 || options.height < 2 || options.width % 2 != 0 || options.height % 2 != 0) {
+        std::cerr << "Video width and height must be even" << std::endl;
+        return false;
+    }
+    if (options.framesPerSecond < 1 || options.seconds <= 0.0f) {
+        std::cerr << "Frame rate and duration must be positive" << std::endl;
+        return false;
+    }
+
+    RecursiveExpander expander(sprite, options.depth, BlendTable(palette, options.blend),
+                               options.rules);
+    imageSize = expander.getOutputSize();
+    if (imageSize > MAX_IMAGE_SIZE) {
+        std::cerr << "Depth " << options.depth << " is too deep to animate" << std::endl;
+        return false;
+    }
+    image.resize(static_cast<size_t>(imageSize) * imageSize);
+    expander.expandRows(0, imageSize, image.data(), imageSize);
+    frameCount = static_cast<int>(options.seconds * options.framesPerSecond + 0.5f);
+
+    // Colors per index once: RGB, and full-range BT.601 YUV as C420jpeg expects
+    for (int i = 0; i < 256; i++) {
+        SDL_Color color = palette.getColor(i);
+        rgb[i][0] = color.r;
+        rgb[i][1] = color.g;
+        rgb[i][2] = color.b;
+
+        float y = 0.299f * color.r + 0.587f * color.g + 0.114f * color.b;
+        float u = 128.0f - 0.168736f * color.r - 0.331264f * color.g + 0.5f * color.b;
+        float v = 128.0f + 0.5f * color.r - 0.418688f * color.g - 0.081312f * color.b;
+        yuv[i][0] = static_cast<Uint8>(std::min(255.0f, std::max(0.0f, y + 0.5f)));
+        yuv[i][1] = static_cast<Uint8>(std::min(255.0f, std::max(0.0f, u + 0.5f)));
+        yuv[i][2] = static_cast<Uint8>(std::min(255.0f, std::max(0.0f, v + 0.5f)));
+    }
+
+    // A file is written under a temporary name; a pipe is written as it goes
+    bool toStandardOutput = options.outputPath == "-";
+    std::string tempPath = options.outputPath + ".tmp";
+    FILE* file = toStandardOutput ? stdout : fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Could not create " << tempPath << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+    if (options.format == VideoFormat::Y4M) {
+        char header[128];
+        int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+                              options.width, options.height, options.framesPerSecond);
+        ok = fwrite(header, 1, length, file) == static_cast<size_t>(length);
+    }
+
+    OrderedWriter writer([file](Uint64, const std::vector<Uint8>& data) {
+        return fwrite(data.data(), 1, data.size(), file) == data.size();
+    }, options.maxBytesInFlight);
+
+    if (ok) {
+        ThreadPool pool(options.threads);
+        size_t pixels = static_cast<size_t>(options.width) * options.height;
+        size_t frameBytes = (options.format == VideoFormat::Y4M) ? pixels * 3 / 2 + 6 : pixels * 3;
+
+        // acquire() blocks while the reorder buffer is full, which happens as
+        // soon as the consumer falls behind
+        for (int frame = 0; frame < frameCount && !writer.hasFailed(); frame++) {
+            writer.acquire(frameBytes);
+            pool.submit([this, frame, frameBytes, &writer] {
+                std::vector<Uint8> data;
+                data.reserve(frameBytes);
+                encodeFrame(frame, data);
+                writer.submit(frame, std::move(data), frameBytes);
+            });
+        }
+        pool.waitIdle();
+    }
+    writer.finish();
+    ok = ok && !writer.hasFailed() && writer.getItemsWritten() == static_cast<Uint64>(frameCount);
+
+    ok = (fflush(file) == 0) && ok;
+    if (!toStandardOutput) {
+        ok = (fclose(file) == 0) && ok;
+        ok = ok && rename(tempPath.c_str(), options.outputPath.c_str()) == 0;
+    }
+    if (!ok) {
+        std::cerr << "Could not write " << options.outputPath << std::endl;
+        if (!toStandardOutput) {
+            remove(tempPath.c_str());
+        }
+        return false;
+    }
+
+    secondsElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    return true;
+}
+
+void VideoExporter::drawIndices(int frame, Uint8* indices) const {
+    int width = options.width;
+    int height = options.height;
+
+    // At the smallest pulse the image is half the frame height, centered
+    float seconds = static_cast<float>(frame) / options.framesPerSecond;
+    int size = static_cast<int>(height / 2 * RecursiveRenderer::getPulseScale(seconds) + 0.5f);
+    int offsetX = (width - size) / 2;
+    int offsetY = (height - size) / 2;
+
+    // Visible columns of the image and where each one samples from
+    int firstColumn = std::max(0, offsetX);
+    int lastColumn = std::min(width, offsetX + size);
+    std::vector<int> columns(std::max(0, lastColumn - firstColumn));
+    for (int x = firstColumn; x < lastColumn; x++) {
+        columns[x - firstColumn] = static_cast<int>(static_cast<long long>(x - offsetX) * imageSize / size);
+    }
+
+    int previousSource = -1;
+    for (int y = 0; y < height; y++) {
+        Uint8* row = indices + static_cast<size_t>(y) * width;
+        int imageRow = y - offsetY;
+        if (imageRow < 0 || imageRow >= size) {
+            std::memset(row, 0, width);
+            previousSource = -1;
+            continue;
+        }
+
+        // Upscaled rows repeat the row above
+        int source = static_cast<int>(static_cast<long long>(imageRow) * imageSize / size);
+        if (source == previousSource) {
+            std::memcpy(row, row - width, width);
+            continue;
+        }
+        previousSource = source;
+
+        const Uint8* sourceRow = &image[static_cast<size_t>(source) * imageSize];
+        std::memset(row, 0, firstColumn);
+        for (size_t i = 0; i < columns.size(); i++) {
+            row[firstColumn + i] = sourceRow[columns[i]];
+        }
+        std::memset(row + lastColumn, 0, width - lastColumn);
+    }
+}
+
+void VideoExporter::encodeFrame(int frame, std::vector<Uint8>& out) const {
+    int width = options.width;
+    int height = options.height;
+    size_t pixels = static_cast<size_t>(width) * height;
+
+    std::vector<Uint8> indices(pixels);
+    drawIndices(frame, indices.data());
+
+    if (options.format == VideoFormat::RGB) {
+        out.resize(pixels * 3);
+        Uint8* target = out.data();
+        for (size_t i = 0; i < pixels; i++) {
+            const Uint8* color = rgb[indices[i]];
+            target[0] = color[0];
+            target[1] = color[1];
+            target[2] = color[2];
+            target += 3;
+        }
+        return;
+    }
+
+    static const char marker[] = "FRAME\n";
+    out.assign(marker, marker + 6);
+    out.resize(6 + pixels * 3 / 2);
+    Uint8* luma = out.data() + 6;
+    Uint8* blue = luma + pixels;
+    Uint8* red = blue + pixels / 4;
+
+    for (size_t i = 0; i < pixels; i++) {
+        luma[i] = yuv[indices[i]][0];
+    }
+
+    // Chroma is the mean over each 2 x 2 block
+    int chromaWidth = width / 2;
+    for (int y = 0; y < height / 2; y++) {
+        const Uint8* top = &indices[static_cast<size_t>(y) * 2 * width];
+        const Uint8* bottom = top + width;
+        for (int x = 0; x < chromaWidth; x++) {
+            const Uint8* a = yuv[top[x * 2]];
+            const Uint8* b = yuv[top[x * 2 + 1]];
+            const Uint8* c = yuv[bottom[x * 2]];
+            const Uint8* d = yuv[bottom[x * 2 + 1]];
+            size_t offset = static_cast<size_t>(y) * chromaWidth + x;
+            blue[offset] = static_cast<Uint8>((a[1] + b[1] + c[1] + d[1] + 2) / 4);
+            red[offset] = static_cast<Uint8>((a[2] + b[2] + c[2] + d[2] + 2) / 4);
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "BlendTable.h"
+#include "PackedIndices.h"
+#include "Palette.h"
+
+enum class VideoFormat {
+    Y4M,  // YUV4MPEG2, 4:2:0 full-range BT.601
+    RGB   // Headerless rgb24 frames
+};
+
+struct VideoOptions {
+    std::string outputPath;  // "-" streams to standard output
+    VideoFormat format = VideoFormat::Y4M;
+    int depth = 2;
+    int width = 1920;
+    int height = 1080;
+    int framesPerSecond = 60;
+    float seconds = 10.0f;   // One pulse cycle
+    int threads = 0;         // 0 means one per hardware core
+    BlendMode blend = BlendMode::Source;
+    std::vector<std::vector<Uint8>> rules;  // Pattern grid per color, empty for a copy of the sprite
+    size_t maxBytesInFlight = static_cast<size_t>(256) << 20;
+};
+
+// Streams the pulsing animation as raw video for an external encoder, e.g.
+// `--video sprite.rps --out - | ffmpeg -i - out.mp4`. Frames are drawn on a
+// thread pool and written strictly in order by an OrderedWriter, whose
+// memory bound doubles as backpressure: when the consumer reads slower than
+// frames are drawn, the writer blocks and no new frames are started.
+class VideoExporter {
+public:
+    explicit VideoExporter(const VideoOptions& options);
+    ~VideoExporter() = default;
+
+    bool run(const SpriteView& sprite, const Palette& palette);
+
+    int getFrameCount() const { return frameCount; }
+    double getSecondsElapsed() const { return secondsElapsed; }
+
+    // Format from the path's extension (.y4m or .rgb); false if it is neither
+    static bool getFormat(const std::string& path, VideoFormat& format);
+
+private:
+    static const int MAX_IMAGE_SIZE = 4096;  // Deepest output that is animated
+
+    VideoOptions options;
+    int frameCount;
+    double secondsElapsed;
+
+    std::vector<Uint8> image;  // Index image, shown at height / 2 at the smallest pulse
+    int imageSize;
+    Uint8 rgb[256][3];
+    Uint8 yuv[256][3];
+
+    // Palette indices of one frame, width x height
+    void drawIndices(int frame, Uint8* indices) const;
+
+    // One frame as it goes into the stream
+    void encodeFrame(int frame, std::vector<Uint8>& out) const;
+};
@@ -1,21 +1,48 @@
 #include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <string>
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #include <emscripten/html5.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CommandLine.h"
 #endif
 
 #include "PixelEditor.h"
 #include "Palette.h"
 #include "RecursiveRenderer.h"
+#include "LatencyTracker.h"
+#include "EditorSnapshot.h"
+#include "TripleBuffer.h"
+#include "EditHistory.h"
+#include "SessionJournal.h"
+#include "SpriteFile.h"
 
-class PixelRecursorApp {
+// SDL's event queue and 2D renderer belong to the thread that created the
+// window, so natively the main thread pumps events and draws the latest
+// published EditorSnapshot, while a document thread applies the events to the
+// document (history, journal, file loads) and publishes new snapshots. Neither
+// side ever waits on the other for longer than a short handoff. Emscripten has
+// no threads and does both in update().
+class PixelRecursorApp : public PixelChangeListener {
 public:
-    PixelRecursorApp() : running(true), window(nullptr), renderer(nullptr) {}
+    PixelRecursorApp() : running(true), vsyncEnabled(false), lastFrameTicks(0), 
+                         reportRequested(false), previewDepth(2), previewFiltered(true),
+                         previewBlend(static_cast<int>(BlendMode::Source)), publishedSequence(0),
+                         strokeActive(false), strokeLastX(0), strokeLastY(0),
+                         window(nullptr), renderer(nullptr) {}
     
-    bool initialize() {
+    bool initialize(int argc, char* argv[]) {
         if (SDL_Init(SDL_INIT_VIDEO) < 0) {
             std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
             return false;
@@ -30,69 +57,348 @@ public:
             return false;
         }
         
-        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+        // Initialize components
+        editor = std::make_unique<PixelEditor>(8);
+        palette = std::make_unique<Palette>();
+        history = std::make_unique<EditHistory>(editor->getGridSize());
+        
+#ifndef __EMSCRIPTEN__
+        // Pattern grids for colors given on the command line
+        std::vector<std::vector<Uint8>> rules;
+        if (!CommandLine::parseEditorArguments(argc, argv, editor->getGridSize(), rules)) {
+            return false;
+        }
+        editor->setRules(rules);
+        
+        // Bring back the last session, then keep journaling from where it ended
+        std::string journalPath = getDataPath("pixelrecursor.journal");
+        if (SessionJournal::recover(journalPath, *editor, *palette)) {
+            std::cout << "Recovered previous session from " << journalPath << std::endl;
+        }
+        journal = std::make_unique<SessionJournal>(editor->getGridSize());
+        if (!journal->open(journalPath, *editor, *palette)) {
+            journal.reset();
+        }
+#else
+        (void)argc;
+        (void)argv;
+#endif
+        
+        editor->setChangeListener(this);
+        recursiveRenderer = std::make_unique<RecursiveRenderer>(8, 128);
+        
+        // The renderer must never see an empty snapshot
+        publishSnapshot();
+        
+        if (!createRenderer()) {
+            return false;
+        }
+        
+#ifndef __EMSCRIPTEN__
+        documentThread = std::thread(&PixelRecursorApp::documentLoop, this);
+#endif
+        return true;
+    }
+    
+    bool createRenderer() {
+        // Let the present pace the frames so there is no sleep between present and input
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
         if (!renderer) {
             std::cerr << "Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
             return false;
         }
         
-        // Initialize components
-        editor = std::make_unique<PixelEditor>(8);
-        palette = std::make_unique<Palette>();
-        recursiveRenderer = std::make_unique<RecursiveRenderer>(8, 128);
+        SDL_RendererInfo info;
+        if (SDL_GetRendererInfo(renderer, &info) == 0) {
+            vsyncEnabled = (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
+        }
         
         return true;
     }
     
+    // Handle one event; returns true if it changed what the renderer must show
+    bool processEvent(const SDL_Event& e) {
+        Uint64 revisionBefore = editor->getRevision();
+        Uint64 paletteRevisionBefore = palette->getRevision();
+        
+        if (e.type == SDL_QUIT) {
+            running = false;
+        } else if (e.type == SDL_MOUSEBUTTONDOWN) {
+            if (e.button.button == SDL_BUTTON_LEFT) {
+                int mouseX = e.button.x;
+                int mouseY = e.button.y;
+                int cellX, cellY;
+                
+                // Check if click is on palette
+                if (palette->handleClick(mouseX, mouseY, PALETTE_X, PALETTE_Y, PALETTE_CELL_SIZE)) {
+                    return true;
+                }
+                // Check if click is on editor grid, which starts a stroke
+                else if (editor->screenToCell(mouseX, mouseY, EDITOR_X, EDITOR_Y, 
+                                              EDITOR_CELL_SIZE, cellX, cellY)) {
+                    history->beginGroup(*editor);
+                    editor->setPixel(cellX, cellY, palette->getCurrentColorIndex());
+                    strokeActive = true;
+                    strokeLastX = cellX;
+                    strokeLastY = cellY;
+                }
+            }
+        } else if (e.type == SDL_MOUSEMOTION) {
+            if (strokeActive && (e.motion.state & SDL_BUTTON_LMASK)) {
+                // Connect to the previous sample, motion events skip cells on fast drags
+                int cellX, cellY;
+                editor->screenToCell(e.motion.x, e.motion.y, EDITOR_X, EDITOR_Y,
+                                     EDITOR_CELL_SIZE, cellX, cellY);
+                editor->drawLine(strokeLastX, strokeLastY, cellX, cellY, palette->getCurrentColorIndex());
+                strokeLastX = cellX;
+                strokeLastY = cellY;
+            } else {
+                endStroke();
+            }
+        } else if (e.type == SDL_MOUSEBUTTONUP) {
+            if (e.button.button == SDL_BUTTON_LEFT) {
+                endStroke();
+            }
+        } else if (e.type == SDL_KEYDOWN) {
+            bool ctrl = (e.key.keysym.mod & KMOD_CTRL) != 0;
+            bool shift = (e.key.keysym.mod & KMOD_SHIFT) != 0;
+            
+            if (ctrl && e.key.keysym.sym == SDLK_z) {
+                endStroke();
+                if (shift) {
+                    history->redo(*editor, *palette);
+                } else {
+                    history->undo(*editor, *palette);
+                }
+            } else if (ctrl && e.key.keysym.sym == SDLK_y) {
+                endStroke();
+                history->redo(*editor, *palette);
+            } else if (ctrl && e.key.keysym.sym == SDLK_s) {
+                std::string path = getDataPath(SPRITE_FILE_NAME);
+                if (SpriteFile::save(path, *editor, *palette)) {
+                    std::cout << "Saved sprite to " << path << std::endl;
+                }
+            } else if (ctrl && e.key.keysym.sym == SDLK_o) {
+                // Loading is a regular edit: undoable and journaled, palette included
+                endStroke();
+                history->beginGroup(*editor);
+                Palette loadedPalette = *palette;
+                if (SpriteFile::load(getDataPath(SPRITE_FILE_NAME), *editor, loadedPalette)) {
+                    replacePalette(loadedPalette);
+                }
+                history->endGroup(*editor);
+            } else if (ctrl && e.key.keysym.sym == SDLK_p) {
+                // A GIMP palette if there is one, else a hex list; the grid keeps its indices
+                // where it can, and the palette change is undoable and journaled
+                std::string path = getDataPath(PALETTE_FILE_NAME);
+                if (!std::ifstream(path)) {
+                    path = getDataPath(PALETTE_HEX_FILE_NAME);
+                }
+                Palette loadedPalette;
+                if (Palette::loadFile(path, loadedPalette)) {
+                    endStroke();
+                    history->beginGroup(*editor);
+                    replacePalette(loadedPalette);
+                    history->endGroup(*editor);
+                    std::cout << "Loaded " << palette->getColorCount() << " colors from " << path << std::endl;
+                }
+            } else if (e.key.keysym.sym == SDLK_c) {
+                endStroke();
+                history->beginGroup(*editor);
+                editor->clear();
+                history->endGroup(*editor);
+            } else if (e.key.keysym.sym == SDLK_l) {
+                // Samples belong to the render side, which prints after its next present
+                reportRequested = true;
+            } else if (e.key.keysym.sym == SDLK_f) {
+                previewFiltered = !previewFiltered;
+            } else if (e.key.keysym.sym == SDLK_b) {
+                int mode = (previewBlend + 1) % BLEND_MODE_COUNT;
+                previewBlend = mode;
+                std::cout << "Blend mode: " << BlendTable::getName(static_cast<BlendMode>(mode)) << std::endl;
+            } else if (e.key.keysym.sym == SDLK_EQUALS || e.key.keysym.sym == SDLK_KP_PLUS) {
+                previewDepth = std::min(previewDepth + 1, MAX_PREVIEW_DEPTH);
+            } else if (e.key.keysym.sym == SDLK_MINUS || e.key.keysym.sym == SDLK_KP_MINUS) {
+                previewDepth = std::max(previewDepth - 1, 1);
+            }
+        }
+        
+        return editor->getRevision() != revisionBefore || palette->getRevision() != paletteRevisionBefore;
+    }
+    
+    // Close the undo step of the stroke in progress, if any
+    void endStroke() {
+        if (strokeActive) {
+            history->endGroup(*editor);
+            strokeActive = false;
+        }
+    }
+    
+    // Swap in new colors as part of the current undo step; pixels of colors the
+    // new palette lacks take the nearest color it has
+    void replacePalette(const Palette& replacement) {
+        Palette before = *palette;
+        int colorCount = replacement.getColorCount();
+        for (int y = 0; y < editor->getGridSize(); y++) {
+            for (int x = 0; x < editor->getGridSize(); x++) {
+                int index = editor->getPixel(x, y);
+                if (index >= colorCount) {
+                    editor->setPixel(x, y, replacement.findNearest(before.getColor(index), 1));
+                }
+            }
+        }
+        
+        palette->setColors(replacement.getColors());
+        history->recordPalette(before, *palette);
+        if (journal) {
+            journal->recordPalette(*palette);
+        }
+    }
+    
+    // PixelChangeListener: every change to the document goes through here
+    void onPixelChanged(int x, int y, int oldColor, int newColor) override {
+        history->record(x, y, oldColor, newColor);
+        if (journal) {
+            journal->recordPixel(x, y, newColor);
+        }
+    }
+    
+    // Location of a file in the per-user data directory
+    static std::string getDataPath(const std::string& fileName) {
+        std::string path = fileName;
+        char* prefPath = SDL_GetPrefPath("gmrodrigues", "PixelRecursor");
+        if (prefPath) {
+            path = std::string(prefPath) + path;
+            SDL_free(prefPath);
+        }
+        return path;
+    }
+    
+    // Handle one event of a batch, timestamping it if the next snapshot will reflect it
+    void dispatchEvent(const SDL_Event& e, bool& documentChanged) {
+        if (processEvent(e)) {
+            latencyTracker.markInput(e.common.timestamp, publishedSequence + 1);
+            documentChanged = true;
+        }
+    }
+    
+    // Drain the event queue; edits of the whole batch go out as a single snapshot,
+    // so a burst of motion events costs one re-render
     void handleEvents() {
         SDL_Event e;
+        bool documentChanged = false;
         while (SDL_PollEvent(&e)) {
-            if (e.type == SDL_QUIT) {
-                running = false;
-            } else if (e.type == SDL_MOUSEBUTTONDOWN) {
-                if (e.button.button == SDL_BUTTON_LEFT) {
-                    int mouseX = e.button.x;
-                    int mouseY = e.button.y;
-                    
-                    // Check if click is on palette
-                    if (palette->handleClick(mouseX, mouseY, PALETTE_X, PALETTE_Y, PALETTE_CELL_SIZE)) {
-                        // Palette selection handled
-                    }
-                    // Check if click is on editor grid
-                    else if (editor->handleClick(mouseX, mouseY, EDITOR_X, EDITOR_Y, 
-                                               EDITOR_CELL_SIZE, palette->getCurrentColorIndex())) {
-                        // Pixel edited
-                    }
-                }
-            } else if (e.type == SDL_KEYDOWN) {
-                if (e.key.keysym.sym == SDLK_c) {
-                    editor->clear();
-                }
+            dispatchEvent(e, documentChanged);
+        }
+        
+        if (documentChanged) {
+            publishSnapshot();
+        }
+    }
+    
+    // Copy the document into the triple buffer's free slot and hand it to the renderer
+    void publishSnapshot() {
+        EditorSnapshot& snapshot = snapshots.getWriteBuffer();
+        snapshot.editor = *editor;
+        snapshot.editor.setChangeListener(nullptr);  // Snapshots never report to the history
+        snapshot.palette = *palette;
+        snapshot.sequence = ++publishedSequence;
+        snapshots.publish();
+    }
+    
+#ifndef __EMSCRIPTEN__
+    // Main thread: pump events, hand them to the document thread, draw
+    void runMainLoop() {
+        while (running) {
+            forwardEvents();
+            waitForNextFrame();
+            render();
+        }
+    }
+    
+    // Move everything in the SDL queue to the document thread, then give it a
+    // moment to publish, so the frame about to be drawn shows this input
+    void forwardEvents() {
+        std::unique_lock<std::mutex> lock(eventMutex);
+        SDL_Event e;
+        while (SDL_PollEvent(&e)) {
+            pendingEvents.push_back(e);
+        }
+        if (pendingEvents.empty()) return;
+        
+        Uint64 batch = ++batchesForwarded;
+        eventCondition.notify_all();
+        eventCondition.wait_for(lock, std::chrono::milliseconds(INPUT_HANDOFF_TIMEOUT_MS),
+                                [this, batch] { return batchesHandled >= batch; });
+    }
+    
+    // Document thread: owns the document and everything that mutates it
+    void documentLoop() {
+        std::vector<SDL_Event> events;
+        while (true) {
+            Uint64 batch;
+            {
+                std::unique_lock<std::mutex> lock(eventMutex);
+                eventCondition.wait(lock, [this] { return !pendingEvents.empty() || !running; });
+                if (pendingEvents.empty()) break;
+                events.swap(pendingEvents);
+                batch = batchesForwarded;
+            }
+            
+            // Edits of the whole batch go out as a single snapshot
+            bool documentChanged = false;
+            for (const SDL_Event& e : events) {
+                dispatchEvent(e, documentChanged);
             }
+            events.clear();
+            if (documentChanged) {
+                publishSnapshot();
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(eventMutex);
+                batchesHandled = batch;
+            }
+            eventCondition.notify_all();
         }
     }
+#endif
     
     void render() {
+        snapshots.update();
+        const EditorSnapshot& snapshot = snapshots.read();
+        
         // Clear screen with dark background
         SDL_SetRenderDrawColor(renderer, 32, 32, 32, 255);
         SDL_RenderClear(renderer);
         
         // Render editor grid with actual colors
-        renderEditorGrid();
+        renderEditorGrid(snapshot);
         
         // Render palette
-        palette->render(renderer, PALETTE_X, PALETTE_Y, PALETTE_CELL_SIZE);
+        snapshot.palette.render(renderer, PALETTE_X, PALETTE_Y, PALETTE_CELL_SIZE);
         
         // Render recursive output
-        recursiveRenderer->render(renderer, *editor, *palette, RECURSIVE_X, RECURSIVE_Y);
+        recursiveRenderer->setDepth(previewDepth);
+        recursiveRenderer->setFiltered(previewFiltered);
+        recursiveRenderer->setBlendMode(static_cast<BlendMode>(previewBlend.load()));
+        recursiveRenderer->render(renderer, snapshot.editor, snapshot.palette, RECURSIVE_X, RECURSIVE_Y);
         
         
         SDL_RenderPresent(renderer);
+        latencyTracker.markPresent(snapshot.sequence);
+        
+        if (reportRequested.exchange(false)) {
+            latencyTracker.report(std::cout);
+            
+            const RenderCache& cache = recursiveRenderer->getCache();
+            std::cout << "Render cache: " << cache.getHits() << " hits, " << cache.getMisses() << " misses, "
+                      << cache.getEntryCount() << " renders in " << (cache.getBytesUsed() >> 10) << " KB"
+                      << std::endl;
+        }
     }
     
-    void renderEditorGrid() {
-        const auto& pixelData = editor->getPixelData();
-        
+    void renderEditorGrid(const EditorSnapshot& snapshot) {
         for (int y = 0; y < 8; y++) {
             for (int x = 0; x < 8; x++) {
                 SDL_Rect rect = {
@@ -103,8 +409,8 @@ public:
                 };
                 
                 // Fill with pixel color
-                int colorIndex = pixelData[y][x];
-                SDL_Color color = palette->getColor(colorIndex);
+                int colorIndex = snapshot.editor.getPixel(x, y);
+                SDL_Color color = snapshot.palette.getColor(colorIndex);
                 SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
                 SDL_RenderFillRect(renderer, &rect);
                 
@@ -120,10 +426,44 @@ public:
         render();
     }
     
+    // Pace frames before drawing rather than after presenting, so the newest edits
+    // are drawn and presented right away. With vsync the present already blocks.
+    void waitForNextFrame() {
+        if (!vsyncEnabled) {
+            Uint32 elapsed = SDL_GetTicks() - lastFrameTicks;
+            if (elapsed < FRAME_TIME_MS) {
+                SDL_Delay(FRAME_TIME_MS - elapsed);
+            }
+        }
+        lastFrameTicks = SDL_GetTicks();
+    }
+    
     bool isRunning() const { return running; }
     
     void cleanup() {
+#ifndef __EMSCRIPTEN__
+        {
+            std::lock_guard<std::mutex> lock(eventMutex);
+            running = false;
+        }
+        eventCondition.notify_all();
+        if (documentThread.joinable()) {
+            documentThread.join();
+        }
+#else
+        running = false;
+#endif
+        
+        if (journal) {
+            journal->close();
+        }
+        
+        if (latencyTracker.getSampleCount() > 0) {
+            latencyTracker.report(std::cout);
+        }
+
         if (renderer) {
+            recursiveRenderer->releaseTexture();
             SDL_DestroyRenderer(renderer);
         }
         if (window) {
@@ -143,14 +483,51 @@ private:
     static const int PALETTE_Y = 450;
     static const int RECURSIVE_X = 400;
     static const int RECURSIVE_Y = 80;
+    static const Uint32 FRAME_TIME_MS = 16;  // ~60 FPS when vsync is unavailable
+    static constexpr int INPUT_HANDOFF_TIMEOUT_MS = 4;  // Longest a frame waits for its input to be applied
+    static constexpr int MAX_PREVIEW_DEPTH = 8;
+    static constexpr int BLEND_MODE_COUNT = 5;
+    static constexpr const char* SPRITE_FILE_NAME = "sprite.rps";
+    static constexpr const char* PALETTE_FILE_NAME = "palette.gpl";
+    static constexpr const char* PALETTE_HEX_FILE_NAME = "palette.hex";
+    
+    std::atomic<bool> running;
+    bool vsyncEnabled;
+    Uint32 lastFrameTicks;
+    std::atomic<bool> reportRequested;
+    std::atomic<int> previewDepth;  // Set by the document thread, read when drawing
+    std::atomic<bool> previewFiltered;
+    std::atomic<int> previewBlend;  // A BlendMode
+    Uint64 publishedSequence;
+    
+    // Stroke in progress, in grid cells
+    bool strokeActive;
+    int strokeLastX;
+    int strokeLastY;
     
-    bool running;
     SDL_Window* window;
     SDL_Renderer* renderer;
     
+    // Document state, owned by the document thread
     std::unique_ptr<PixelEditor> editor;
     std::unique_ptr<Palette> palette;
+    std::unique_ptr<EditHistory> history;
+    std::unique_ptr<SessionJournal> journal;
+    
+    // Owned by the main thread
     std::unique_ptr<RecursiveRenderer> recursiveRenderer;
+    
+    TripleBuffer<EditorSnapshot> snapshots;
+    LatencyTracker latencyTracker;
+    
+#ifndef __EMSCRIPTEN__
+    std::thread documentThread;
+    std::mutex eventMutex;
+    std::condition_variable eventCondition;
+    std::vector<SDL_Event> pendingEvents;  // Pumped by the main thread, not yet applied
+    Uint64 batchesForwarded = 0;
+    Uint64 batchesHandled = 0;
+#endif
 };
 
 // Global app instance for Emscripten
@@ -167,10 +544,16 @@ void mainLoop() {
 #endif
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+#ifndef __EMSCRIPTEN__
+    if (CommandLine::isHeadless(argc, argv)) {
+        return CommandLine::run(argc, argv);
+    }
+#endif
+    
     g_app = new PixelRecursorApp();
     
-    if (!g_app->initialize()) {
+    if (!g_app->initialize(argc, argv)) {
         std::cerr << "Failed to initialize application!" << std::endl;
         delete g_app;
         return -1;
@@ -180,11 +563,8 @@ int main() {
     // Set up main loop for Emscripten
     emscripten_set_main_loop(mainLoop, 60, 1);
 #else
-    // Native main loop
-    while (g_app->isRunning()) {
-        g_app->update();
-        SDL_Delay(16); // ~60 FPS
-    }
+    // Native: this thread pumps events and draws while the document thread edits
+    g_app->runMainLoop();
 #endif
     
     g_app->cleanup();
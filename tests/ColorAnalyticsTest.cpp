@@ -0,0 +1,161 @@
+// Checks ColorAnalytics against a brute-force count of the rendered output:
+// random sprites, palettes, blend modes and rules, whole outputs, random
+// regions and grids of cells. Exits non-zero on the first mismatch.
+#include <SDL2/SDL.h>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "BlendTable.h"
+#include "ColorAnalytics.h"
+#include "Palette.h"
+#include "RecursiveExpander.h"
+
+namespace {
+
+struct Case {
+    int gridSize;
+    int depth;
+    std::vector<Uint8> base;
+    Palette palette;
+    BlendMode blend;
+    std::vector<std::vector<Uint8>> rules;
+};
+
+// Pixels of each state in [x, x + width) x [y, y + height) of a rendered output
+std::vector<Uint64> countImage(const std::vector<Uint8>& image, int size, int stateCount,
+                               int x, int y, int width, int height) {
+    std::vector<Uint64> counts(stateCount, 0);
+    for (int row = y; row < y + height; row++) {
+        for (int column = x; column < x + width; column++) {
+            counts[image[static_cast<size_t>(row) * size + column]]++;
+        }
+    }
+    return counts;
+}
+
+bool matches(const ColorCounts& counts, const std::vector<Uint64>& expected, const char* what, int caseIndex) {
+    Uint64 total = 0;
+    for (Uint64 count : expected) {
+        total += count;
+    }
+    if (counts.pixels == expected && counts.total == total) return true;
+
+    std::fprintf(stderr, "Case %d: %s counts differ from the rendered output\n", caseIndex, what);
+    for (size_t state = 0; state < expected.size() && state < counts.pixels.size(); state++) {
+        if (counts.pixels[state] != expected[state]) {
+            std::fprintf(stderr, "  state %zu: %llu, expected %llu\n", state,
+                         static_cast<unsigned long long>(counts.pixels[state]),
+                         static_cast<unsigned long long>(expected[state]));
+        }
+    }
+    return false;
+}
+
+// Edge index of a region split into parts, as countGrid places it
+int cellEdge(int origin, int extent, int index, int parts) {
+    return origin + extent / parts * index + extent % parts * index / parts;
+}
+
+Case makeCase(std::mt19937& random) {
+    Case test;
+    test.gridSize = 2 + static_cast<int>(random() % 3);
+    test.depth = 1 + static_cast<int>(random() % (test.gridSize == 2 ? 6 : 4));
+
+    int colorCount = 2 + static_cast<int>(random() % 5);
+    std::vector<SDL_Color> colors(colorCount);
+    for (SDL_Color& color : colors) {
+        color = SDL_Color{static_cast<Uint8>(random()), static_cast<Uint8>(random()),
+                          static_cast<Uint8>(random()), 255};
+    }
+    test.palette = Palette(colors);
+    test.blend = static_cast<BlendMode>(random() % 5);
+
+    int cells = test.gridSize * test.gridSize;
+    test.base.resize(cells);
+    for (Uint8& index : test.base) {
+        index = static_cast<Uint8>(random() % colorCount);
+    }
+
+    // Some colors, the background included, expand into a grid of their own
+    if (random() % 2 == 0) {
+        test.rules.resize(colorCount);
+        for (std::vector<Uint8>& rule : test.rules) {
+            if (random() % 3 != 0) continue;
+            rule.resize(cells);
+            for (Uint8& index : rule) {
+                index = static_cast<Uint8>(random() % colorCount);
+            }
+        }
+    }
+    return test;
+}
+
+}
+
+int main() {
+    std::mt19937 random(12345);
+    const int caseCount = 200;
+    const int regionsPerCase = 25;
+
+    for (int caseIndex = 0; caseIndex < caseCount; caseIndex++) {
+        Case test = makeCase(random);
+        BlendTable blend(test.palette, test.blend);
+
+        RecursiveExpander rendered(test.base.data(), test.gridSize, test.depth, blend, test.rules);
+        int size = rendered.getOutputSize();
+        std::vector<Uint8> image(static_cast<size_t>(size) * size);
+        rendered.expandRows(0, size, image.data(), size);
+
+        RecursiveExpander expander(test.base.data(), test.gridSize, 1, blend, test.rules);
+        ColorAnalytics analytics(expander, test.depth);
+        int stateCount = analytics.getStateCount();
+        if (analytics.getTableDepth() < test.depth) {
+            std::fprintf(stderr, "Case %d: no region tables for depth %d\n", caseIndex, test.depth);
+            return 1;
+        }
+
+        ColorCounts counts;
+        if (!analytics.countColors(test.depth, counts) ||
+            !matches(counts, countImage(image, size, stateCount, 0, 0, size, size), "whole output", caseIndex)) {
+            return 1;
+        }
+
+        for (int query = 0; query < regionsPerCase; query++) {
+            int x = static_cast<int>(random() % (size + 1));
+            int y = static_cast<int>(random() % (size + 1));
+            int width = static_cast<int>(random() % (size - x + 1));
+            int height = static_cast<int>(random() % (size - y + 1));
+
+            if (!analytics.countRegion(test.depth, x, y, width, height, counts) ||
+                !matches(counts, countImage(image, size, stateCount, x, y, width, height), "region", caseIndex)) {
+                return 1;
+            }
+
+            int columns = 1 + static_cast<int>(random() % 3);
+            int rows = 1 + static_cast<int>(random() % 3);
+            std::vector<ColorCounts> cells;
+            if (!analytics.countGrid(test.depth, x, y, width, height, columns, rows, cells) ||
+                cells.size() != static_cast<size_t>(columns * rows)) {
+                std::fprintf(stderr, "Case %d: grid query failed\n", caseIndex);
+                return 1;
+            }
+
+            for (int row = 0; row < rows; row++) {
+                for (int column = 0; column < columns; column++) {
+                    int left = cellEdge(x, width, column, columns);
+                    int top = cellEdge(y, height, row, rows);
+                    int right = cellEdge(x, width, column + 1, columns);
+                    int bottom = cellEdge(y, height, row + 1, rows);
+                    std::vector<Uint64> expected = countImage(image, size, stateCount, left, top,
+                                                              right - left, bottom - top);
+                    if (!matches(cells[row * columns + column], expected, "grid cell", caseIndex)) {
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+
+    std::printf("%d cases of %d regions match the rendered output\n", caseCount, regionsPerCase);
+    return 0;
+}